@@ -5,18 +5,154 @@
 #include <algorithm>
 #include <cmath>
 #include <math.h>
+#include "lanes.h"
+
+template <typename Scalar>
+using Vec2 = Eigen::Matrix<Scalar, 2, 1>;
 
 typedef Eigen::Vector2f vec2;
+typedef Eigen::Vector2d vec2d;
 
-float angleBetween (vec2 a, vec2 b) {
-    float theta = a.dot(b) / (a.norm() * b.norm());
-    theta = std::min(1.0f, std::max(-1.0f, theta));
-    return std::acos(theta);
+// The templates below are the implementations for any scalar type,
+// the float overloads also accept Eigen expressions as arguments.
+
+// z component of the 3D cross product, positive if b is counter-clockwise of a
+template <typename Scalar>
+Scalar cross (Vec2<Scalar> a, Vec2<Scalar> b) {
+    return a[0] * b[1] - a[1] * b[0];
 }
 
-float angleBetweenWithDirection (vec2 a, vec2 aDirection, vec2 b) {
-    float simpleAngle = angleBetween(a, b);
-    vec2 linearDirection = (b - a).normalized();
+// FAST ANGLES
+// Polynomial atan2 and acos, evaluated in float. The polynomials (Abramowitz & Stegun 4.4.49
+// for atan, 4.4.46 for acos) are within 2.2e-8 rad, with float rounding the results are within
+// FAST_ANGLE_MAX_ERROR of std::atan2 and std::acos. An angle error e moves an arc offset by
+// e * radius, so offsets stay within thickness on arcs with radii up to
+// thickness / FAST_ANGLE_MAX_ERROR, which is 100 for the float thickness.
+// Defining COMPASS_FAST_ANGLES makes the float angleBetween use them.
+
+#ifdef COMPASS_FAST_ANGLES
+const bool FAST_ANGLES = true;
+#else
+const bool FAST_ANGLES = false;
+#endif
+
+const float FAST_ANGLE_MAX_ERROR = 0.000001;
+
+// atan(t) = t * sum(c[i] * t^2i) for t in [0, 1]
+const float FAST_ATAN_COEFFICIENTS[] = {
+        1.0f, -0.3333314528f, 0.1999355085f, -0.1420889944f, 0.1065626393f,
+        -0.0752896400f, 0.0429096138f, -0.0161657367f, 0.0028662257f
+};
+const int FAST_ATAN_DEGREE = 9;
+
+// acos(x) = sqrt(1 - x) * sum(c[i] * x^i) for x in [0, 1]
+const float FAST_ACOS_COEFFICIENTS[] = {
+        1.5707963050f, -0.2145988016f, 0.0889789874f, -0.0501743046f,
+        0.0308918810f, -0.0170881256f, 0.0066700901f, -0.0012624911f
+};
+const int FAST_ACOS_DEGREE = 8;
+
+float fastAtan2 (float y, float x) {
+    float ax = std::abs(x), ay = std::abs(y);
+    float larger = std::max(ax, ay);
+    if (larger == 0) return 0;
+    float t = std::min(ax, ay) / larger;
+    float t2 = t * t;
+    float sum = FAST_ATAN_COEFFICIENTS[FAST_ATAN_DEGREE - 1];
+    for (int i = FAST_ATAN_DEGREE - 2; i >= 0; i--) sum = sum * t2 + FAST_ATAN_COEFFICIENTS[i];
+    float angle = sum * t;
+
+    if (ay > ax) angle = float(M_PI / 2) - angle;
+    if (x < 0) angle = float(M_PI) - angle;
+    return std::copysign(angle, y);
+}
+
+// x is expected in [-1, 1]
+float fastAcos (float x) {
+    float ax = std::abs(x);
+    float sum = FAST_ACOS_COEFFICIENTS[FAST_ACOS_DEGREE - 1];
+    for (int i = FAST_ACOS_DEGREE - 2; i >= 0; i--) sum = sum * ax + FAST_ACOS_COEFFICIENTS[i];
+    float angle = std::sqrt(1 - ax) * sum;
+    return x < 0 ? float(M_PI) - angle : angle;
+}
+
+Lanes lanesFastAtan2 (Lanes y, Lanes x) {
+    auto zero = lanesBroadcast(0);
+    auto ax = lanesAbs(x), ay = lanesAbs(y);
+    auto larger = lanesMax(ax, ay);
+    auto isZero = lanesLessOrEqual(larger, zero);
+    auto t = lanesMin(ax, ay) / lanesSelect(isZero, lanesBroadcast(1), larger);
+
+    auto t2 = t * t;
+    auto sum = lanesBroadcast(FAST_ATAN_COEFFICIENTS[FAST_ATAN_DEGREE - 1]);
+    for (int i = FAST_ATAN_DEGREE - 2; i >= 0; i--) sum = sum * t2 + lanesBroadcast(FAST_ATAN_COEFFICIENTS[i]);
+    auto angle = sum * t;
+
+    angle = lanesSelect(lanesGreater(ay, ax), lanesBroadcast(M_PI / 2) - angle, angle);
+    angle = lanesSelect(lanesLess(x, zero), lanesBroadcast(M_PI) - angle, angle);
+    angle = lanesSelect(lanesLess(y, zero), zero - angle, angle);
+    return lanesAndNot(isZero, angle);
+}
+
+Lanes lanesFastAcos (Lanes x) {
+    auto ax = lanesAbs(x);
+    auto sum = lanesBroadcast(FAST_ACOS_COEFFICIENTS[FAST_ACOS_DEGREE - 1]);
+    for (int i = FAST_ACOS_DEGREE - 2; i >= 0; i--) sum = sum * ax + lanesBroadcast(FAST_ACOS_COEFFICIENTS[i]);
+    auto angle = lanesSqrt(lanesBroadcast(1) - ax) * sum;
+    return lanesSelect(lanesLess(x, lanesBroadcast(0)), lanesBroadcast(M_PI) - angle, angle);
+}
+
+// out[i] = fastAtan2(ys[i], xs[i]), LANE_COUNT at a time
+void fastAtan2s (const float* ys, const float* xs, float* out, int n) {
+    int i = 0;
+    for (; i + LANE_COUNT <= n; i += LANE_COUNT) lanesStore(out + i, lanesFastAtan2(lanesLoad(ys + i), lanesLoad(xs + i)));
+    for (; i < n; i++) out[i] = fastAtan2(ys[i], xs[i]);
+}
+
+// out[i] = fastAcos(xs[i]), LANE_COUNT at a time
+void fastAcoss (const float* xs, float* out, int n) {
+    int i = 0;
+    for (; i + LANE_COUNT <= n; i += LANE_COUNT) lanesStore(out + i, lanesFastAcos(lanesLoad(xs + i)));
+    for (; i < n; i++) out[i] = fastAcos(xs[i]);
+}
+
+// the acos angleBetween uses, only float has a fast path
+template <typename Scalar>
+Scalar angleAcos (Scalar x) {
+    using std::acos;
+    return acos(x);
+}
+
+template <>
+float angleAcos (float x) {
+    return FAST_ANGLES ? fastAcos(x) : std::acos(x);
+}
+
+// PSEUDO ANGLES
+// For comparing and sorting angles without any trigonometry
+
+// in [0, 4), increasing monotonically with the counter-clockwise angle of v from the
+// x axis in [0, 2 pi), undefined for the zero vector
+template <typename Scalar>
+Scalar diamondAngle (Vec2<Scalar> v) {
+    Scalar x = v[0], y = v[1];
+    if (y >= 0) return x >= 0 ? y / (x + y) : 1 - x / (y - x);
+    else return x < 0 ? 2 - y / (-x - y) : 3 + x / (x - y);
+}
+
+// ANGLES
+
+template <typename Scalar>
+Scalar angleBetween (Vec2<Scalar> a, Vec2<Scalar> b) {
+    Scalar theta = a.dot(b) / (a.norm() * b.norm());
+    theta = std::min(Scalar(1), std::max(Scalar(-1), theta));
+    return angleAcos(theta);
+}
+
+template <typename Scalar>
+Scalar angleBetweenWithDirection (Vec2<Scalar> a, Vec2<Scalar> aDirection, Vec2<Scalar> b) {
+    Scalar simpleAngle = angleBetween<Scalar>(a, b);
+    Vec2<Scalar> linearDirection = (b - a).normalized();
 
     if (aDirection.dot(linearDirection) >= 0) {
         return simpleAngle;
@@ -25,4 +161,24 @@ float angleBetweenWithDirection (vec2 a, vec2 aDirection, vec2 b) {
     }
 }
 
+// The diamond angle from a to b, turning the way aDirection points from a, ordered like
+// angleBetweenWithDirection for a and b of the same length, like points on one circle
+template <typename Scalar>
+Scalar pseudoAngleBetweenWithDirection (Vec2<Scalar> a, Vec2<Scalar> aDirection, Vec2<Scalar> b) {
+    Scalar turn = cross(a, aDirection) >= 0 ? 1 : -1;
+    return diamondAngle(Vec2<Scalar>(a.dot(b), turn * cross(a, b)));
+}
+
+float cross (vec2 a, vec2 b) {
+    return cross<float>(a, b);
+}
+
+float angleBetween (vec2 a, vec2 b) {
+    return angleBetween<float>(a, b);
+}
+
+float angleBetweenWithDirection (vec2 a, vec2 aDirection, vec2 b) {
+    return angleBetweenWithDirection<float>(a, aDirection, b);
+}
+
 #endif //COMPASS_ANGLES_H
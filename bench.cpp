@@ -0,0 +1,1140 @@
+#include <cstring>
+#include <sstream>
+#include "bench.h"
+#include "primitives.h"
+#include "intersections.h"
+#include "segment-batch.h"
+#include "intersect-all.h"
+#include "clipper.h"
+#include "primitive-dispatch.h"
+#include "predicates.h"
+#include "fixed-point.h"
+#include "intersection-graph.h"
+#include "straight-skeleton.h"
+#include "segment-bvh.h"
+#include "segment-file.h"
+#include "tessellation.h"
+#include "buffer.h"
+#include "overlap.h"
+#include "whiteboard/whiteboard.h"
+#include "whiteboard-compass.h"
+
+typedef Eigen::Vector2f vec2;
+
+const int N = 1000000;
+const int M = 1024;
+
+// What constrainToArc() did before the arc kernel: contains() and offsetAt() on their own, each with its trig
+bool constrainViaContains (Intersection& i, Segment& a) {
+    if (!a.contains(i.position)) return false;
+    i.alongA = std::min(std::max(a.offsetAt(i.position), 0.0f), a.length());
+    return true;
+}
+
+// Pairs with an arc the way intersect(Segment, Segment) solved them before the arc kernel, for comparison:
+// full circles with offsets along them, then every arc filters and remaps on its own
+int intersectViaCircles (Segment& a, Segment& b) {
+    Circle circleA(a.radialCenter(), a.radius()), circleB(b.radialCenter(), b.radius());
+    Intersection candidates[2];
+    int n;
+    if (a.isStraight()) {
+        Line lineA(a.start, a.direction);
+        n = writeIntersections(lineA, circleB, candidates);
+    } else {
+        if (b.isStraight()) {
+            Line lineB(b.start, b.direction);
+            n = writeIntersections(lineB, circleA, candidates);
+        } else {
+            n = writeIntersections(circleB, circleA, candidates);
+        }
+        for (int k = 0; k < n; k++) std::swap(candidates[k].alongA, candidates[k].alongB);
+    }
+
+    int kept = 0;
+    for (int k = 0; k < n; k++) {
+        auto& i = candidates[k];
+        if (!(a.isStraight() ? constrainToSegment(i, a) : constrainViaContains(i, a))) continue;
+        std::swap(i.alongA, i.alongB);
+        if (b.isStraight() ? constrainToSegment(i, b) : constrainViaContains(i, b)) kept++;
+    }
+    return kept;
+}
+
+void benchmarkIntersections () {
+    auto lines = randomLines(M, 1);
+    auto otherLines = randomLines(M, 2);
+    auto rays = randomRays(M, 3);
+    auto otherRays = randomRays(M, 4);
+    auto circles = randomCircles(M, 5);
+    auto otherCircles = randomCircles(M, 6);
+    auto lineSegments = randomLineSegments(M, 7);
+    auto otherLineSegments = randomLineSegments(M, 8);
+    auto arcs = randomArcs(M, 9);
+    auto otherArcs = randomArcs(M, 10);
+    auto tiny = tinyArcs(M, 11);
+
+    std::vector<Line> parallelLines, otherParallelLines;
+    nearParallelLines(M, 12, parallelLines, otherParallelLines);
+    std::vector<Circle> tangent, otherTangent;
+    tangentCircles(M, 13, tangent, otherTangent);
+
+    // FUNDAMENTAL INTERSECTIONS
+
+    benchmark("intersect(Line, Line)", "random", N, [&](int i) {
+        return intersect(lines[i % M], otherLines[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Line, Line)", "near-parallel", N, [&](int i) {
+        return intersect(parallelLines[i % M], otherParallelLines[i % M]).size();
+    });
+    benchmark("intersect(Circle, Circle)", "random", N, [&](int i) {
+        return intersect(circles[i % M], otherCircles[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Circle, Circle)", "tangent", N, [&](int i) {
+        return intersect(tangent[i % M], otherTangent[i % M]).size();
+    });
+    benchmark("intersect(Line, Circle)", "random", N, [&](int i) {
+        return intersect(lines[i % M], circles[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Circle, Line)", "random", N, [&](int i) {
+        return intersect(circles[i % M], lines[(i * 7) % M]).size();
+    });
+
+    // CONSTRAINED INTERSECTIONS
+
+    benchmark("intersect(Ray, Ray)", "random", N, [&](int i) {
+        return intersect(rays[i % M], otherRays[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Ray, Line)", "random", N, [&](int i) {
+        return intersect(rays[i % M], lines[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Line, Ray)", "random", N, [&](int i) {
+        return intersect(lines[i % M], rays[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Ray, Circle)", "random", N, [&](int i) {
+        return intersect(rays[i % M], circles[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Circle, Ray)", "random", N, [&](int i) {
+        return intersect(circles[i % M], rays[(i * 7) % M]).size();
+    });
+
+    benchmark("intersect(Segment, Line)", "line", N, [&](int i) {
+        return intersect(lineSegments[i % M], lines[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Segment, Line)", "arc", N, [&](int i) {
+        return intersect(arcs[i % M], lines[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Line, Segment)", "line", N, [&](int i) {
+        return intersect(lines[i % M], lineSegments[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Line, Segment)", "arc", N, [&](int i) {
+        return intersect(lines[i % M], arcs[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Segment, Ray)", "line", N, [&](int i) {
+        return intersect(lineSegments[i % M], rays[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Segment, Ray)", "arc", N, [&](int i) {
+        return intersect(arcs[i % M], rays[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Ray, Segment)", "line", N, [&](int i) {
+        return intersect(rays[i % M], lineSegments[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Ray, Segment)", "arc", N, [&](int i) {
+        return intersect(rays[i % M], arcs[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Segment, Circle)", "line", N, [&](int i) {
+        return intersect(lineSegments[i % M], circles[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Segment, Circle)", "arc", N, [&](int i) {
+        return intersect(arcs[i % M], circles[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Circle, Segment)", "line", N, [&](int i) {
+        return intersect(circles[i % M], lineSegments[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Circle, Segment)", "arc", N, [&](int i) {
+        return intersect(circles[i % M], arcs[(i * 7) % M]).size();
+    });
+
+    benchmark("intersect(Segment, Segment)", "line-line", N, [&](int i) {
+        return intersect(lineSegments[i % M], otherLineSegments[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Segment, Segment)", "line-arc", N, [&](int i) {
+        return intersect(lineSegments[i % M], arcs[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Segment, Segment)", "arc-line", N, [&](int i) {
+        return intersect(arcs[i % M], lineSegments[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Segment, Segment)", "arc-arc", N, [&](int i) {
+        return intersect(arcs[i % M], otherArcs[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Segment, Segment)", "tiny-line", N, [&](int i) {
+        return intersect(tiny[i % M], lineSegments[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Segment, Segment)", "tiny-tiny", N, [&](int i) {
+        return intersect(tiny[i % M], tiny[(i * 7 + 1) % M]).size();
+    });
+
+    // the same pairs through the sink, as the bulk queries use it
+    int sunk = 0;
+    auto countSunk = [&](Intersection&) { sunk++; };
+    benchmark("intersectInto(Segment, Segment)", "line-line", N, [&](int i) {
+        intersectInto(lineSegments[i % M], otherLineSegments[(i * 7) % M], countSunk);
+        return sunk;
+    });
+    benchmark("intersectInto(Segment, Segment)", "line-arc", N, [&](int i) {
+        intersectInto(lineSegments[i % M], arcs[(i * 7) % M], countSunk);
+        return sunk;
+    });
+    benchmark("intersectInto(Segment, Segment)", "arc-line", N, [&](int i) {
+        intersectInto(arcs[i % M], lineSegments[(i * 7) % M], countSunk);
+        return sunk;
+    });
+    benchmark("intersectInto(Segment, Segment)", "arc-arc", N, [&](int i) {
+        intersectInto(arcs[i % M], otherArcs[(i * 7) % M], countSunk);
+        return sunk;
+    });
+
+    // the arc sides through circles, as before the arc kernel
+    benchmark("intersectViaCircles(Segment, Segment)", "line-arc", N, [&](int i) {
+        return intersectViaCircles(lineSegments[i % M], arcs[(i * 7) % M]);
+    });
+    benchmark("intersectViaCircles(Segment, Segment)", "arc-line", N, [&](int i) {
+        return intersectViaCircles(arcs[i % M], lineSegments[(i * 7) % M]);
+    });
+    benchmark("intersectViaCircles(Segment, Segment)", "arc-arc", N, [&](int i) {
+        return intersectViaCircles(arcs[i % M], otherArcs[(i * 7) % M]);
+    });
+}
+
+void benchmarkSegmentMethods (const char* inputs, std::vector<Segment>& segments) {
+    auto points = randomPoints(M, 20);
+
+    benchmark("Segment::Segment", inputs, N, [&](int i) {
+        auto& segment = segments[i % M];
+        return Segment(segment.start, segment.direction, segment.end).length();
+    });
+    benchmark("Segment::length", inputs, N, [&](int i) {
+        return segments[i % M].length();
+    });
+    benchmark("Segment::radialCenter", inputs, N, [&](int i) {
+        return segments[i % M].radialCenter()[0];
+    });
+    benchmark("Segment::radius", inputs, N, [&](int i) {
+        return segments[i % M].radius();
+    });
+    benchmark("Segment::midpoint", inputs, N, [&](int i) {
+        return segments[i % M].midpoint()[0];
+    });
+    benchmark("Segment::endDirection", inputs, N, [&](int i) {
+        return segments[i % M].endDirection()[0];
+    });
+    benchmark("Segment::directionOf", inputs, N, [&](int i) {
+        auto& segment = segments[i % M];
+        return segment.directionOf(0.5f * segment.length())[0];
+    });
+    benchmark("Segment::offsetAt", inputs, N, [&](int i) {
+        return segments[i % M].offsetAt(points[(i * 7) % M]);
+    });
+    benchmark("Segment::distanceTo", inputs, N, [&](int i) {
+        return segments[i % M].distanceTo(points[(i * 7) % M]);
+    });
+    benchmark("Segment::contains", inputs, N, [&](int i) {
+        return segments[i % M].contains(points[(i * 7) % M]);
+    });
+    benchmark("Segment::reverse", inputs, N, [&](int i) {
+        return segments[i % M].reverse().length();
+    });
+    benchmark("Segment::subdivide", inputs, N, [&](int i) {
+        auto& segment = segments[i % M];
+        return segment.subdivide(segment.midpoint())[1].length();
+    });
+}
+
+void benchmarkCompactSegmentMethods (const char* inputs, std::vector<Segment>& segments) {
+    auto points = randomPoints(M, 20);
+    std::vector<CompactSegment> compactSegments(segments.begin(), segments.end());
+
+    benchmark("CompactSegment::midpoint", inputs, N, [&](int i) {
+        return compactSegments[i % M].midpoint()[0];
+    });
+    benchmark("CompactSegment::directionOf", inputs, N, [&](int i) {
+        auto& segment = compactSegments[i % M];
+        return segment.directionOf(0.5f * segment.length())[0];
+    });
+    benchmark("CompactSegment::offsetAt", inputs, N, [&](int i) {
+        return compactSegments[i % M].offsetAt(points[(i * 7) % M]);
+    });
+    benchmark("CompactSegment::distanceTo", inputs, N, [&](int i) {
+        return compactSegments[i % M].distanceTo(points[(i * 7) % M]);
+    });
+    benchmark("CompactSegment::contains", inputs, N, [&](int i) {
+        return compactSegments[i % M].contains(points[(i * 7) % M]);
+    });
+}
+
+void benchmarkPaths () {
+    Path lane(randomLane(M, 44));
+    Generator generator(45);
+    std::vector<float> offsets;
+    for (int i = 0; i < 4096; i++) offsets.push_back(lane.length() * randomCoordinate(generator));
+
+    benchmark("Path::pointAt", "lane of 1024", N, [&](int i) {
+        return lane.pointAt(offsets[i % offsets.size()])[0];
+    });
+    // what pointAt did before the offset table, for comparison
+    benchmark("Path::pointAt linear scan", "lane of 1024", N / 100, [&](int i) {
+        float offset = offsets[i % offsets.size()];
+        int s = 0;
+        while (s + 1 < lane.segments.size() && offset > lane.segments[s].length()) {
+            offset -= lane.segments[s].length();
+            s++;
+        }
+        return lane.segments[s].pointAt(offset)[0];
+    });
+    benchmark("Path::directionAt", "lane of 1024", N, [&](int i) {
+        return lane.directionAt(offsets[i % offsets.size()])[0];
+    });
+    auto points = randomPoints(M, 46);
+    benchmark("Path::offsetAt", "lane of 1024", N / 100, [&](int i) {
+        return lane.offsetAt(100 * points[i % M]);
+    });
+
+    // one op is a whole update of 4096 vehicles
+    std::vector<float> sortedOffsets = offsets;
+    std::sort(sortedOffsets.begin(), sortedOffsets.end());
+    std::vector<vec2> pointsAlong, directions;
+    benchmark("Path::pointsAndDirectionsAt", "lane of 1024, 4096 random", 1000, [&](int i) {
+        lane.pointsAndDirectionsAt(offsets, pointsAlong, directions);
+        return pointsAlong[i % pointsAlong.size()][0];
+    });
+    benchmark("Path::pointsAndDirectionsAt", "lane of 1024, 4096 sorted", 1000, [&](int i) {
+        lane.pointsAndDirectionsAt(sortedOffsets, pointsAlong, directions);
+        return pointsAlong[i % pointsAlong.size()][0];
+    });
+}
+
+void benchmarkSegmentBVH () {
+    auto lane = randomLane(M, 49);
+    SegmentBVH laneBVH(lane);
+    std::vector<vec2> points;
+    for (auto& point : randomPoints(M, 50)) points.push_back(vec2(60 * point[0], 40 * point[1] - 20));
+
+    benchmark("SegmentBVH::nearest", "lane of 1024", N / 10, [&](int i) {
+        return laneBVH.nearest(points[i % M]);
+    });
+    benchmark("nearest brute force", "lane of 1024", N / 1000, [&](int i) {
+        int nearest = 0;
+        float distance = INFINITY;
+        for (int s = 0; s < lane.size(); s++) {
+            float d = lane[s].distanceTo(points[i % M]);
+            if (d < distance) {
+                nearest = s;
+                distance = d;
+            }
+        }
+        return nearest;
+    });
+    std::vector<std::pair<float, int>> kNearest;
+    benchmark("SegmentBVH::kNearest", "lane of 1024, k = 8", N / 10, [&](int i) {
+        laneBVH.kNearest(points[i % M], 8, kNearest);
+        return kNearest[0].second;
+    });
+
+    // one op is a whole cursor path of 1024 points in small steps
+    std::vector<vec2> cursor;
+    Generator generator(51);
+    vec2 position(0, 0);
+    for (int i = 0; i < M; i++) {
+        position += 0.1f * randomDirection(generator);
+        cursor.push_back(position);
+    }
+    std::vector<int> nearest;
+    benchmark("SegmentBVH::nearestMany", "lane of 1024, cursor of 1024", 1000, [&](int i) {
+        laneBVH.nearestMany(cursor, nearest);
+        return nearest[i % M];
+    });
+    benchmark("SegmentBVH::nearest", "lane of 1024, cursor of 1024", 1000, [&](int i) {
+        int sum = 0;
+        for (auto& point : cursor) sum += laneBVH.nearest(point);
+        return sum;
+    });
+
+    // a block of 100 buildings, with rounded corners
+    std::vector<Path> buildings;
+    Generator buildingGenerator(52);
+    for (int b = 0; b < 100; b++) {
+        auto footprint = randomFootprint(buildingGenerator);
+        std::vector<Segment> outline;
+        for (int c = 0; c < footprint.size(); c++) {
+            vec2 start = footprint[c], end = footprint[(c + 1) % footprint.size()];
+            vec2 direction = Eigen::Rotation2D<float>(c % 2 ? 0.2f : 0) * vec2((end - start).normalized());
+            outline.push_back(Segment(start, direction, end));
+        }
+        buildings.push_back(Path(outline));
+    }
+    SegmentBVH buildingsBVH(buildings);
+    std::vector<vec2> blockPoints;
+    for (auto& point : randomPoints(M, 53)) blockPoints.push_back(1000 * point);
+
+    benchmark("SegmentBVH::windingNumber", "100 buildings", N / 10, [&](int i) {
+        return buildingsBVH.windingNumber(blockPoints[i % M]);
+    });
+    benchmark("Path::windingNumber", "100 buildings", N / 1000, [&](int i) {
+        int winding = 0;
+        for (auto& building : buildings) winding += building.windingNumber(blockPoints[i % M]);
+        return winding;
+    });
+}
+
+void benchmarkSegmentFile () {
+    const char* fileName = "compass-bench-segments.bin";
+    SegmentFileWriter writer;
+    if (!writer.open(fileName)) return;
+    for (int i = 0; i < 1000; i++) {
+        auto lane = randomLane(M, 60 + i);
+        writer.add(lane);
+    }
+    writer.close();
+
+    MappedSegments mapped;
+    std::vector<Segment> loaded;
+    // how loading went before, through the constructors from the defining points
+    benchmark("load through constructors", "1M segment file", 3, [&](int i) {
+        mapped.open(fileName);
+        loaded.clear();
+        loaded.reserve(mapped.size());
+        for (int s = 0; s < mapped.size(); s++) {
+            vec2 start(mapped.field(s, START_X), mapped.field(s, START_Y));
+            vec2 end(mapped.field(s, END_X), mapped.field(s, END_Y));
+            vec2 direction(mapped.field(s, DIRECTION_X), mapped.field(s, DIRECTION_Y));
+            loaded.push_back(Segment(start, direction, end));
+        }
+        return loaded.size();
+    });
+    benchmark("MappedSegments::segments", "1M segment file", 3, [&](int i) {
+        mapped.open(fileName);
+        mapped.segments(loaded);
+        return loaded.size();
+    });
+    // zero copy, only touching the columns that are used
+    benchmark("MappedSegments::column", "1M segment file, total length", 3, [&](int i) {
+        mapped.open(fileName);
+        float total = 0;
+        for (int b = 0; b < mapped.blockCount(); b++) {
+            const float* lengths = mapped.column(b, LENGTH);
+            for (int s = 0; s < SEGMENT_FILE_BLOCK_SIZE; s++) total += lengths[s];
+        }
+        return total;
+    });
+
+    mapped.close();
+    std::remove(fileName);
+}
+
+void benchmarkWhiteboard () {
+    // a city block of 100k short segments, a quarter of them arcs
+    std::vector<Segment> city;
+    Generator generator(70);
+    for (int i = 0; i < 100000; i++) {
+        vec2 start = 1000 * randomPoint(generator);
+        vec2 chord = (0.5f + 20 * randomCoordinate(generator)) * randomDirection(generator);
+        if (i % 4) city.push_back(Segment(start, start + chord));
+        else city.push_back(Segment(start, Eigen::Rotation2D<float>(0.3f) * vec2(chord.normalized()), start + chord));
+    }
+
+    std::ostringstream out;
+    auto drawStream = wb::draw(out);
+    benchmark("draw_stream << Segment", "100k segments", 5, [&](int i) {
+        out.str("");
+        for (auto& segment : city) drawStream << segment;
+        return out.tellp();
+    });
+    benchmark("WhiteboardBatch", "100k segments, text", 5, [&](int i) {
+        out.str("");
+        WhiteboardBatch batch(drawStream);
+        for (auto& segment : city) batch << segment;
+        batch.flush();
+        return out.tellp();
+    });
+    // the whole block on 200 pixels, and zoomed in on 100 m
+    benchmark("WhiteboardBatch", "100k segments, text, 5 m pixels", 5, [&](int i) {
+        out.str("");
+        WhiteboardBatch batch(drawStream);
+        batch.setViewport(BoundingBox(vec2(0, 0), vec2(1000, 1000)), 5);
+        for (auto& segment : city) batch << segment;
+        batch.flush();
+        return out.tellp();
+    });
+    benchmark("WhiteboardBatch", "100k segments, text, 100 m view", 5, [&](int i) {
+        out.str("");
+        WhiteboardBatch batch(drawStream);
+        batch.setViewport(BoundingBox(vec2(450, 450), vec2(550, 550)), 0.1);
+        for (auto& segment : city) batch << segment;
+        batch.flush();
+        return out.tellp();
+    });
+}
+
+void benchmarkPathOffsets () {
+    Path lane(randomLane(M, 80));
+
+    // how lanes were offset before: segment by segment through the constructors, without joins
+    benchmark("offset through constructors", "lane of 1024, without joins", 1000, [&](int i) {
+        Path offset;
+        for (auto& segment : lane.segments) {
+            vec2 start = segment.start + 3.5f * segment.direction.unitOrthogonal();
+            vec2 end = segment.end + 3.5f * segment.endDirection().unitOrthogonal();
+            offset.add(segment.isStraight() ? Segment(start, end) : Segment(start, segment.direction, end));
+        }
+        return offset.length();
+    });
+    std::vector<Segment> shifted;
+    benchmark("Segment::offsetBy", "lane of 1024, without joins", 1000, [&](int i) {
+        shifted.clear();
+        for (auto& segment : lane.segments) shifted.push_back(segment.offsetBy(3.5));
+        return shifted.size();
+    });
+    benchmark("Path::offset", "lane of 1024", 1000, [&](int i) {
+        return lane.offset(3.5).length();
+    });
+    PathOffsetter offsetter;
+    Path offset;
+    benchmark("PathOffsetter::offset", "lane of 1024", 1000, [&](int i) {
+        offsetter.offset(lane, 3.5, offset);
+        return offset.length();
+    });
+
+    std::vector<Path> lanes;
+    for (int i = 0; i < 1000; i++) lanes.push_back(Path(randomLane(64, 81 + i)));
+    std::vector<float> distances = {-5.25, -1.75, 1.75, 5.25};
+    std::vector<Path> offsets;
+    WorkStealingPool singleThread(1);
+    WorkStealingPool allThreads;
+    static char allThreadsInputs[64];
+    std::snprintf(allThreadsInputs, sizeof(allThreadsInputs), "1000 lanes x 4, all %d threads", allThreads.size());
+    benchmark("offsetPaths", "1000 lanes x 4, 1 thread", 10, [&](int i) {
+        offsetPaths(lanes, distances, offsets, singleThread);
+        return offsets.size();
+    });
+    benchmark("offsetPaths", allThreadsInputs, 10, [&](int i) {
+        offsetPaths(lanes, distances, offsets, allThreads);
+        return offsets.size();
+    });
+}
+
+void benchmarkTessellation () {
+    auto arcs = randomArcs(M, 90);
+    std::vector<vec2> polyline;
+
+    // how arcs were sampled before, one rotation per point
+    benchmark("sampling with Segment::pointAt", "arc, 0.001 error", N / 10, [&](int i) {
+        auto& arc = arcs[i % M];
+        int chords = chordCount(arc, 0.001);
+        polyline.clear();
+        for (int c = 0; c <= chords; c++) polyline.push_back(arc.pointAt(arc.length() * c / chords));
+        return polyline.size();
+    });
+    benchmark("tessellate", "arc, 0.001 error", N / 10, [&](int i) {
+        polyline.clear();
+        tessellate(arcs[i % M], 0.001, polyline);
+        return polyline.size();
+    });
+    TessellationCache cache;
+    benchmark("TessellationCache::polyline", "arc, 0.001 error, cached", N / 10, [&](int i) {
+        int count;
+        return cache.polyline(arcs[i % M], 0.001, count)[0][0];
+    });
+
+    // a network of 100k segments, a quarter of them arcs
+    std::vector<Segment> network;
+    Generator generator(91);
+    for (int i = 0; i < 100000; i++) {
+        vec2 start = 1000 * randomPoint(generator);
+        vec2 chord = (1 + 20 * randomCoordinate(generator)) * randomDirection(generator);
+        if (i % 4) network.push_back(Segment(start, start + chord));
+        else network.push_back(Segment(start, Eigen::Rotation2D<float>(0.5f) * vec2(chord.normalized()), start + chord));
+    }
+    Tessellation tessellation;
+    benchmark("tessellateAll", "100k network, 0.01 error", 10, [&](int i) {
+        tessellateAll(network, 0.01, tessellation);
+        return tessellation.vertices.size();
+    });
+    WorkStealingPool allThreads;
+    static char allThreadsInputs[64];
+    std::snprintf(allThreadsInputs, sizeof(allThreadsInputs), "100k network, 0.01 error, %d threads", allThreads.size());
+    benchmark("tessellateAll", allThreadsInputs, 10, [&](int i) {
+        tessellateAll(network, 0.01, tessellation, allThreads);
+        return tessellation.vertices.size();
+    });
+}
+
+void benchmarkBuffers () {
+    Generator generator(92);
+    std::vector<Path> footprints;
+    for (int i = 0; i < 10000; i++) {
+        auto corners = randomFootprint(generator);
+        Path footprint;
+        for (int c = 0; c < corners.size(); c++) footprint.add(Segment(corners[c], corners[(c + 1) % corners.size()]));
+        footprints.push_back(footprint);
+    }
+
+    ShapeBuffer builder;
+    std::vector<Path> grown;
+    benchmark("ShapeBuffer::buffer", "building footprint, 2 m", N / 100, [&](int i) {
+        return builder.buffer(footprints[i % footprints.size()], 2, grown);
+    });
+
+    std::vector<std::vector<Path>> allGrown;
+    WorkStealingPool allThreads;
+    static char allThreadsInputs[64];
+    std::snprintf(allThreadsInputs, sizeof(allThreadsInputs), "10k footprints, 2 m, %d threads", allThreads.size());
+    size_t resultsBefore = benchmarkResults.size();
+    benchmark("bufferAll", allThreadsInputs, 3, [&](int i) {
+        bufferAll(footprints, 2, allGrown, allThreads);
+        return allGrown.size();
+    });
+    if (benchmarkResults.size() > resultsBefore) {
+        // what the same results would take as polygons
+        long segments = 0, vertices = 0;
+        for (auto& paths : allGrown) {
+            for (auto& path : paths) {
+                segments += path.segments.size();
+                for (auto& segment : path.segments) vertices += chordCount(segment, 0.01);
+            }
+        }
+        std::printf("  %.1f segments per buffer, %.1f vertices tessellated to 1 cm\n",
+                    double(segments) / allGrown.size(), double(vertices) / allGrown.size());
+    }
+}
+
+void benchmarkOverlaps () {
+    // 1000 buildings on 1 km², every other one with rounded corners, and candidates to place among them
+    Generator generator(93);
+    std::uniform_real_distribution<float> position(0, 1000);
+    auto building = [&](bool rounded) {
+        auto footprint = randomFootprint(generator);
+        vec2 at(position(generator), position(generator));
+        Path outline;
+        for (int c = 0; c < footprint.size(); c++) {
+            vec2 start = at + footprint[c], end = at + footprint[(c + 1) % footprint.size()];
+            if (rounded && c % 2) {
+                outline.add(Segment(start, Eigen::Rotation2D<float>(0.2f) * vec2((end - start).normalized()), end));
+            } else {
+                outline.add(Segment(start, end));
+            }
+        }
+        return outline;
+    };
+    std::vector<Path> buildings;
+    for (int b = 0; b < 1000; b++) buildings.push_back(building(b % 2));
+    std::vector<Path> candidates;
+    for (int c = 0; c < 100; c++) candidates.push_back(building(false));
+
+    std::vector<BoundingBox> bounds;
+    std::vector<ShapeKind> kinds;
+    prepareShapes(buildings, bounds, kinds);
+    OverlapTester tester;
+    std::vector<int> overlapping;
+    benchmark("OverlapTester::overlapping", "1 vs 1000 buildings", N / 1000, [&](int i) {
+        return tester.overlapping(candidates[i % candidates.size()], buildings, bounds, kinds, overlapping);
+    });
+    benchmark("OverlapTester::firstOverlapping", "1 vs 1000 buildings", N / 1000, [&](int i) {
+        return tester.firstOverlapping(candidates[i % candidates.size()], buildings, bounds, kinds);
+    });
+    benchmark("intersect + contains", "1 vs 1000 buildings", N / 10000, [&](int i) {
+        auto& candidate = candidates[i % candidates.size()];
+        int count = 0;
+        for (auto& other : buildings) {
+            bool overlap = false;
+            for (auto& a : candidate.segments) {
+                for (auto& b : other.segments) overlap |= intersect(a, b).size() > 0;
+            }
+            overlap = overlap || other.contains(candidate.segments[0].start) || candidate.contains(other.segments[0].start);
+            count += overlap;
+        }
+        return count;
+    });
+
+    // pairs that pass the bounds test, where the exact work happens
+    std::vector<std::pair<int, int>> close;
+    for (int a = 0; a < buildings.size() && close.size() < M; a++) {
+        for (int b = a + 1; b < buildings.size(); b++) {
+            if (bounds[a].overlaps(bounds[b])) close.push_back({a, b});
+        }
+    }
+    if (close.empty()) return;
+    benchmark("OverlapTester::overlaps", "buildings with overlapping bounds", N / 10, [&](int i) {
+        auto& pair = close[i % close.size()];
+        return tester.overlaps(buildings[pair.first], bounds[pair.first], kinds[pair.first],
+                               buildings[pair.second], bounds[pair.second], kinds[pair.second]);
+    });
+    benchmark("intersect + contains", "buildings with overlapping bounds", N / 100, [&](int i) {
+        auto& pair = close[i % close.size()];
+        auto& first = buildings[pair.first];
+        auto& second = buildings[pair.second];
+        for (auto& a : first.segments) {
+            for (auto& b : second.segments) if (intersect(a, b).size()) return true;
+        }
+        return first.contains(second.segments[0].start) || second.contains(first.segments[0].start);
+    });
+}
+
+void benchmarkStraightSkeletons () {
+    Generator generator(48);
+    std::vector<std::vector<vec2>> footprints;
+    for (int i = 0; i < 100000; i++) footprints.push_back(randomFootprint(generator));
+
+    StraightSkeletonBuilder builder;
+    StraightSkeleton skeleton;
+    benchmark("StraightSkeletonBuilder::build", "building footprint", N / 10, [&](int i) {
+        builder.build(footprints[i % footprints.size()], skeleton);
+        return skeleton.nodes.size();
+    });
+
+    WorkStealingPool singleThread(1);
+    WorkStealingPool allThreads;
+    static char allThreadsInputs[64];
+    std::snprintf(allThreadsInputs, sizeof(allThreadsInputs), "100k footprints, all %d threads", allThreads.size());
+    std::vector<StraightSkeleton> skeletons;
+
+    for (auto threads : {&singleThread, &allThreads}) {
+        const char* inputs = threads == &singleThread ? "100k footprints, 1 thread" : allThreadsInputs;
+        size_t resultsBefore = benchmarkResults.size();
+        benchmark("straightSkeletons", inputs, 3, [&](int i) {
+            straightSkeletons(footprints, skeletons, *threads);
+            return skeletons.size();
+        });
+        if (benchmarkResults.size() > resultsBefore) {
+            std::printf("  %.0f footprints/s\n", footprints.size() / (benchmarkResults.back().nanosecondsPerOp * 1e-9));
+        }
+    }
+}
+
+void benchmarkBulkOperations () {
+    auto segments = randomLineSegments(M, 40);
+
+    // short segments, so the broad phase has something to reject
+    std::vector<Segment> shortSegments;
+    for (auto& segment : segments) {
+        shortSegments.push_back(Segment(segment.start, segment.start + 0.05f * (segment.end - segment.start)));
+    }
+    for (auto& arc : tinyArcs(M, 42)) shortSegments.push_back(arc);
+
+    SegmentBatch batchA, batchB;
+    for (int i = 0; i < M; i++) {
+        batchA.add(shortSegments[i]);
+        batchB.add(shortSegments[M + i]);
+    }
+    std::vector<BatchIntersection> batchResults;
+
+    benchmark("intersectMany", "short-line x tiny-arc 1024x1024", 20, [&](int i) {
+        batchResults.clear();
+        intersectMany(batchA, batchB, batchResults);
+        return batchResults.size();
+    });
+    benchmark("intersectAll", "grid 2048", 20, [&](int i) {
+        return intersectAll(shortSegments, GRID).size();
+    });
+    benchmark("intersectAll", "sweep-line 2048", 20, [&](int i) {
+        return intersectAll(shortSegments, SWEEP_LINE).size();
+    });
+
+    // a scene of 100k short segments, at the density of the 2048 segment one
+    std::vector<Segment> scene;
+    Generator sceneGenerator(47);
+    for (int i = 0; i < 100000; i++) {
+        vec2 start = 7 * randomPoint(sceneGenerator);
+        vec2 chordDirection = randomDirection(sceneGenerator);
+        if (i % 4) {
+            scene.push_back(Segment(start, start + 0.05f * chordDirection));
+        } else {
+            // bent by up to 1 radian away from the chord
+            vec2 direction = Eigen::Rotation2D<float>(2 * randomCoordinate(sceneGenerator) - 1) * chordDirection;
+            scene.push_back(Segment(start, direction, start + 0.05f * chordDirection));
+        }
+    }
+    WorkStealingPool singleThread(1);
+    WorkStealingPool allThreads;
+    static char allThreadsInputs[64];
+    std::snprintf(allThreadsInputs, sizeof(allThreadsInputs), "scene 100k, all %d threads", allThreads.size());
+
+    benchmark("intersectAll", "grid scene 100k", 3, [&](int i) {
+        return intersectAll(scene, GRID).size();
+    });
+    std::vector<BatchIntersection> sceneResults;
+    benchmark("intersectAllInto", "grid scene 100k, reused buffer", 3, [&](int i) {
+        sceneResults.clear();
+        intersectAllInto(scene, std::back_inserter(sceneResults), GRID);
+        return sceneResults.size();
+    });
+    benchmark("intersectAllParallel", "scene 100k, 1 thread", 3, [&](int i) {
+        return intersectAllParallel(scene, singleThread).size();
+    });
+    benchmark("intersectAllParallel", allThreadsInputs, 3, [&](int i) {
+        return intersectAllParallel(scene, allThreads).size();
+    });
+
+    // dragging one segment of the scene around
+    IntersectionGraph graph(0.05f);
+    for (auto& segment : scene) graph.insert(segment);
+    graph.takeChanges();
+    benchmark("IntersectionGraph::modify", "one of scene 100k", 10000, [&](int i) {
+        vec2 offset(0.001f * (i % 100), 0);
+        graph.modify(500, Segment(scene[500].start + offset, scene[500].end + offset));
+        auto changes = graph.takeChanges();
+        return changes.added.size() + changes.removed.size();
+    });
+
+    std::vector<Primitive> primitives;
+    auto lines = randomLines(M, 44);
+    auto rays = randomRays(M, 45);
+    auto circles = randomCircles(M, 46);
+    for (int i = 0; i < M; i++) {
+        switch (i % 4) {
+            case 0: primitives.push_back(lines[i]); break;
+            case 1: primitives.push_back(rays[i]); break;
+            case 2: primitives.push_back(circles[i]); break;
+            case 3: primitives.push_back(segments[i]); break;
+        }
+    }
+    std::vector<PrimitivePair> primitivePairs;
+    for (int i = 0; i < 64 * M; i++) primitivePairs.push_back(PrimitivePair(i % M, (i * 7 + i / M) % M));
+    std::vector<BatchIntersection> primitiveResults;
+
+    benchmark("intersect(Primitive, Primitive)", "mixed", N, [&](int i) {
+        auto& pair = primitivePairs[i % primitivePairs.size()];
+        return intersect(primitives[pair.first], primitives[pair.second]).size();
+    });
+    benchmark("intersectPairs", "mixed 65536 pairs", 20, [&](int i) {
+        primitiveResults.clear();
+        intersectPairs(primitives, primitivePairs, primitiveResults);
+        return primitiveResults.size();
+    });
+
+    Generator generator(43);
+    std::vector<Path> subjects, clips;
+    for (int i = 0; i < M; i++) {
+        vec2 corner = randomPoint(generator);
+        vec2 other = randomPoint(generator);
+        subjects.push_back(Path({Segment(corner, vec2(corner[0] + 0.3f, corner[1])),
+                                 Segment(vec2(corner[0] + 0.3f, corner[1]), corner + vec2(0.3f, 0.3f)),
+                                 Segment(corner + vec2(0.3f, 0.3f), vec2(corner[0], corner[1] + 0.3f)),
+                                 Segment(vec2(corner[0], corner[1] + 0.3f), corner)}));
+        clips.push_back(Path({Segment(other, vec2(1, 0), other + vec2(0, 0.4f)),
+                              Segment(other + vec2(0, 0.4f), vec2(-1, 0), other)}));
+    }
+    Clipper clipper;
+    std::vector<Path> clipResults;
+
+    benchmark("Clipper::clip", "square-circle union", 10000, [&](int i) {
+        return clipper.clip(UNION, subjects[i % M], clips[i % M], clipResults);
+    });
+    benchmark("Clipper::clip", "square-circle difference", 10000, [&](int i) {
+        return clipper.clip(DIFFERENCE, subjects[i % M], clips[i % M], clipResults);
+    });
+
+    benchmarkPaths();
+    benchmarkPathOffsets();
+    benchmarkTessellation();
+    benchmarkBuffers();
+    benchmarkOverlaps();
+    benchmarkStraightSkeletons();
+    benchmarkSegmentBVH();
+    benchmarkSegmentFile();
+    benchmarkWhiteboard();
+}
+
+template <typename Scalar>
+std::vector<SegmentT<Scalar>> castSegments (std::vector<Segment>& segments, Vec2<Scalar> offset) {
+    std::vector<SegmentT<Scalar>> cast;
+    for (auto& segment : segments) {
+        if (segment.isStraight()) {
+            cast.push_back(SegmentT<Scalar>(segment.start.cast<Scalar>() + offset, segment.end.cast<Scalar>() + offset));
+        } else {
+            cast.push_back(SegmentT<Scalar>(segment.start.cast<Scalar>() + offset, segment.direction.cast<Scalar>(),
+                                            segment.end.cast<Scalar>() + offset));
+        }
+    }
+    return cast;
+}
+
+// Prints the largest distance between float and double results, over the pairs where
+// both find the same number of intersections, and how many pairs don't
+void reportFloatAccuracy (const char* inputs, std::vector<Segment>& as, std::vector<Segment>& bs, vec2d offset) {
+    const char* name = "intersect(Segment, Segment) float";
+    if (benchmarkFilter && std::string(name).find(benchmarkFilter) == std::string::npos) return;
+
+    auto asFloat = castSegments<float>(as, offset.cast<float>());
+    auto bsFloat = castSegments<float>(bs, offset.cast<float>());
+    auto asDouble = castSegments<double>(as, offset);
+    auto bsDouble = castSegments<double>(bs, offset);
+
+    double maxError = 0;
+    int disagreeing = 0;
+    for (int i = 0; i < as.size(); i++) {
+        auto floatResults = intersect(asFloat[i], bsFloat[i]);
+        auto doubleResults = intersect(asDouble[i], bsDouble[i]);
+        if (floatResults.size() != doubleResults.size()) {
+            disagreeing++;
+            continue;
+        }
+        for (int r = 0; r < floatResults.size(); r++) {
+            maxError = std::max(maxError, (floatResults[r].position.cast<double>() - doubleResults[r].position).norm());
+        }
+    }
+
+    std::printf("%-36s %-32s %10.3g max error vs double, %d of %d pairs disagree\n",
+                name, inputs, maxError, disagreeing, int(as.size()));
+}
+
+// how often a predicate had to fall back to exact arithmetic since the snapshot, with COMPASS_INSTRUMENTATION
+void reportEscalations (const char* name, const char* inputs, InstrumentationSnapshot& since) {
+    auto counts = threadInstrumentation() - since;
+    long calls = counts[ORIENTATION_CALLS] + counts[IN_CIRCLE_CALLS];
+    long escalations = counts[ORIENTATION_ESCALATIONS] + counts[IN_CIRCLE_ESCALATIONS];
+    if (calls) std::printf("  %s, %s: %ld of %ld calls escalated\n", name, inputs, escalations, calls);
+    since = threadInstrumentation();
+}
+
+void benchmarkPredicates () {
+    auto points = randomPoints(M, 60);
+    // on the line y = 2x + 1/3, rounded, so nearly but mostly not exactly collinear
+    std::vector<vec2d> collinear;
+    for (int i = 0; i < M; i++) collinear.push_back(vec2d(points[i][0], 2.0 * points[i][0] + 1.0 / 3));
+    // on the unit circle, rounded
+    std::vector<vec2d> cocircular;
+    for (int i = 0; i < M; i++) cocircular.push_back(vec2d(std::cos(2 * M_PI * i / M), std::sin(2 * M_PI * i / M)));
+
+    auto since = threadInstrumentation();
+    benchmark("orientation", "random", N, [&](int i) {
+        return orientation(points[i % M], points[(i * 7) % M], points[(i * 13) % M]) > 0;
+    });
+    reportEscalations("orientation", "random", since);
+    benchmark("orientation", "nearly collinear", N, [&](int i) {
+        return orientation(collinear[i % M], collinear[(i * 7) % M], collinear[(i * 13) % M]) > 0;
+    });
+    reportEscalations("orientation", "nearly collinear", since);
+    benchmark("inCircle", "random", N, [&](int i) {
+        return inCircle(points[i % M], points[(i * 7) % M], points[(i * 13) % M], points[(i * 29) % M]) > 0;
+    });
+    reportEscalations("inCircle", "random", since);
+    benchmark("inCircle", "nearly cocircular", N, [&](int i) {
+        return inCircle(cocircular[i % M], cocircular[(i * 7) % M], cocircular[(i * 13) % M],
+                        cocircular[(i * 29) % M]) > 0;
+    });
+    reportEscalations("inCircle", "nearly cocircular", since);
+
+    std::vector<Line> parallelLines, otherParallelLines;
+    nearParallelLines(M, 61, parallelLines, otherParallelLines);
+    benchmark("intersect(Line, Line)", "near-parallel, counted", N, [&](int i) {
+        return intersect(parallelLines[i % M], otherParallelLines[i % M]).size();
+    });
+    reportEscalations("intersect(Line, Line)", "near-parallel", since);
+}
+
+void benchmarkPrecision () {
+    auto lineSegments = randomLineSegments(M, 50);
+    auto otherLineSegments = randomLineSegments(M, 51);
+    auto arcs = randomArcs(M, 52);
+    auto otherArcs = randomArcs(M, 53);
+
+    auto lineSegmentsd = castSegments<double>(lineSegments, vec2d(0, 0));
+    auto otherLineSegmentsd = castSegments<double>(otherLineSegments, vec2d(0, 0));
+    auto arcsd = castSegments<double>(arcs, vec2d(0, 0));
+    auto otherArcsd = castSegments<double>(otherArcs, vec2d(0, 0));
+    auto lineSegmentsx = castSegments<Fixed>(lineSegments, vec2x(0, 0));
+    auto otherLineSegmentsx = castSegments<Fixed>(otherLineSegments, vec2x(0, 0));
+    auto arcsx = castSegments<Fixed>(arcs, vec2x(0, 0));
+    auto otherArcsx = castSegments<Fixed>(otherArcs, vec2x(0, 0));
+
+    benchmark("intersect(Segment, Segment) float", "line-line", N, [&](int i) {
+        return intersect(lineSegments[i % M], otherLineSegments[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Segment, Segment) double", "line-line", N, [&](int i) {
+        return intersect(lineSegmentsd[i % M], otherLineSegmentsd[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Segment, Segment) fixed", "line-line", N, [&](int i) {
+        return intersect(lineSegmentsx[i % M], otherLineSegmentsx[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Segment, Segment) float", "arc-arc", N, [&](int i) {
+        return intersect(arcs[i % M], otherArcs[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Segment, Segment) double", "arc-arc", N, [&](int i) {
+        return intersect(arcsd[i % M], otherArcsd[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Segment, Segment) fixed", "arc-arc", N, [&](int i) {
+        return intersect(arcsx[i % M], otherArcsx[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Segment, Segment) float", "line-arc", N, [&](int i) {
+        return intersect(lineSegments[i % M], arcs[(i * 7) % M]).size();
+    });
+    benchmark("intersect(Segment, Segment) fixed", "line-arc", N, [&](int i) {
+        return intersect(lineSegmentsx[i % M], arcsx[(i * 7) % M]).size();
+    });
+
+    // construction computes the arc's center, radius and angles
+    benchmark("Segment(start, direction, end) float", "arc", N, [&](int i) {
+        auto& arc = arcs[i % M];
+        return Segment(arc.start, arc.direction, arc.end).length();
+    });
+    benchmark("Segment(start, direction, end) fixed", "arc", N, [&](int i) {
+        auto& arc = arcsx[i % M];
+        return double(Segmentx(arc.start, arc.direction, arc.end).length());
+    });
+
+    // one op is a row of 1024 pairs
+    SegmentBatch batchA, batchB;
+    for (int i = 0; i < M; i++) {
+        batchA.add(lineSegments[i]);
+        batchB.add(otherLineSegments[i]);
+    }
+    std::vector<BatchIntersection> batchResults;
+
+    benchmark("intersectStraightWithBatch float", "line-line row of 1024", 10000, [&](int i) {
+        batchResults.clear();
+        intersectStraightWithBatch(batchA.view(), i % M, batchB.view(), batchResults);
+        return batchResults.size();
+    });
+    benchmark("intersect(Segment, Segment) double", "line-line row of 1024", 10000, [&](int i) {
+        int n = 0;
+        for (int j = 0; j < M; j++) n += intersect(lineSegmentsd[i % M], otherLineSegmentsd[j]).size();
+        return n;
+    });
+
+    // accuracy of float against double as the coordinates grow
+    reportFloatAccuracy("line-line, near origin", lineSegments, otherLineSegments, vec2d(0, 0));
+    reportFloatAccuracy("line-line, 1 km away", lineSegments, otherLineSegments, vec2d(1000, 1000));
+    reportFloatAccuracy("line-line, 20 km away", lineSegments, otherLineSegments, vec2d(20000, 20000));
+    reportFloatAccuracy("arc-arc, near origin", arcs, otherArcs, vec2d(0, 0));
+    reportFloatAccuracy("arc-arc, 1 km away", arcs, otherArcs, vec2d(1000, 1000));
+    reportFloatAccuracy("arc-arc, 20 km away", arcs, otherArcs, vec2d(20000, 20000));
+
+    benchmarkPredicates();
+}
+
+// Compares the fast angle path against the std one angles.h uses by default: largest angle error
+// of fastAcos over the cosines angleBetween sees, what that means for arc offsets, and how often
+// the pseudo-angle span test in boundsOf decides differently
+void reportFastAngleAccuracy (const char* inputs, std::vector<Segment>& arcs, std::vector<vec2>& points) {
+    const char* name = "fastAcos accuracy";
+    if (benchmarkFilter && std::string(name).find(benchmarkFilter) == std::string::npos) return;
+
+    float maxAngleError = 0, maxOffsetError = 0;
+    int disagreeingSpans = 0, spanTests = 0;
+    for (int i = 0; i < arcs.size(); i++) {
+        auto& arc = arcs[i];
+        vec2 center = arc.radialCenter();
+        vec2 a = arc.start - center, b = points[i] - center;
+        float cosine = std::min(1.0f, std::max(-1.0f, a.dot(b) / (a.norm() * b.norm())));
+        float error = std::abs(fastAcos(cosine) - std::acos(cosine));
+        maxAngleError = std::max(maxAngleError, error);
+        maxOffsetError = std::max(maxOffsetError, error * arc.radius());
+
+        float pseudoSpan = pseudoAngleBetweenWithDirection<float>(a, arc.direction, arc.end - center);
+        for (vec2 axis : {vec2(1, 0), vec2(0, 1), vec2(-1, 0), vec2(0, -1)}) {
+            bool exact = angleBetweenWithDirection(a, arc.direction, arc.radius() * axis) <= arc.angleSpan();
+            bool pseudo = pseudoAngleBetweenWithDirection<float>(a, arc.direction, arc.radius() * axis) <= pseudoSpan;
+            disagreeingSpans += exact != pseudo;
+            spanTests++;
+        }
+    }
+
+    std::printf("%-36s %-32s %10.3g max angle error, %.3g max offset error (thickness %g)\n",
+                name, inputs, maxAngleError, maxOffsetError, thickness);
+    std::printf("  pseudo-angle span tests: %d of %d decide differently\n", disagreeingSpans, spanTests);
+}
+
+void benchmarkAngles () {
+    auto arcs = randomArcs(M, 70);
+    auto points = randomPoints(M, 71);
+    std::vector<float> ys(M), xs(M), cosines(M), results(M);
+    for (int i = 0; i < M; i++) {
+        vec2 fromCenter = points[i] - arcs[i].radialCenter();
+        ys[i] = fromCenter[1];
+        xs[i] = fromCenter[0];
+        cosines[i] = fromCenter.normalized().dot(arcs[i].direction);
+    }
+
+    benchmark("std::atan2", "random", N, [&](int i) {
+        return std::atan2(ys[i % M], xs[i % M]);
+    });
+    benchmark("fastAtan2", "random", N, [&](int i) {
+        return fastAtan2(ys[i % M], xs[i % M]);
+    });
+    // one op is a whole array of 1024
+    benchmark("fastAtan2s", "random 1024", 10000, [&](int i) {
+        fastAtan2s(ys.data(), xs.data(), results.data(), M);
+        return results[i % M];
+    });
+    benchmark("std::acos", "random", N, [&](int i) {
+        return std::acos(cosines[i % M]);
+    });
+    std::vector<Fixed> ysx(ys.begin(), ys.end()), xsx(xs.begin(), xs.end());
+    benchmark("atan2(Fixed)", "random", N, [&](int i) {
+        return double(atan2(ysx[i % M], xsx[i % M]));
+    });
+    benchmark("sqrt(Fixed)", "random", N, [&](int i) {
+        return double(sqrt(xsx[i % M] * xsx[i % M] + ysx[i % M] * ysx[i % M]));
+    });
+    benchmark("std::sqrt", "random", N, [&](int i) {
+        return std::sqrt(xs[i % M] * xs[i % M] + ys[i % M] * ys[i % M]);
+    });
+    benchmark("fastAcos", "random", N, [&](int i) {
+        return fastAcos(cosines[i % M]);
+    });
+    benchmark("fastAcoss", "random 1024", 10000, [&](int i) {
+        fastAcoss(cosines.data(), results.data(), M);
+        return results[i % M];
+    });
+
+    benchmark("angleBetweenWithDirection", "arc start to point", N, [&](int i) {
+        auto& arc = arcs[i % M];
+        return angleBetweenWithDirection(vec2(arc.start - arc.radialCenter()), arc.direction,
+                                         vec2(points[i % M] - arc.radialCenter()));
+    });
+    benchmark("pseudoAngleBetweenWithDirection", "arc start to point", N, [&](int i) {
+        auto& arc = arcs[i % M];
+        return pseudoAngleBetweenWithDirection<float>(arc.start - arc.radialCenter(), arc.direction,
+                                                      points[i % M] - arc.radialCenter());
+    });
+    benchmark("boundsOf", "arc", N, [&](int i) {
+        return boundsOf(arcs[i % M]).max[0];
+    });
+
+    reportFastAngleAccuracy("random arcs", arcs, points);
+}
+
+// usage: compass_bench [--filter substring] [--json output.json]
+int main (int argc, char** argv) {
+    const char* jsonFile = nullptr;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--json") == 0) jsonFile = argv[i + 1];
+        else if (std::strcmp(argv[i], "--filter") == 0) benchmarkFilter = argv[i + 1];
+    }
+
+    benchmarkIntersections();
+
+    auto lineSegments = randomLineSegments(M, 30);
+    auto arcs = randomArcs(M, 31);
+    auto tiny = tinyArcs(M, 32);
+
+    benchmarkSegmentMethods("line", lineSegments);
+    benchmarkSegmentMethods("arc", arcs);
+    benchmarkSegmentMethods("tiny-arc", tiny);
+
+    benchmarkCompactSegmentMethods("line", lineSegments);
+    benchmarkCompactSegmentMethods("arc", arcs);
+
+    benchmarkAngles();
+
+    benchmarkBulkOperations();
+    benchmarkPrecision();
+
+    // with COMPASS_INSTRUMENTATION, what all of the above made the intersection code do
+    if (INSTRUMENTATION) {
+        std::printf("\ninstrumentation, all threads:\n");
+        instrumentationSnapshot().dump(stdout);
+    }
+
+    if (jsonFile) writeBenchmarkJson(jsonFile);
+    return 0;
+}
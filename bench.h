@@ -0,0 +1,299 @@
+#ifndef COMPASS_BENCH_H
+#define COMPASS_BENCH_H
+
+// Minimal benchmark harness for compass_bench: times a function over many
+// calls, counts heap allocations through a replaced global operator new and
+// collects everything for a human-readable table and a JSON report.
+// Only include this from the benchmark executable.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+#include "primitives.h"
+
+// ALLOCATION COUNTING
+
+// atomic, since parallel code allocates from several threads
+std::atomic<size_t> allocationCount(0);
+
+void* countedAllocation (std::size_t size) noexcept {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return std::malloc(size ? size : 1);
+}
+
+// Every form of new and delete is replaced, so all allocations are counted and each pair ends up in malloc and
+// free. They are kept out of line: GCC would otherwise see free() on memory from operator new where one inlines
+// and warn with -Wmismatched-new-delete.
+#define COMPASS_REPLACED __attribute__((noinline))
+
+COMPASS_REPLACED void* operator new (std::size_t size) {
+    void* memory = countedAllocation(size);
+    if (!memory) throw std::bad_alloc();
+    return memory;
+}
+
+COMPASS_REPLACED void* operator new[] (std::size_t size) {
+    void* memory = countedAllocation(size);
+    if (!memory) throw std::bad_alloc();
+    return memory;
+}
+
+COMPASS_REPLACED void* operator new (std::size_t size, const std::nothrow_t&) noexcept {
+    return countedAllocation(size);
+}
+
+COMPASS_REPLACED void* operator new[] (std::size_t size, const std::nothrow_t&) noexcept {
+    return countedAllocation(size);
+}
+
+COMPASS_REPLACED void operator delete (void* memory) noexcept {
+    std::free(memory);
+}
+
+COMPASS_REPLACED void operator delete[] (void* memory) noexcept {
+    std::free(memory);
+}
+
+COMPASS_REPLACED void operator delete (void* memory, const std::nothrow_t&) noexcept {
+    std::free(memory);
+}
+
+COMPASS_REPLACED void operator delete[] (void* memory, const std::nothrow_t&) noexcept {
+    std::free(memory);
+}
+
+#ifdef __cpp_sized_deallocation
+COMPASS_REPLACED void operator delete (void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+COMPASS_REPLACED void operator delete[] (void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+#endif
+
+#undef COMPASS_REPLACED
+
+// HARNESS
+
+struct BenchmarkResult {
+    std::string name;
+    std::string inputs;
+    double nanosecondsPerOp;
+    double allocationsPerOp;
+};
+
+std::vector<BenchmarkResult> benchmarkResults;
+
+// only benchmarks whose name contains this are run, if set
+const char* benchmarkFilter = nullptr;
+
+// accumulates every benchmarked result, so the optimizer can't drop the work
+volatile float benchmarkSink;
+
+// Runs f(i) for i in [0, n) after a short warm up, f has to return something that adds to a float
+template <typename F>
+void benchmark (const char* name, const char* inputs, int n, F f) {
+    if (benchmarkFilter && std::string(name).find(benchmarkFilter) == std::string::npos) return;
+    float accumulated = 0;
+    // warm up caches and branch predictors
+    for (int i = 0; i < n / 10; i++) accumulated += f(i);
+
+    size_t allocationsBefore = allocationCount;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; i++) accumulated += f(i);
+    auto end = std::chrono::steady_clock::now();
+    size_t allocations = allocationCount - allocationsBefore;
+
+    benchmarkSink = accumulated;
+    double nanoseconds = std::chrono::duration<double, std::nano>(end - start).count();
+    benchmarkResults.push_back({name, inputs, nanoseconds / n, double(allocations) / n});
+
+    std::printf("%-36s %-32s %10.2f ns/op %8.3f allocs/op\n", name, inputs, nanoseconds / n, double(allocations) / n);
+}
+
+void writeBenchmarkJson (const char* fileName) {
+    FILE* file = std::fopen(fileName, "w");
+    if (!file) {
+        std::fprintf(stderr, "could not open %s\n", fileName);
+        return;
+    }
+
+    std::fprintf(file, "[\n");
+    for (int i = 0; i < benchmarkResults.size(); i++) {
+        auto& result = benchmarkResults[i];
+        std::fprintf(file, "  {\"name\": \"%s\", \"inputs\": \"%s\", \"ns_per_op\": %.3f, \"allocs_per_op\": %.4f}%s\n",
+                     result.name.c_str(), result.inputs.c_str(), result.nanosecondsPerOp, result.allocationsPerOp,
+                     i + 1 < benchmarkResults.size() ? "," : "");
+    }
+    std::fprintf(file, "]\n");
+    std::fclose(file);
+}
+
+// INPUTS
+
+typedef std::mt19937 Generator;
+
+float randomCoordinate (Generator& generator) {
+    return std::uniform_real_distribution<float>(0, 1)(generator);
+}
+
+vec2 randomPoint (Generator& generator) {
+    return vec2(randomCoordinate(generator), randomCoordinate(generator));
+}
+
+vec2 randomDirection (Generator& generator) {
+    float angle = std::uniform_real_distribution<float>(0, 2 * M_PI)(generator);
+    return vec2(std::cos(angle), std::sin(angle));
+}
+
+std::vector<vec2> randomPoints (int n, unsigned int seed) {
+    Generator generator(seed);
+    std::vector<vec2> points;
+    for (int i = 0; i < n; i++) points.push_back(randomPoint(generator));
+    return points;
+}
+
+std::vector<Line> randomLines (int n, unsigned int seed) {
+    Generator generator(seed);
+    std::vector<Line> lines;
+    for (int i = 0; i < n; i++) lines.push_back(Line(randomPoint(generator), randomDirection(generator)));
+    return lines;
+}
+
+std::vector<Ray> randomRays (int n, unsigned int seed) {
+    Generator generator(seed);
+    std::vector<Ray> rays;
+    for (int i = 0; i < n; i++) rays.push_back(Ray(randomPoint(generator), randomDirection(generator)));
+    return rays;
+}
+
+std::vector<Circle> randomCircles (int n, unsigned int seed) {
+    Generator generator(seed);
+    std::vector<Circle> circles;
+    for (int i = 0; i < n; i++) circles.push_back(Circle(randomPoint(generator), 0.1f + 0.4f * randomCoordinate(generator)));
+    return circles;
+}
+
+std::vector<Segment> randomLineSegments (int n, unsigned int seed) {
+    Generator generator(seed);
+    std::vector<Segment> segments;
+    for (int i = 0; i < n; i++) segments.push_back(Segment(randomPoint(generator), randomPoint(generator)));
+    return segments;
+}
+
+std::vector<Segment> randomArcs (int n, unsigned int seed) {
+    Generator generator(seed);
+    std::vector<Segment> arcs;
+    while (arcs.size() < n) {
+        auto arc = Segment(randomPoint(generator), randomDirection(generator), randomPoint(generator));
+        if (!arc.isStraight()) arcs.push_back(arc);
+    }
+    return arcs;
+}
+
+// a connected chain of lines and arcs, each turning by at most 1 rad, like a lane
+std::vector<Segment> randomLane (int n, unsigned int seed) {
+    Generator generator(seed);
+    std::vector<Segment> lane;
+    vec2 start(0, 0);
+    vec2 direction(1, 0);
+    while (lane.size() < n) {
+        float bend = std::uniform_real_distribution<float>(-1, 1)(generator);
+        vec2 end = start + (0.5f + randomCoordinate(generator)) * (Eigen::Rotation2D<float>(bend / 2) * direction);
+        auto segment = lane.size() % 2 ? Segment(start, direction, end) : Segment(start, end);
+        lane.push_back(segment);
+        direction = segment.endDirection();
+        start = end;
+    }
+    return lane;
+}
+
+// A counter-clockwise building footprint in meters: a rectangle, L, T or U shape,
+// sometimes with a notch, rotated and placed randomly
+std::vector<vec2> randomFootprint (Generator& generator) {
+    auto meters = [&](float min, float max) {
+        return std::uniform_real_distribution<float>(min, max)(generator);
+    };
+    float width = meters(8, 30), depth = meters(6, 20);
+    float wing = meters(0.3f, 0.45f) * width, wingDepth = meters(0.3f, 0.6f) * depth;
+    std::vector<vec2> outline;
+
+    switch (std::uniform_int_distribution<int>(0, 3)(generator)) {
+        case 0:
+            outline = {{0, 0}, {width, 0}, {width, depth}, {0, depth}};
+            break;
+        case 1:
+            outline = {{0, 0}, {width, 0}, {width, wingDepth}, {wing, wingDepth}, {wing, depth}, {0, depth}};
+            break;
+        case 2:
+            outline = {{wing, 0}, {width - wing, 0}, {width - wing, wingDepth}, {width, wingDepth},
+                       {width, depth}, {0, depth}, {0, wingDepth}, {wing, wingDepth}};
+            break;
+        default:
+            outline = {{0, 0}, {width, 0}, {width, depth}, {width - wing, depth}, {width - wing, wingDepth},
+                       {wing, wingDepth}, {wing, depth}, {0, depth}};
+    }
+
+    // a notch in the first edge
+    if (randomCoordinate(generator) < 0.3f) {
+        vec2 a = outline[0], b = outline[1];
+        vec2 along = (b - a) / 5, inward = 0.2f * wingDepth * vec2(-along[1], along[0]).normalized();
+        outline.insert(outline.begin() + 1, {a + 2 * along, a + 2 * along + inward, a + 3 * along + inward, a + 3 * along});
+    }
+
+    Eigen::Rotation2D<float> rotation(meters(0, 2 * M_PI));
+    vec2 position = 1000 * randomPoint(generator);
+    for (auto& point : outline) point = position + rotation * point;
+    return outline;
+}
+
+// ADVERSARIAL INPUTS
+
+// pairs of lines whose directions differ by 1e-3 to 1e-7 radians
+void nearParallelLines (int n, unsigned int seed, std::vector<Line>& as, std::vector<Line>& bs) {
+    Generator generator(seed);
+    for (int i = 0; i < n; i++) {
+        vec2 direction = randomDirection(generator);
+        float deviation = std::pow(10.0f, -3.0f - 4.0f * randomCoordinate(generator));
+        vec2 deviated = Eigen::Rotation2D<float>(deviation) * direction;
+        as.push_back(Line(randomPoint(generator), direction));
+        bs.push_back(Line(randomPoint(generator), deviated));
+    }
+}
+
+// pairs of circles touching from the outside or the inside
+void tangentCircles (int n, unsigned int seed, std::vector<Circle>& as, std::vector<Circle>& bs) {
+    Generator generator(seed);
+    for (int i = 0; i < n; i++) {
+        vec2 center = randomPoint(generator);
+        float radius = 0.1f + 0.4f * randomCoordinate(generator);
+        float otherRadius = 0.1f + 0.4f * randomCoordinate(generator);
+        float distance = i % 2 ? radius + otherRadius : std::abs(radius - otherRadius);
+        as.push_back(Circle(center, radius));
+        bs.push_back(Circle(center + distance * randomDirection(generator), otherRadius));
+    }
+}
+
+// arcs with chords around 1e-3, both nearly straight and tightly curved
+std::vector<Segment> tinyArcs (int n, unsigned int seed) {
+    Generator generator(seed);
+    std::vector<Segment> arcs;
+    while (arcs.size() < n) {
+        vec2 start = randomPoint(generator);
+        vec2 chordDirection = randomDirection(generator);
+        vec2 end = start + 0.001f * chordDirection;
+        float bend = arcs.size() % 2 ? 0.01f : 1.0f;
+        vec2 direction = Eigen::Rotation2D<float>(bend) * chordDirection;
+        auto arc = Segment(start, direction, end);
+        if (!arc.isStraight()) arcs.push_back(arc);
+    }
+    return arcs;
+}
+
+#endif //COMPASS_BENCH_H
@@ -0,0 +1,76 @@
+#ifndef COMPASS_BOUNDING_BOX_H
+#define COMPASS_BOUNDING_BOX_H
+
+#include <algorithm>
+#include "primitives.h"
+
+struct BoundingBox {
+    vec2 min;
+    vec2 max;
+
+    BoundingBox () : min(0, 0), max(0, 0) {};
+
+    BoundingBox (vec2 min, vec2 max) : min(min), max(max) {};
+
+    bool overlaps (const BoundingBox& other) const {
+        return min[0] <= other.max[0] && other.min[0] <= max[0]
+            && min[1] <= other.max[1] && other.min[1] <= max[1];
+    }
+
+    bool contains (vec2 point) const {
+        return min[0] <= point[0] && point[0] <= max[0]
+            && min[1] <= point[1] && point[1] <= max[1];
+    }
+
+    void include (vec2 point) {
+        min = min.cwiseMin(point);
+        max = max.cwiseMax(point);
+    }
+
+    void include (const BoundingBox& other) {
+        min = min.cwiseMin(other.min);
+        max = max.cwiseMax(other.max);
+    }
+
+    BoundingBox expandedBy (float margin) const {
+        return BoundingBox(min - vec2(margin, margin), max + vec2(margin, margin));
+    }
+
+    vec2 extent () const {
+        return max - min;
+    }
+
+    // 0 for points inside
+    float distanceTo (vec2 point) const {
+        vec2 outside = (min - point).cwiseMax(point - max).cwiseMax(vec2(0, 0));
+        return outside.norm();
+    }
+};
+
+// Tight bounds of a line or arc segment, grown by thickness so that
+// everything intersect() can report near the segment lies inside.
+// Arcs include every axis extreme that lies within their angle span.
+BoundingBox boundsOf (Segment& segment) {
+    BoundingBox box(segment.start.cwiseMin(segment.end), segment.start.cwiseMax(segment.end));
+
+    if (!segment.isStraight()) {
+        vec2 center = segment.radialCenter();
+        float radius = segment.radius();
+        float angleSpan = segment.length() / radius;
+        vec2 startFromCenter = segment.start - center;
+        // with fast angles, compare pseudo-angles up to the end instead
+        float pseudoAngleSpan = FAST_ANGLES ?
+                pseudoAngleBetweenWithDirection<float>(startFromCenter, segment.direction, segment.end - center) : 0;
+
+        for (vec2 axis : {vec2(1, 0), vec2(0, 1), vec2(-1, 0), vec2(0, -1)}) {
+            bool withinSpan = FAST_ANGLES ?
+                    pseudoAngleBetweenWithDirection<float>(startFromCenter, segment.direction, radius * axis) <= pseudoAngleSpan
+                    : angleBetweenWithDirection(startFromCenter, segment.direction, radius * axis) <= angleSpan;
+            if (withinSpan) box.include(vec2(center + radius * axis));
+        }
+    }
+
+    return box.expandedBy(thickness);
+}
+
+#endif //COMPASS_BOUNDING_BOX_H
@@ -0,0 +1,249 @@
+#ifndef COMPASS_BUFFER_H
+#define COMPASS_BUFFER_H
+
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <cmath>
+#include "primitives.h"
+#include "intersections.h"
+#include "path.h"
+#include "intersect-all.h"
+#include "clipper.h"
+#include "work-stealing-pool.h"
+
+// How far apart the end of a kept piece and the start of the next one may be, from numerical noise alone
+const float PIECE_LINK_DISTANCE = 10 * thickness;
+
+// Computes buffers of closed paths: everything within distance of the shape, as exact lines and arcs.
+// The outline is offset outwards with a PathOffsetter, which puts arcs around convex corners and cuts
+// neighbours at inside corners. Where the offset outline still overlaps itself (narrow gaps, notches,
+// offsets larger than features), it is split at its self intersections. Only the pieces that are
+// the full distance away from the shape and outside of it are kept and linked up again.
+// A negative distance shrinks the shape instead, keeping pieces inside of it.
+// The offset outline, its pieces and their links grow to the biggest shape seen, only the crossing
+// search still allocates its grid, about 10 times for a building footprint.
+class ShapeBuffer {
+    PathOffsetter offsetter;
+    // the outline moved to start at the origin
+    Path local;
+    Path offset;
+    std::vector<BatchIntersection> crossings;
+    std::vector<ClipperSplit> splits;
+    std::vector<Segment> pieces;
+    std::vector<int> kept;
+    std::vector<int> next;
+    std::vector<bool> visited;
+
+public:
+    // Kept pieces that the last buffer() left out because they didn't link up into a closed loop. Those are
+    // mostly slivers where crossings nearly coincide, but they can be parts missing from the result as well,
+    // so check results that aren't expected to lose anything when it isn't 0.
+    int unlinkedCount;
+
+    ShapeBuffer () : unlinkedCount(0) {};
+
+    // Writes the closed result paths to out[0 ... count - 1] and returns count. Outlines turn like the given
+    // one, holes the other way. Like Clipper::clip, paths beyond count are emptied but kept for their storage.
+    int buffer (Path& outline, float distance, std::vector<Path>& out) {
+        // Far from the origin, floats lose the digits that the thickness tolerances of the intersections
+        // rely on, and crossings of the offset outline go missing. Near it the shape's extent is what counts.
+        vec2 origin = outline.segments.empty() ? vec2(0, 0) : outline.segments[0].start;
+        local.segments.clear();
+        for (auto& segment : outline.segments) local.segments.push_back(segment.movedBy(-origin));
+        local.updateOffsets();
+
+        float outwards = local.isClockwise() ? 1 : -1;
+        offsetter.offset(local, outwards * distance, offset);
+
+        unlinkedCount = 0;
+        findPieces();
+        keepPiecesAtDistance(local, distance);
+        dropDeadEnds();
+        return linkPieces(origin, out);
+    }
+
+private:
+    // neighbours in the offset outline touch at their shared end
+    bool sharedEnd (BatchIntersection& crossing) {
+        int n = offset.segments.size();
+        auto& a = offset.segments[crossing.indexA];
+        auto& b = offset.segments[crossing.indexB];
+        if (crossing.indexB == crossing.indexA + 1) {
+            return a.length() - crossing.alongA < thickness && crossing.alongB < thickness;
+        }
+        if (crossing.indexA == 0 && crossing.indexB == n - 1) {
+            return crossing.alongA < thickness && b.length() - crossing.alongB < thickness;
+        }
+        return false;
+    }
+
+    // the offset outline split at all its self intersections
+    void findPieces () {
+        crossings.clear();
+        intersectAllInto(offset.segments, std::back_inserter(crossings));
+        splits.clear();
+        for (auto& crossing : crossings) {
+            if (sharedEnd(crossing)) continue;
+            splits.push_back({crossing.indexA, crossing.alongA, crossing.position});
+            splits.push_back({crossing.indexB, crossing.alongB, crossing.position});
+        }
+        std::sort(splits.begin(), splits.end());
+
+        pieces.clear();
+        int split = 0;
+        for (int e = 0; e < offset.segments.size(); e++) {
+            auto& segment = offset.segments[e];
+            vec2 from = segment.start;
+            for (; split < splits.size() && splits[split].edge == e; split++) {
+                if ((splits[split].position - from).norm() < thickness) continue;
+                addPiece(segment, from, splits[split].position);
+                from = splits[split].position;
+            }
+            if ((segment.end - from).norm() >= thickness) addPiece(segment, from, segment.end);
+        }
+    }
+
+    // Arc pieces start tangent to the circle at from, the offsets of the splits are too rough near the ends.
+    // Pieces that bulge less than thickness / 2 from their chord are straight, their ends alone can't tell
+    // their arc apart from noise.
+    void addPiece (Segment& segment, vec2 from, vec2 to) {
+        if (segment.isStraight() || (to - from).squaredNorm() < 4 * segment.radius() * thickness) {
+            pieces.push_back(Segment(from, to));
+        } else {
+            float turn = segment.signedRadius() >= 0 ? 1 : -1;
+            pieces.push_back(Segment(from, turn * (from - segment.radialCenter()).unitOrthogonal(), to));
+        }
+    }
+
+    void keepPiecesAtDistance (Path& outline, float distance) {
+        float tolerance = 0.001f * std::abs(distance) + thickness;
+        kept.clear();
+        for (int p = 0; p < pieces.size(); p++) {
+            vec2 middle = pieces[p].midpoint();
+            bool atDistance = true;
+            for (auto& segment : outline.segments) {
+                if (segment.distanceTo(middle) < std::abs(distance) - tolerance) {
+                    atDistance = false;
+                    break;
+                }
+            }
+            if (atDistance && outline.contains(middle) == (distance < 0)) kept.push_back(p);
+        }
+    }
+
+    // Drops kept pieces that no other kept piece ends before or starts after, until there are none: they can't
+    // be part of a loop. These are slivers just past a crossing that keepPiecesAtDistance() accepted within
+    // its tolerance, parts of the offset outline that are only kept for noise, like both sides of a feature
+    // that shrinks to zero width, and ends left by crossings that weren't found.
+    void dropDeadEnds () {
+        bool dropped = true;
+        while (dropped) {
+            dropped = false;
+            for (int k = 0; k < kept.size(); k++) {
+                if (!joinsStart(k) || !joinsEnd(k)) {
+                    kept.erase(kept.begin() + k--);
+                    unlinkedCount++;
+                    dropped = true;
+                }
+            }
+        }
+    }
+
+    // whether another kept piece ends where kept[k] starts, usually the one before it
+    bool joinsStart (int k) {
+        int n = kept.size();
+        vec2 start = pieces[kept[k]].start;
+        if (n > 1 && (pieces[kept[(k + n - 1) % n]].end - start).norm() < PIECE_LINK_DISTANCE) return true;
+        for (int other = 0; other < n; other++) {
+            if (other != k && (pieces[kept[other]].end - start).norm() < PIECE_LINK_DISTANCE) return true;
+        }
+        return false;
+    }
+
+    // whether another kept piece starts where kept[k] ends, usually the one after it
+    bool joinsEnd (int k) {
+        int n = kept.size();
+        vec2 end = pieces[kept[k]].end;
+        if (n > 1 && (pieces[kept[(k + 1) % n]].start - end).norm() < PIECE_LINK_DISTANCE) return true;
+        for (int other = 0; other < n; other++) {
+            if (other != k && (pieces[kept[other]].start - end).norm() < PIECE_LINK_DISTANCE) return true;
+        }
+        return false;
+    }
+
+    // Links every kept piece to the one starting where it ends, usually the next one, and collects the loops,
+    // moved back by origin. Where pieces branch, a loop can still end up open, then it is left out as well.
+    int linkPieces (vec2 origin, std::vector<Path>& out) {
+        int n = kept.size();
+        next.assign(n, -1);
+        for (int k = 0; k < n; k++) {
+            vec2 end = pieces[kept[k]].end;
+            int following = (k + 1) % n;
+            if ((pieces[kept[following]].start - end).norm() < PIECE_LINK_DISTANCE) {
+                next[k] = following;
+                continue;
+            }
+            float closestDistance = PIECE_LINK_DISTANCE;
+            for (int other = 0; other < n; other++) {
+                float distance = (pieces[kept[other]].start - end).norm();
+                if (distance < closestDistance) {
+                    next[k] = other;
+                    closestDistance = distance;
+                }
+            }
+        }
+
+        int loops = 0;
+        visited.assign(n, false);
+        for (int first = 0; first < n; first++) {
+            if (visited[first]) continue;
+            if (out.size() <= loops) out.emplace_back();
+            Path& loop = out[loops];
+            loop.segments.clear();
+
+            int k = first;
+            while (k >= 0 && !visited[k]) {
+                visited[k] = true;
+                loop.segments.push_back(pieces[kept[k]].movedBy(origin));
+                k = next[k];
+            }
+            // a loop has to come back to where it started
+            if (k != first) {
+                unlinkedCount += loop.segments.size();
+                continue;
+            }
+            loop.updateOffsets();
+            loops++;
+        }
+
+        for (int i = loops; i < out.size(); i++) {
+            out[i].segments.clear();
+            out[i].updateOffsets();
+        }
+        return loops;
+    }
+};
+
+std::vector<Path> buffered (Path& outline, float distance) {
+    std::vector<Path> out;
+    out.resize(ShapeBuffer().buffer(outline, distance, out));
+    return out;
+}
+
+// BATCHED
+
+// Outlines per task of bufferAll, about a millisecond of building footprints
+const int BUFFERS_PER_TASK = 64;
+
+// Buffers of many independent shapes on the threads of pool, out[i] belongs to outlines[i]
+void bufferAll (std::vector<Path>& outlines, float distance, std::vector<std::vector<Path>>& out,
+                WorkStealingPool& pool) {
+    out.resize(outlines.size());
+    pool.runRanges(outlines.size(), BUFFERS_PER_TASK, [&](int begin, int end) {
+        ShapeBuffer builder;
+        for (int i = begin; i < end; i++) out[i].resize(builder.buffer(outlines[i], distance, out[i]));
+    });
+}
+
+#endif //COMPASS_BUFFER_H
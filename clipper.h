@@ -11,93 +11,355 @@
 
             (a paper that I paid fucking 42EUR for)
 
+ Instead of entry/exit roles on intersection vertices, every edge piece
+ between two intersections is classified on its own (inside, outside or
+ on an edge of the other path, with the same or opposite direction).
+ The paper's degenerate cases (shared edges, touching vertices) then
+ become a plain selection of edge pieces by mode.
+
  */
 
 #ifndef COMPASS_CLIPPER_H
 #define COMPASS_CLIPPER_H
 
+#include <vector>
+#include <algorithm>
 #include "./primitives.h"
-#include "range/v3/all.hpp"
+#include "./intersections.h"
+#include "./bounding-box.h"
+#include "./path.h"
 
+// DIFFERENCE keeps the subject outside of the clip path, NOT keeps the clip path outside of the subject
 enum Mode {INTERSECTION, UNION, DIFFERENCE, NOT};
-enum Location {INSIDE, OUTSIDE, ON_EDGE};
-enum Role {NONE, ENTRY, EXIT, ENTRY_EXIT, EXIT_ENTRY};
-enum Direction {FORWARD_STAY, FORWARD_SWITCH, BACKWARD_STAY, BACKWARD_SWITCH};
+enum Location {INSIDE, OUTSIDE, ON_EDGE, ON_EDGE_OPPOSITE};
+
+enum {SUBJECT = 0, CLIP = 1};
 
+// Vertices are linked by index into the Clipper's pool, never by pointer
 struct ClipperVertex {
     Segment forwardEdge;
     Location forwardEdgeLocation;
-    Location location;
-    Role role;
+    int chain;
+    int next;
+    int previous;
     bool visited;
-    ClipperVertex* neighbor;
-    ClipperVertex* partner;
-    bool isFirstPartner;
 
     vec2 position () { return forwardEdge.start; };
-    bool isIntersection () {return neighbor && role != NONE; };
-    bool isEntry () {return role == ENTRY || role == ENTRY_EXIT; };
-    bool isExit () {return role == EXIT || role == EXIT_ENTRY; };
 
-    ClipperVertex (Segment segment) : forwardEdge(segment) {};
-
-    ClipperVertex split (vec2 position) {
-        auto parts = forwardEdge.subdivide(position);
-        forwardEdge = parts[0];
-        auto newVertex = ClipperVertex(parts[1]);
+    ClipperVertex (Segment segment, int chain) : forwardEdge(segment), forwardEdgeLocation(OUTSIDE), chain(chain),
+                                                 next(-1), previous(-1), visited(false) {};
+};
 
-        newVertex.next = next;
-        next->previous = newVertex;
-        newVertex.previous = this;
-        next = &newVertex;
+struct ClipperSplit {
+    int edge;
+    float along;
+    vec2 position;
 
-        return newVertex;
+    bool operator< (const ClipperSplit& other) const {
+        return edge < other.edge || (edge == other.edge && along < other.along);
     }
 };
 
-std::vector<Path> clip (Mode mode, Path& subjectPath, clipPath) {
-    if (subjectPath.isClockwise()) return clip(mode, subjectPath.reversed(), clipPath);
-    if (clipPath.isClockwise()) return clip(mode, subjectPath, clipPath.reversed());
+// Owns all scratch storage of a clipping operation. Storage is cleared, but never
+// shrunk between calls, so a reused Clipper stops allocating once it has seen
+// the biggest paths it has to deal with.
+class Clipper {
+    std::vector<Segment> edges;
+    std::vector<BoundingBox> edgeBounds;
+    // edges of the subject are edges[0 ... clipEdgesStart - 1], the rest belong to the clip path
+    int clipEdgesStart;
+    std::vector<ClipperSplit> splits;
+    std::vector<ClipperVertex> vertices;
+    int clipVerticesStart;
+    std::vector<int> selected;
+    std::vector<bool> selectedReversed;
+    // the pieces of the loop being traversed, in its direction
+    std::vector<Segment> loop;
+
+public:
+    // Selected edge pieces that the last clip() left out because they didn't close into a loop. That only
+    // happens with numerical trouble, but then parts of the result are missing, so check it isn't 0 where
+    // results need to be complete.
+    int unclosedCount;
+
+    Clipper () : unclosedCount(0) {};
+
+    // Writes the closed result paths to out[0 ... count - 1] and returns count. Outlines are counter-clockwise,
+    // holes clockwise. Paths already in out are overwritten in place; the ones beyond count are emptied but
+    // kept, so a call with fewer results doesn't free storage that the next call needs again.
+    int clip (Mode mode, Path& subjectPath, Path& clipPath, std::vector<Path>& out) {
+        collectEdges(subjectPath, clipPath);
+        findSplits();
+        createVertexChains();
+        determineEdgeLocations();
+        selectEdges(mode);
+        return traverse(out);
+    }
+
+private:
+    // both paths are read counter-clockwise, without creating reversed copies
+    void collectEdges (Path& subjectPath, Path& clipPath) {
+        edges.clear();
+        edgeBounds.clear();
+
+        for (Path* path : {&subjectPath, &clipPath}) {
+            if (path == &clipPath) clipEdgesStart = edges.size();
+            if (path->isClockwise()) {
+                for (int i = path->segments.size() - 1; i >= 0; i--) edges.push_back(path->segments[i].reverse());
+            } else {
+                for (auto& segment : path->segments) edges.push_back(segment);
+            }
+        }
+
+        for (auto& edge : edges) edgeBounds.push_back(boundsOf(edge));
+    }
+
+    bool isSubjectEdge (int edge) {
+        return edge < clipEdgesStart;
+    }
+
+    // Splits both paths where they cross or where a vertex of one touches an edge of the other
+    void findSplits () {
+        splits.clear();
 
-    ClipperVertex* subjectChain = createVertexChain(subjectPath, clipPath);
-    ClipperVertex* clipChain = createVertexChain(clipPath, subjectPath);
+        for (int a = 0; a < clipEdgesStart; a++) {
+            for (int b = clipEdgesStart; b < edges.size(); b++) {
+                if (!edgeBounds[a].overlaps(edgeBounds[b])) continue;
 
-    auto intersectionGroups = findIntersections(subjectChain, clipChain);
-    splitAtIntersections(subjectChain, clipChain, intersectionGroups);
-    determineEdgeLocations(subjectChain, clipChain, subjectPath, clipPath);
+                for (auto& intersection : intersect(edges[a], edges[b])) {
+                    splits.push_back({a, intersection.alongA, intersection.position});
+                    splits.push_back({b, intersection.alongB, intersection.position});
+                }
 
-    bool allEdgesOnAnotherEdge = false;
-    for (auto vertex : subjectChain) {
-        if (vertex.forwardEdgeLocation != ON_EDGE) {
-            allEdgesOnAnotherEdge = false;
-            break;
+                addSplitIfTouching(a, edges[b].start);
+                addSplitIfTouching(b, edges[a].start);
+            }
+        }
+
+        std::sort(splits.begin(), splits.end());
+    }
+
+    // catches the ends of collinear overlaps, which intersect() doesn't report
+    void addSplitIfTouching (int edge, vec2 point) {
+        if (edges[edge].contains(point)) {
+            splits.push_back({edge, edges[edge].offsetAt(point), point});
         }
     }
 
-    if (allEdgesOnAnotherEdge) {
-        if (mode == UNION || mode == INTERSECTION) {
-            return {subjectChain.toPath()};
-        } else return {};
+    // Cuts every edge into pieces at its splits, ignoring splits
+    // that would leave pieces shorter than thickness
+    void createVertexChains () {
+        vertices.clear();
+        int split = 0;
+
+        for (int edge = 0; edge < edges.size(); edge++) {
+            if (edge == clipEdgesStart) clipVerticesStart = vertices.size();
+            auto& original = edges[edge];
+            vec2 pieceStart = original.start;
+            vec2 pieceDirection = original.direction;
+            float pieceStartAlong = 0;
+
+            for (; split < splits.size() && splits[split].edge == edge; split++) {
+                float along = splits[split].along;
+                if (along - pieceStartAlong < thickness || original.length() - along < thickness) continue;
+
+                vec2 position = splits[split].position;
+                addVertex(pieceSegment(original, pieceStart, pieceDirection, position), edge);
+                pieceDirection = original.isStraight() ? original.direction : vec2(
+                        std::copysign(1.0f, original.signedRadius()) * (position - original.radialCenter()).unitOrthogonal());
+                pieceStart = position;
+                pieceStartAlong = along;
+            }
+
+            addVertex(pieceSegment(original, pieceStart, pieceDirection, original.end), edge);
+        }
+
+        linkChain(0, clipVerticesStart);
+        linkChain(clipVerticesStart, vertices.size());
     }
 
-    setRoles(subjectChain, clipChain);
-    markCouples(subjectChain, clipChain);
+    Segment pieceSegment (Segment& original, vec2 start, vec2 direction, vec2 end) {
+        if (original.isStraight()) return Segment(start, end);
+        else return Segment(start, direction, end);
+    }
 
-    if (mode == UNION || mode == DIFFERENCE) {
-        reverseRoles(subjectChain);
+    void addVertex (Segment piece, int edge) {
+        vertices.push_back(ClipperVertex(piece, isSubjectEdge(edge) ? SUBJECT : CLIP));
     }
 
-    if (mode == UNION || mode == NOT) {
-        reverseRoles(clipChain);
+    void linkChain (int begin, int end) {
+        for (int v = begin; v < end; v++) {
+            vertices[v].next = v + 1 < end ? v + 1 : begin;
+            vertices[v].previous = v > begin ? v - 1 : end - 1;
+        }
     }
 
-    std::vector<Path> resultPaths = traverse(subjectChain, clipChain, mode);
-    resultPaths |= range::actions::transform([&](Segment segment){return segment.weld(thickness);});
+    // Classifies each edge piece by its midpoint, which never lies on a split
+    void determineEdgeLocations () {
+        for (auto& vertex : vertices) {
+            auto& piece = vertex.forwardEdge;
+            vec2 midpoint = piece.midpoint();
+            int otherBegin = vertex.chain == SUBJECT ? clipEdgesStart : 0;
+            int otherEnd = vertex.chain == SUBJECT ? edges.size() : clipEdgesStart;
 
-    // TODO: free chains?
+            vertex.forwardEdgeLocation = OUTSIDE;
+            float winding = 0;
+            bool onEdge = false;
+
+            for (int other = otherBegin; other < otherEnd; other++) {
+                auto& otherEdge = edges[other];
+                if (edgeBounds[other].contains(midpoint) && otherEdge.distanceTo(midpoint) < thickness) {
+                    vec2 otherDirection = otherEdge.directionOf(otherEdge.offsetAt(midpoint));
+                    vec2 pieceDirection = piece.directionOf(piece.length() / 2);
+                    vertex.forwardEdgeLocation = otherDirection.dot(pieceDirection) > 0 ? ON_EDGE : ON_EDGE_OPPOSITE;
+                    onEdge = true;
+                    break;
+                }
+                winding += windingAngle(otherEdge, midpoint);
+            }
+
+            if (!onEdge && std::abs(winding) > M_PI) vertex.forwardEdgeLocation = INSIDE;
+        }
+    }
 
+    // Picks the edge pieces that bound the result, shared edges are taken from one chain only
+    void selectEdges (Mode mode) {
+        selected.clear();
+        selectedReversed.clear();
+
+        for (int v = 0; v < vertices.size(); v++) {
+            auto& vertex = vertices[v];
+            vertex.visited = false;
+            bool isSubject = vertex.chain == SUBJECT;
+            Location location = vertex.forwardEdgeLocation;
+            bool take = false;
+            bool reversed = false;
+
+            switch (mode) {
+                case INTERSECTION:
+                    take = location == INSIDE || (isSubject && location == ON_EDGE);
+                    break;
+                case UNION:
+                    take = location == OUTSIDE || (isSubject && location == ON_EDGE);
+                    break;
+                case DIFFERENCE:
+                    take = isSubject ? (location == OUTSIDE || location == ON_EDGE_OPPOSITE) : location == INSIDE;
+                    reversed = !isSubject;
+                    break;
+                case NOT:
+                    take = isSubject ? location == INSIDE : (location == OUTSIDE || location == ON_EDGE_OPPOSITE);
+                    reversed = isSubject;
+                    break;
+            }
+
+            if (take) {
+                selected.push_back(v);
+                selectedReversed.push_back(reversed);
+            }
+        }
+    }
+
+    vec2 startOf (int s) {
+        auto& edge = vertices[selected[s]].forwardEdge;
+        return selectedReversed[s] ? edge.end : edge.start;
+    }
+
+    vec2 endOf (int s) {
+        auto& edge = vertices[selected[s]].forwardEdge;
+        return selectedReversed[s] ? edge.start : edge.end;
+    }
+
+    // Finds an unvisited selected piece starting at point,
+    // trying the natural successor within the same chain first
+    int findContinuation (int current, vec2 point) {
+        int vertex = selected[current];
+        int successor = selectedReversed[current] ? vertices[vertex].previous : vertices[vertex].next;
+        if (current + 1 < selected.size() && selected[current + 1] == successor && !vertices[successor].visited
+            && (startOf(current + 1) - point).norm() < thickness) return current + 1;
+
+        for (int s = 0; s < selected.size(); s++) {
+            if (!vertices[selected[s]].visited && (startOf(s) - point).norm() < thickness) return s;
+        }
+        return -1;
+    }
+
+    // Links the selected pieces into closed paths, welding pieces of the same line or circle
+    int traverse (std::vector<Path>& out) {
+        int resultCount = 0;
+        unclosedCount = 0;
+
+        for (int first = 0; first < selected.size(); first++) {
+            if (vertices[selected[first]].visited) continue;
+
+            loop.clear();
+            vec2 loopStart = startOf(first);
+            int current = first;
+            while (current != -1) {
+                vertices[selected[current]].visited = true;
+                auto& edge = vertices[selected[current]].forwardEdge;
+                loop.push_back(selectedReversed[current] ? edge.reverse() : edge);
+                if ((endOf(current) - loopStart).norm() < thickness) break;
+                current = findContinuation(current, endOf(current));
+            }
+
+            // an unclosable loop is only left over from numerical trouble
+            if (current == -1) {
+                unclosedCount += loop.size();
+                continue;
+            }
+
+            if (resultCount == out.size()) out.push_back(Path());
+            Path& result = out[resultCount++];
+            result.segments.clear();
+            // start at a corner, so that pieces of one line or circle across the loop's start are welded too
+            int n = loop.size();
+            int start = 0;
+            while (start < n && weldable(loop[(start + n - 1) % n], loop[start])) start++;
+            if (start == n) start = 0;
+            for (int i = 0; i < n; i++) appendWelded(result.segments, loop[(start + i) % n]);
+            result.updateOffsets();
+        }
+
+        // empty the paths that weren't needed this time, keeping their storage
+        for (int i = resultCount; i < out.size(); i++) {
+            out[i].segments.clear();
+            out[i].updateOffsets();
+        }
+        return resultCount;
+    }
+
+    // segment continues previous on the same line or circle, without closing a full circle
+    bool weldable (Segment& previous, Segment& segment) {
+        if (previous.isStraight() && segment.isStraight()) {
+            return std::abs(cross(previous.direction, segment.direction)) < ROUGH_TOLERANCE * 100
+                   && previous.direction.dot(segment.direction) > 0;
+        } else if (!previous.isStraight() && !segment.isStraight()) {
+            return (previous.radialCenter() - segment.radialCenter()).norm() < thickness
+                   && std::abs(previous.signedRadius() - segment.signedRadius()) < thickness
+                   && (previous.start - segment.end).norm() > thickness;
+        }
+        return false;
+    }
+
+    void appendWelded (std::vector<Segment>& segments, Segment segment) {
+        if (!segments.empty() && weldable(segments.back(), segment)) {
+            vec2 start = segments.back().start;
+            vec2 direction = segments.back().direction;
+            segments.pop_back();
+            if (segment.isStraight()) segments.push_back(Segment(start, segment.end));
+            else segments.push_back(Segment(start, direction, segment.end));
+            return;
+        }
+        segments.push_back(segment);
+    }
+};
+
+// Convenience wrapper using one Clipper per thread, so repeated calls don't reallocate scratch storage
+std::vector<Path> clip (Mode mode, Path& subjectPath, Path& clipPath) {
+    static thread_local Clipper clipper;
+    std::vector<Path> resultPaths;
+    resultPaths.resize(clipper.clip(mode, subjectPath, clipPath, resultPaths));
     return resultPaths;
 }
 
-
 #endif //COMPASS_CLIPPER_H
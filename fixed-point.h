@@ -0,0 +1,364 @@
+#ifndef COMPASS_FIXED_POINT_H
+#define COMPASS_FIXED_POINT_H
+
+#include <Eigen/Dense>
+#include <cstdint>
+#include <cmath>
+#include <limits>
+#include "primitives.h"
+#include "intersections.h"
+#include "predicates.h"
+
+// A deterministic scalar for lockstep simulations, where every machine has to compute bit for bit
+// the same geometry. Values are 32.32 fixed point numbers in an int64_t, all arithmetic, sqrt and
+// angle functions are integer operations, so results don't depend on compiler, optimization
+// level, FMA contraction or libm. Only converting from double at runtime touches floating point,
+// and that's exact for the same double on every IEEE machine.
+// Results that don't fit saturate to +-Fixed::max() (division by zero too), like float goes to inf.
+// Needs __int128, so GCC or Clang, and arithmetic right shifts of negative numbers. That's why it is
+// opt-in: only code that includes this header gets Fixed, the x typedefs (Segmentx, ...) and the
+// Fixed predicates, the rest of the library works without it.
+
+class Fixed {
+    struct RawTag {};
+    constexpr Fixed (int64_t raw, RawTag) : raw(raw) {};
+
+public:
+    static const int FRACTION_BITS = 32;
+    static constexpr int64_t ONE = int64_t(1) << FRACTION_BITS;
+    // symmetric, so negating never overflows
+    static constexpr int64_t MAX_RAW = std::numeric_limits<int64_t>::max();
+
+    int64_t raw;
+
+    constexpr Fixed () : raw(0) {};
+
+    constexpr Fixed (int value) : raw(int64_t(value) * ONE) {};
+
+    // rounds to the nearest representable value
+    Fixed (double value) {
+        double scaled = value * double(ONE);
+        if (!(scaled == scaled)) raw = 0;
+        else if (scaled >= 9.2233720368547758e18) raw = MAX_RAW;
+        else if (scaled <= -9.2233720368547758e18) raw = -MAX_RAW;
+        else raw = std::llround(scaled);
+    };
+
+    static constexpr Fixed fromRaw (int64_t raw) {
+        return Fixed(raw, RawTag());
+    }
+
+    static constexpr Fixed max () {
+        return fromRaw(MAX_RAW);
+    }
+
+    explicit operator double () const {
+        return double(raw) / double(ONE);
+    }
+
+    explicit operator float () const {
+        return float(double(*this));
+    }
+
+    explicit operator int () const {
+        return int(raw >> FRACTION_BITS);
+    }
+
+    static Fixed saturated (__int128 raw) {
+        if (raw > MAX_RAW) return fromRaw(MAX_RAW);
+        if (raw < -MAX_RAW) return fromRaw(-MAX_RAW);
+        return fromRaw(int64_t(raw));
+    }
+
+    Fixed operator- () const {
+        return fromRaw(-raw);
+    }
+
+    Fixed& operator+= (Fixed other) {
+        return *this = saturated(__int128(raw) + other.raw);
+    }
+
+    Fixed& operator-= (Fixed other) {
+        return *this = saturated(__int128(raw) - other.raw);
+    }
+
+    // rounds to nearest, ties up
+    Fixed& operator*= (Fixed other) {
+        return *this = saturated((__int128(raw) * other.raw + (__int128(1) << (FRACTION_BITS - 1))) >> FRACTION_BITS);
+    }
+
+    // rounds towards zero
+    Fixed& operator/= (Fixed other) {
+        if (other.raw == 0) return *this = raw == 0 ? Fixed() : fromRaw(raw > 0 ? MAX_RAW : -MAX_RAW);
+        return *this = saturated(__int128(raw) * ONE / other.raw);
+    }
+};
+
+inline Fixed operator+ (Fixed a, Fixed b) { return a += b; }
+inline Fixed operator- (Fixed a, Fixed b) { return a -= b; }
+inline Fixed operator* (Fixed a, Fixed b) { return a *= b; }
+inline Fixed operator/ (Fixed a, Fixed b) { return a /= b; }
+
+inline bool operator== (Fixed a, Fixed b) { return a.raw == b.raw; }
+inline bool operator!= (Fixed a, Fixed b) { return a.raw != b.raw; }
+inline bool operator< (Fixed a, Fixed b) { return a.raw < b.raw; }
+inline bool operator> (Fixed a, Fixed b) { return a.raw > b.raw; }
+inline bool operator<= (Fixed a, Fixed b) { return a.raw <= b.raw; }
+inline bool operator>= (Fixed a, Fixed b) { return a.raw >= b.raw; }
+
+// MATH
+// Found by argument dependent lookup: like Eigen, the templates call them as
+// using std::abs; abs(x), which picks these for Fixed and the std ones otherwise.
+
+const Fixed FIXED_PI = Fixed::fromRaw(13493037705);
+const Fixed FIXED_HALF_PI = Fixed::fromRaw(6746518852);
+const Fixed FIXED_TWO_PI = Fixed::fromRaw(26986075409);
+
+Fixed abs (Fixed x) {
+    return x.raw < 0 ? -x : x;
+}
+
+Fixed copysign (Fixed magnitude, Fixed sign) {
+    return (sign.raw < 0) != (magnitude.raw < 0) ? -magnitude : magnitude;
+}
+
+Fixed floor (Fixed x) {
+    return Fixed::fromRaw(x.raw & ~(Fixed::ONE - 1));
+}
+
+// Bit by bit integer square root of raw * 2^32, exact to the last bit (rounded down).
+// Negative values give 0, where float gives NaN.
+Fixed sqrt (Fixed x) {
+    if (x.raw <= 0) return Fixed();
+    unsigned __int128 remainder = (unsigned __int128)(x.raw) << Fixed::FRACTION_BITS;
+    unsigned __int128 root = 0;
+    unsigned __int128 bit = (unsigned __int128)(1) << 94;
+    while (bit > remainder) bit >>= 2;
+    while (bit) {
+        if (remainder >= root + bit) {
+            remainder -= root + bit;
+            root = (root >> 1) + bit;
+        } else {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return Fixed::fromRaw(int64_t(root));
+}
+
+// only whole exponents, by repeated multiplication
+Fixed pow (Fixed x, int exponent) {
+    Fixed result = 1;
+    for (int i = 0; i < std::abs(exponent); i++) result *= x;
+    return exponent < 0 ? 1 / result : result;
+}
+
+Fixed pow (Fixed x, double exponent) {
+    return pow(x, int(exponent));
+}
+
+// CORDIC
+// Angles come from rotating a vector by atan(2^-i) steps, with shifts and adds only.
+// Angles are accumulated with 40 fraction bits and vectors with 60, so the
+// 40 steps are accurate to a few units in the last place of the 32 bit result.
+
+const int CORDIC_STEPS = 40;
+const int CORDIC_ANGLE_BITS = 40;
+const int CORDIC_VECTOR_BITS = 60;
+
+// round(atan(2^-i) * 2^40)
+const int64_t CORDIC_ANGLES[CORDIC_STEPS] = {
+        863554413089, 509785937287, 269356888665, 136729762476, 68630207382, 34348560106, 17178471287,
+        8589759836, 4294945451, 2147480917, 1073741483, 536870869, 268435451, 134217727, 67108864,
+        33554432, 16777216, 8388608, 4194304, 2097152, 1048576, 524288, 262144, 131072, 65536, 32768,
+        16384, 8192, 4096, 2048, 1024, 512, 256, 128, 64, 32, 16, 8, 4, 2
+};
+
+// round(2^60 / prod(sqrt(1 + 2^-2i))), the inverse of the gain of all steps
+const int64_t CORDIC_INVERSE_GAIN = 700114967507363238;
+
+int64_t cordicAngleToFixedRaw (int64_t angle) {
+    const int shift = CORDIC_ANGLE_BITS - Fixed::FRACTION_BITS;
+    return (angle + (int64_t(1) << (shift - 1))) >> shift;
+}
+
+int64_t cordicVectorToFixedRaw (int64_t coordinate) {
+    const int shift = CORDIC_VECTOR_BITS - Fixed::FRACTION_BITS;
+    return (coordinate + (int64_t(1) << (shift - 1))) >> shift;
+}
+
+// Rotates (x, y) onto the positive x axis and returns the angle that took, x must be >= 0.
+// Works on a copy scaled to just below 2^59, where the rotated vector can't overflow.
+int64_t cordicVectorAngle (int64_t x, int64_t y) {
+    uint64_t larger = std::max<uint64_t>(x, y < 0 ? -uint64_t(y) : uint64_t(y));
+    int shift = __builtin_clzll(larger) - 5;
+    if (shift >= 0) {
+        x <<= shift;
+        y = int64_t(uint64_t(y) << shift);
+    } else {
+        x >>= -shift;
+        y >>= -shift;
+    }
+
+    int64_t angle = 0;
+    for (int i = 0; i < CORDIC_STEPS; i++) {
+        int64_t dx = y >> i, dy = x >> i;
+        if (y > 0) {
+            x += dx;
+            y -= dy;
+            angle += CORDIC_ANGLES[i];
+        } else {
+            x -= dx;
+            y += dy;
+            angle -= CORDIC_ANGLES[i];
+        }
+    }
+    return angle;
+}
+
+Fixed atan2 (Fixed y, Fixed x) {
+    if (x.raw == 0 && y.raw == 0) return Fixed();
+    if (x.raw >= 0) return Fixed::fromRaw(cordicAngleToFixedRaw(cordicVectorAngle(x.raw, y.raw)));
+    // turned by half a turn into the right half plane first
+    Fixed angle = Fixed::fromRaw(cordicAngleToFixedRaw(cordicVectorAngle(-x.raw, -y.raw)));
+    return y.raw >= 0 ? angle + FIXED_PI : angle - FIXED_PI;
+}
+
+// x is clamped to [-1, 1]
+Fixed acos (Fixed x) {
+    x = std::min(Fixed(1), std::max(Fixed(-1), x));
+    return atan2(sqrt((1 - x) * (1 + x)), x);
+}
+
+// Both at once, by rotating (1, 0) by angle
+void sinCos (Fixed angle, Fixed& sine, Fixed& cosine) {
+    int64_t reduced = angle.raw % FIXED_TWO_PI.raw;
+    if (reduced > FIXED_PI.raw) reduced -= FIXED_TWO_PI.raw;
+    if (reduced < -FIXED_PI.raw) reduced += FIXED_TWO_PI.raw;
+    // CORDIC only converges within [-pi/2, pi/2], beyond that rotate by half a turn less and flip
+    bool flipped = false;
+    if (reduced > FIXED_HALF_PI.raw) {
+        reduced -= FIXED_PI.raw;
+        flipped = true;
+    } else if (reduced < -FIXED_HALF_PI.raw) {
+        reduced += FIXED_PI.raw;
+        flipped = true;
+    }
+
+    int64_t remaining = reduced * (int64_t(1) << (CORDIC_ANGLE_BITS - Fixed::FRACTION_BITS));
+    int64_t x = CORDIC_INVERSE_GAIN, y = 0;
+    for (int i = 0; i < CORDIC_STEPS; i++) {
+        int64_t dx = y >> i, dy = x >> i;
+        if (remaining > 0) {
+            x -= dx;
+            y += dy;
+            remaining -= CORDIC_ANGLES[i];
+        } else {
+            x += dx;
+            y -= dy;
+            remaining += CORDIC_ANGLES[i];
+        }
+    }
+
+    cosine = Fixed::fromRaw(cordicVectorToFixedRaw(flipped ? -x : x));
+    sine = Fixed::fromRaw(cordicVectorToFixedRaw(flipped ? -y : y));
+}
+
+Fixed sin (Fixed angle) {
+    Fixed sine, cosine;
+    sinCos(angle, sine, cosine);
+    return sine;
+}
+
+Fixed cos (Fixed angle) {
+    Fixed sine, cosine;
+    sinCos(angle, sine, cosine);
+    return cosine;
+}
+
+namespace std {
+    template <> class numeric_limits<Fixed> {
+    public:
+        static const bool is_specialized = true;
+        static const bool is_signed = true;
+        static const bool is_integer = false;
+        static const bool is_exact = true;
+        static const bool has_infinity = false;
+        static const bool has_quiet_NaN = false;
+        static const int digits = 63;
+        static const int digits10 = 9;
+        static const int radix = 2;
+
+        static constexpr Fixed min () { return Fixed::fromRaw(1); }
+        static constexpr Fixed max () { return Fixed::max(); }
+        static constexpr Fixed lowest () { return Fixed::fromRaw(-Fixed::MAX_RAW); }
+        static constexpr Fixed epsilon () { return Fixed::fromRaw(1); }
+        static constexpr Fixed round_error () { return Fixed::fromRaw(1); }
+    };
+}
+
+namespace Eigen {
+    template <> struct NumTraits<Fixed> : GenericNumTraits<Fixed> {
+        typedef Fixed Real;
+        typedef Fixed NonInteger;
+        typedef Fixed Nested;
+        typedef Fixed Literal;
+
+        enum {
+            IsComplex = 0,
+            IsInteger = 0,
+            IsSigned = 1,
+            RequireInitialization = 1,
+            ReadCost = 1,
+            AddCost = 2,
+            MulCost = 4
+        };
+
+        static inline Real epsilon () { return Fixed::fromRaw(1); }
+        static inline Real dummy_precision () { return Fixed::fromRaw(1 << 12); }
+        static inline Real highest () { return Fixed::max(); }
+        static inline Real lowest () { return -Fixed::max(); }
+        static inline int digits10 () { return 9; }
+    };
+}
+
+typedef Eigen::Matrix<Fixed, 2, 1> vec2x;
+
+// GEOMETRY
+
+// Fixed has the same absolute precision everywhere, thickness is 2^12 of its steps (about 1e-6)
+template <> struct Tolerances<Fixed> {
+    static constexpr Fixed thickness () { return Fixed::fromRaw(1 << 12); }
+    static constexpr Fixed rough () { return Fixed::fromRaw(1 << 4); }
+};
+
+typedef CircleT<Fixed> Circlex;
+typedef LineT<Fixed> Linex;
+typedef RayT<Fixed> Rayx;
+typedef SegmentT<Fixed> Segmentx;
+typedef IntersectionT<Fixed> Intersectionx;
+
+// Fixed point coordinates are integers, so the orientation determinant is exact in 128 bit
+// integers, in units of 2^-64, for coordinates within +-2^30
+__int128 fixedOrientation (Vec2<Fixed> a, Vec2<Fixed> b, Vec2<Fixed> c) {
+    instrument(ORIENTATION_CALLS);
+    __int128 acx = __int128(a[0].raw) - c[0].raw, acy = __int128(a[1].raw) - c[1].raw;
+    __int128 bcx = __int128(b[0].raw) - c[0].raw, bcy = __int128(b[1].raw) - c[1].raw;
+    return acx * bcy - acy * bcx;
+}
+
+// only the final conversion rounds, the sign is always exact
+template <>
+double orientation (Vec2<Fixed> a, Vec2<Fixed> b, Vec2<Fixed> c) {
+    return std::ldexp(double(fixedOrientation(a, b, c)), -2 * Fixed::FRACTION_BITS);
+}
+
+template <>
+bool orientationWithin (Vec2<Fixed> a, Vec2<Fixed> b, Vec2<Fixed> c, double tolerance) {
+    __int128 det = fixedOrientation(a, b, c);
+    double limit = std::floor(std::ldexp(tolerance, 2 * Fixed::FRACTION_BITS));
+    if (limit >= std::ldexp(1.0, 126)) return true;
+    return (det < 0 ? -det : det) <= __int128(limit);
+}
+
+#endif //COMPASS_FIXED_POINT_H
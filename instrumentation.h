@@ -0,0 +1,198 @@
+#ifndef COMPASS_INSTRUMENTATION_H
+#define COMPASS_INSTRUMENTATION_H
+
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <cstdio>
+
+// Opt-in counters for the intersection hot path, to tell call volume from expensive cases
+// when frame times spike. Defining COMPASS_INSTRUMENTATION turns them on, without it every
+// instrument() is a branch on a constant that the compiler drops. COMPASS_INSTRUMENTATION_TIMING
+// additionally times the calls that are wrapped in a ScopedTiming, at the cost of two clock reads each.
+// Every thread counts into its own slots, which only it writes, so counting never locks or
+// contends. Snapshots sum up all threads, including ones that have finished.
+
+#if defined(COMPASS_INSTRUMENTATION) || defined(COMPASS_INSTRUMENTATION_TIMING)
+const bool INSTRUMENTATION = true;
+#else
+const bool INSTRUMENTATION = false;
+#endif
+
+#ifdef COMPASS_INSTRUMENTATION_TIMING
+const bool INSTRUMENTATION_TIMING = true;
+#else
+const bool INSTRUMENTATION_TIMING = false;
+#endif
+
+enum InstrumentationCounter {
+    // calls per primitive pair, intersect(SegmentT&, ...) counts once for each side it is resolved from
+    LINE_LINE_CALLS, CIRCLE_CIRCLE_CALLS, LINE_CIRCLE_CALLS, RAY_CALLS, SEGMENT_CALLS, SEGMENT_SINK_CALLS,
+    // early outs
+    PARALLEL_LINES, NEARLY_PARALLEL_LINES, CONCENTRIC_CIRCLES, SEPARATE_CIRCLES, NESTED_CIRCLES,
+    TANGENT_CIRCLES, LINE_MISSES_CIRCLE, TANGENT_LINE,
+    // candidates within thickness of an end that are clamped onto it, and ones that are rejected
+    RAY_START_CLAMPED, RAY_START_REJECTED, SEGMENT_END_CLAMPED, SEGMENT_END_REJECTED, ARC_END_CLAMPED, ARC_REJECTED,
+    // arc quantities computed from scratch: on construction and in offsetAt
+    ARC_CONSTRUCTIONS, ARC_OFFSET_LOOKUPS,
+    // predicates of predicates.h, and how often their plain double result was too close to call
+    ORIENTATION_CALLS, ORIENTATION_ESCALATIONS, IN_CIRCLE_CALLS, IN_CIRCLE_ESCALATIONS,
+    COUNTERS
+};
+
+const char* const COUNTER_NAMES[COUNTERS] = {
+        "line-line calls", "circle-circle calls", "line-circle calls", "ray calls", "segment calls",
+        "segment sink calls",
+        "parallel lines", "nearly parallel lines", "concentric circles", "separate circles", "nested circles",
+        "tangent circles", "line misses circle", "tangent line",
+        "ray start clamped", "ray start rejected", "segment end clamped", "segment end rejected",
+        "arc end clamped", "arc rejected",
+        "arc constructions", "arc offset lookups",
+        "orientation calls", "orientation escalations", "in-circle calls", "in-circle escalations"
+};
+
+struct InstrumentationSnapshot {
+    long counts[COUNTERS];
+    // only with COMPASS_INSTRUMENTATION_TIMING
+    long nanoseconds[COUNTERS];
+
+    InstrumentationSnapshot () : counts(), nanoseconds() {};
+
+    long operator[] (InstrumentationCounter counter) const {
+        return counts[counter];
+    }
+
+    // what happened between an earlier snapshot and this one
+    InstrumentationSnapshot operator- (const InstrumentationSnapshot& earlier) const {
+        InstrumentationSnapshot difference;
+        for (int c = 0; c < COUNTERS; c++) {
+            difference.counts[c] = counts[c] - earlier.counts[c];
+            difference.nanoseconds[c] = nanoseconds[c] - earlier.nanoseconds[c];
+        }
+        return difference;
+    }
+
+    InstrumentationSnapshot& operator+= (const InstrumentationSnapshot& other) {
+        for (int c = 0; c < COUNTERS; c++) {
+            counts[c] += other.counts[c];
+            nanoseconds[c] += other.nanoseconds[c];
+        }
+        return *this;
+    }
+
+    // one "name: count" line per counter that isn't zero, with the time where there is one
+    void dump (FILE* out) const {
+        for (int c = 0; c < COUNTERS; c++) {
+            if (!counts[c]) continue;
+            if (nanoseconds[c]) {
+                std::fprintf(out, "%s: %ld (%.1f ns each)\n", COUNTER_NAMES[c], counts[c], double(nanoseconds[c]) / counts[c]);
+            } else {
+                std::fprintf(out, "%s: %ld\n", COUNTER_NAMES[c], counts[c]);
+            }
+        }
+    }
+};
+
+// The slots of one thread. Only their thread writes them, atomics just make reading them from
+// snapshots well defined, all accesses are relaxed loads and stores.
+struct ThreadCounters {
+    std::atomic<long> counts[COUNTERS];
+    std::atomic<long> nanoseconds[COUNTERS];
+
+    ThreadCounters ();
+    ~ThreadCounters ();
+
+    InstrumentationSnapshot snapshot () const {
+        InstrumentationSnapshot snapshot;
+        for (int c = 0; c < COUNTERS; c++) {
+            snapshot.counts[c] = counts[c].load(std::memory_order_relaxed);
+            snapshot.nanoseconds[c] = nanoseconds[c].load(std::memory_order_relaxed);
+        }
+        return snapshot;
+    }
+};
+
+// All live threads' slots, and the sums of threads that have finished. Locked only
+// when a thread counts for the first time, when it ends and for snapshots.
+struct InstrumentationRegistry {
+    std::mutex mutex;
+    std::vector<ThreadCounters*> threads;
+    InstrumentationSnapshot finished;
+};
+
+InstrumentationRegistry& instrumentationRegistry () {
+    static InstrumentationRegistry registry;
+    return registry;
+}
+
+ThreadCounters::ThreadCounters () {
+    for (int c = 0; c < COUNTERS; c++) {
+        counts[c].store(0, std::memory_order_relaxed);
+        nanoseconds[c].store(0, std::memory_order_relaxed);
+    }
+    auto& registry = instrumentationRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.threads.push_back(this);
+}
+
+ThreadCounters::~ThreadCounters () {
+    auto& registry = instrumentationRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.finished += snapshot();
+    registry.threads.erase(std::find(registry.threads.begin(), registry.threads.end(), this));
+}
+
+ThreadCounters& threadCounters () {
+    static thread_local ThreadCounters counters;
+    return counters;
+}
+
+void instrument (InstrumentationCounter counter) {
+    if (!INSTRUMENTATION) return;
+    auto& slot = threadCounters().counts[counter];
+    slot.store(slot.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+// Counts a call to counter and, with COMPASS_INSTRUMENTATION_TIMING, adds the time until it goes out of scope
+class ScopedTiming {
+    InstrumentationCounter counter;
+    std::chrono::steady_clock::time_point started;
+
+public:
+    explicit ScopedTiming (InstrumentationCounter counter) : counter(counter) {
+        instrument(counter);
+        if (INSTRUMENTATION_TIMING) started = std::chrono::steady_clock::now();
+    };
+
+    ScopedTiming (const ScopedTiming&) = delete;
+    ScopedTiming& operator= (const ScopedTiming&) = delete;
+
+    ~ScopedTiming () {
+        if (!INSTRUMENTATION_TIMING) return;
+        long elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - started).count();
+        auto& slot = threadCounters().nanoseconds[counter];
+        slot.store(slot.load(std::memory_order_relaxed) + elapsed, std::memory_order_relaxed);
+    }
+};
+
+// SNAPSHOTS
+
+// The counts of the calling thread only
+InstrumentationSnapshot threadInstrumentation () {
+    return threadCounters().snapshot();
+}
+
+// The counts of all threads so far, for telemetry. Other threads keep counting
+// while it sums them up, so it is a consistent total only once they are idle.
+InstrumentationSnapshot instrumentationSnapshot () {
+    auto& registry = instrumentationRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    InstrumentationSnapshot total = registry.finished;
+    for (auto thread : registry.threads) total += thread->snapshot();
+    return total;
+}
+
+#endif //COMPASS_INSTRUMENTATION_H
@@ -0,0 +1,173 @@
+#ifndef COMPASS_INTERSECT_ALL_H
+#define COMPASS_INTERSECT_ALL_H
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <iterator>
+#include "primitives.h"
+#include "intersections.h"
+#include "bounding-box.h"
+#include "segment-grid.h"
+#include "segment-batch.h"
+#include "work-stealing-pool.h"
+
+enum BroadPhase {GRID, SWEEP_LINE};
+
+typedef std::pair<int, int> SegmentPair;
+
+// Sweeps a vertical line over the bounds from left to right, keeping the
+// segments it currently crosses active and reporting every active pair whose
+// bounds also overlap vertically. Only needs the bounds, so arcs work as well.
+std::vector<SegmentPair> sweepLineCandidatePairs (std::vector<BoundingBox>& bounds) {
+    std::vector<int> byLeftEdge(bounds.size());
+    for (int i = 0; i < bounds.size(); i++) byLeftEdge[i] = i;
+    std::sort(byLeftEdge.begin(), byLeftEdge.end(), [&](int i, int j) {
+        return bounds[i].min[0] < bounds[j].min[0] || (bounds[i].min[0] == bounds[j].min[0] && i < j);
+    });
+
+    std::vector<SegmentPair> pairs;
+    std::vector<int> active;
+
+    for (int i : byLeftEdge) {
+        float sweepX = bounds[i].min[0];
+
+        for (int a = 0; a < active.size();) {
+            int j = active[a];
+            if (bounds[j].max[0] < sweepX) {
+                active[a] = active.back();
+                active.pop_back();
+            } else {
+                if (bounds[j].min[1] <= bounds[i].max[1] && bounds[i].min[1] <= bounds[j].max[1]) {
+                    pairs.push_back(i < j ? SegmentPair(i, j) : SegmentPair(j, i));
+                }
+                a++;
+            }
+        }
+
+        active.push_back(i);
+    }
+
+    return pairs;
+}
+
+std::vector<SegmentPair> gridCandidatePairs (std::vector<BoundingBox>& bounds) {
+    SegmentGrid grid(bounds);
+    std::vector<SegmentPair> pairs;
+    grid.forEachCandidatePair([&](int i, int j) {
+        pairs.push_back(SegmentPair(i, j));
+    });
+    return pairs;
+}
+
+// Finds all intersections between different segments of a set, running the
+// narrow phase intersect() only on pairs whose bounds overlap, and writes them to the
+// output iterator out. With a std::back_inserter into a vector that is kept between
+// calls, or a pointer into a big enough buffer, the results don't allocate.
+// Results are ordered by indexA < indexB, exactly like a nested loop would produce them.
+template <typename OutputIterator>
+OutputIterator intersectAllInto (std::vector<Segment>& segments, OutputIterator out, BroadPhase broadPhase = GRID) {
+    std::vector<BoundingBox> bounds;
+    bounds.reserve(segments.size());
+    for (auto& segment : segments) bounds.push_back(boundsOf(segment));
+
+    auto pairs = broadPhase == GRID ? gridCandidatePairs(bounds) : sweepLineCandidatePairs(bounds);
+    std::sort(pairs.begin(), pairs.end());
+
+    for (auto& pair : pairs) {
+        intersectInto(segments[pair.first], segments[pair.second], [&](Intersection& i) {
+            *out++ = BatchIntersection{pair.first, pair.second, i.alongA, i.alongB, i.position};
+        });
+    }
+
+    return out;
+}
+
+std::vector<BatchIntersection> intersectAll (std::vector<Segment>& segments, BroadPhase broadPhase = GRID) {
+    std::vector<BatchIntersection> results;
+    intersectAllInto(segments, std::back_inserter(results), broadPhase);
+    return results;
+}
+
+// PARALLEL
+
+// Width and height of a tile in grid cells, tiles are the unit of work of intersectAllParallel
+const int INTERSECT_ALL_TILE_CELLS = 8;
+
+bool beforeInPairOrder (const BatchIntersection& a, const BatchIntersection& b) {
+    return a.indexA < b.indexA || (a.indexA == b.indexA && a.indexB < b.indexB);
+}
+
+// Same results in the same order as intersectAll, computed on the threads of pool.
+// The grid is cut into square tiles of cells, each tile collects the pairs its cells report
+// into its own buffer, which is sorted by pair right there. The sorted tile buffers are merged
+// at the end. A pair always belongs to the same tile, so the output doesn't depend on the thread count.
+std::vector<BatchIntersection> intersectAllParallel (std::vector<Segment>& segments, WorkStealingPool& pool) {
+    SegmentGrid grid(segments);
+    int tileColumns = (grid.columns + INTERSECT_ALL_TILE_CELLS - 1) / INTERSECT_ALL_TILE_CELLS;
+    int tileRows = (grid.rows + INTERSECT_ALL_TILE_CELLS - 1) / INTERSECT_ALL_TILE_CELLS;
+    std::vector<std::vector<BatchIntersection>> tileResults(tileColumns * tileRows);
+
+    pool.run(tileResults.size(), [&](int tile) {
+        auto& results = tileResults[tile];
+        auto addIntersections = [&](int i, int j) {
+            intersectInto(segments[i], segments[j], [&](Intersection& intersection) {
+                results.push_back({i, j, intersection.alongA, intersection.alongB, intersection.position});
+            });
+        };
+
+        int firstColumn = (tile % tileColumns) * INTERSECT_ALL_TILE_CELLS;
+        int firstRow = (tile / tileColumns) * INTERSECT_ALL_TILE_CELLS;
+        for (int row = firstRow; row < std::min(grid.rows, firstRow + INTERSECT_ALL_TILE_CELLS); row++) {
+            for (int column = firstColumn; column < std::min(grid.columns, firstColumn + INTERSECT_ALL_TILE_CELLS); column++) {
+                grid.forEachCandidatePairInCell(column, row, addIntersections);
+            }
+        }
+
+        // stable, so the intersections of one pair stay in the order intersect() returned them
+        std::stable_sort(results.begin(), results.end(), beforeInPairOrder);
+    });
+
+    // k-way merge of the tile buffers, pairs never occur in more than one of them
+    typedef std::pair<int, int> TileCursor;
+    auto laterCursor = [&](const TileCursor& a, const TileCursor& b) {
+        return beforeInPairOrder(tileResults[b.first][b.second], tileResults[a.first][a.second]);
+    };
+    std::vector<TileCursor> cursors;
+    size_t total = 0;
+    for (int tile = 0; tile < tileResults.size(); tile++) {
+        total += tileResults[tile].size();
+        if (!tileResults[tile].empty()) cursors.push_back(TileCursor(tile, 0));
+    }
+    std::make_heap(cursors.begin(), cursors.end(), laterCursor);
+
+    std::vector<BatchIntersection> results;
+    results.reserve(total);
+    while (!cursors.empty()) {
+        std::pop_heap(cursors.begin(), cursors.end(), laterCursor);
+        auto& cursor = cursors.back();
+        auto& tile = tileResults[cursor.first];
+        // the whole run of one pair at once
+        int pairEnd = cursor.second + 1;
+        while (pairEnd < tile.size() && tile[pairEnd].indexA == tile[cursor.second].indexA
+               && tile[pairEnd].indexB == tile[cursor.second].indexB) pairEnd++;
+        results.insert(results.end(), tile.begin() + cursor.second, tile.begin() + pairEnd);
+
+        if (pairEnd < tile.size()) {
+            cursor.second = pairEnd;
+            std::push_heap(cursors.begin(), cursors.end(), laterCursor);
+        } else {
+            cursors.pop_back();
+        }
+    }
+
+    return results;
+}
+
+// a threadCount of 0 uses all hardware threads
+std::vector<BatchIntersection> intersectAllParallel (std::vector<Segment>& segments, int threadCount = 0) {
+    WorkStealingPool pool(threadCount);
+    return intersectAllParallel(segments, pool);
+}
+
+#endif //COMPASS_INTERSECT_ALL_H
@@ -0,0 +1,255 @@
+#ifndef COMPASS_INTERSECTION_GRAPH_H
+#define COMPASS_INTERSECTION_GRAPH_H
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include "primitives.h"
+#include "intersections.h"
+#include "bounding-box.h"
+#include "intersect-all.h"
+
+// Intersections that appeared or disappeared since the changes were last taken,
+// indexA and indexB are segment ids
+struct IntersectionChanges {
+    std::vector<BatchIntersection> added;
+    std::vector<BatchIntersection> removed;
+
+    bool empty () const {
+        return added.empty() && removed.empty();
+    }
+};
+
+// Segments whose bounds cover more grid cells than this are kept in one list instead,
+// a single long road would otherwise fill millions of cells
+const int MAX_CELLS_PER_SEGMENT = 16;
+
+// Grid cell indices are clamped to this, far away coordinates would overflow int
+const float MAX_CELL_INDEX = 1 << 30;
+
+// Keeps all intersections between a changing set of segments up to date.
+// Segments are kept in a hash grid of their bounds, so inserting, removing or
+// modifying one only intersects it with the segments whose bounds it overlaps.
+// Intersections are stored per pair of segment ids (lower id first) and, like
+// in intersectAll, computed as intersect(lower id segment, higher id segment).
+class IntersectionGraph {
+    struct Entry {
+        Segment segment;
+        BoundingBox bounds;
+
+        Entry (Segment segment) : segment(segment), bounds(boundsOf(segment)) {};
+    };
+
+    // inclusive, clamped cell indices covered by a bounding box
+    struct CellRange {
+        int minColumn, maxColumn, minRow, maxRow;
+
+        // in long long before subtracting, a range across both clamps spans more than int holds
+        long long size () const {
+            long long columns = (long long)(maxColumn) - (long long)(minColumn) + 1;
+            long long rows = (long long)(maxRow) - (long long)(minRow) + 1;
+            return columns * rows;
+        }
+
+        bool large () const {
+            return size() > MAX_CELLS_PER_SEGMENT;
+        }
+    };
+
+    float cellSize;
+    int nextId = 0;
+    std::unordered_map<int, Entry> entries;
+    std::unordered_map<long long, std::vector<int>> cells;
+    // segments with large bounds, which aren't in any cell
+    std::vector<int> largeSegments;
+    std::map<SegmentPair, std::vector<BatchIntersection>> pairIntersections;
+    IntersectionChanges changes;
+
+    // reused between calls
+    std::vector<int> candidates;
+    std::vector<BatchIntersection> before;
+    std::vector<BatchIntersection> after;
+
+public:
+    // cellSize should be around the typical segment extent
+    explicit IntersectionGraph (float cellSize = 1) : cellSize(cellSize) {};
+
+    int insert (Segment segment) {
+        int id = nextId++;
+        insertWithId(id, segment);
+        return id;
+    }
+
+    void remove (int id) {
+        unlink(id, changes.removed);
+    }
+
+    // Replaces the segment with the given id. Only intersections that differ
+    // from its old ones are reported, as removed and added.
+    void modify (int id, Segment segment) {
+        before.clear();
+        after.clear();
+        unlink(id, before);
+        link(id, segment, after);
+
+        for (auto& old : before) {
+            if (std::find_if(after.begin(), after.end(), SameIntersection(old)) == after.end()) {
+                changes.removed.push_back(old);
+            }
+        }
+        for (auto& found : after) {
+            if (std::find_if(before.begin(), before.end(), SameIntersection(found)) == before.end()) {
+                changes.added.push_back(found);
+            }
+        }
+    }
+
+    bool contains (int id) const {
+        return entries.count(id) > 0;
+    }
+
+    Segment& segment (int id) {
+        return entries.at(id).segment;
+    }
+
+    int size () const {
+        return entries.size();
+    }
+
+    // Calls f(intersection) for every current intersection, ordered by pair like intersectAll
+    template <typename F>
+    void forEachIntersection (F f) const {
+        for (auto& pair : pairIntersections) {
+            for (auto& intersection : pair.second) f(intersection);
+        }
+    }
+
+    // Returns the changes since the last call and starts collecting anew
+    IntersectionChanges takeChanges () {
+        IntersectionChanges taken;
+        std::swap(taken, changes);
+        return taken;
+    }
+
+private:
+    static SegmentPair orderedPair (int a, int b) {
+        return a < b ? SegmentPair(a, b) : SegmentPair(b, a);
+    }
+
+    // bit for bit, modify() only reports intersections that changed at all
+    struct SameIntersection {
+        const BatchIntersection& a;
+
+        explicit SameIntersection (const BatchIntersection& a) : a(a) {};
+
+        bool operator() (const BatchIntersection& b) const {
+            return a.indexA == b.indexA && a.indexB == b.indexB && a.alongA == b.alongA && a.alongB == b.alongB
+                && a.position == b.position;
+        }
+    };
+
+    // unsigned, shifting a negative column would be undefined
+    static long long cellKey (int column, int row) {
+        return (long long)((unsigned long long)(unsigned int)(column) << 32 | (unsigned int)(row));
+    }
+
+    int cellIndex (float coordinate) const {
+        float index = std::floor(coordinate / cellSize);
+        return int(std::max(-MAX_CELL_INDEX, std::min(MAX_CELL_INDEX, index)));
+    }
+
+    CellRange cellRange (const BoundingBox& box) const {
+        return {cellIndex(box.min[0]), cellIndex(box.max[0]), cellIndex(box.min[1]), cellIndex(box.max[1])};
+    }
+
+    template <typename F>
+    void forEachCellKey (const CellRange& range, F f) const {
+        for (int row = range.minRow; row <= range.maxRow; row++) {
+            for (int column = range.minColumn; column <= range.maxColumn; column++) f(cellKey(column, row));
+        }
+    }
+
+    // Fills candidates with the ids of all other segments whose bounds overlap box, each once.
+    // Large boxes check every segment instead of walking their cells.
+    void findCandidates (int id, const BoundingBox& box) {
+        candidates.clear();
+        auto addIfOverlapping = [&](int other) {
+            if (other != id && entries.at(other).bounds.overlaps(box)) candidates.push_back(other);
+        };
+
+        CellRange range = cellRange(box);
+        if (range.large()) {
+            for (auto& entry : entries) addIfOverlapping(entry.first);
+        } else {
+            forEachCellKey(range, [&](long long key) {
+                auto cell = cells.find(key);
+                if (cell == cells.end()) return;
+                for (int other : cell->second) addIfOverlapping(other);
+            });
+            for (int other : largeSegments) addIfOverlapping(other);
+        }
+        std::sort(candidates.begin(), candidates.end());
+        candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    }
+
+    void insertWithId (int id, Segment segment) {
+        link(id, segment, changes.added);
+    }
+
+    // Adds the segment with its intersections, appending them to found
+    void link (int id, Segment segment, std::vector<BatchIntersection>& found) {
+        auto& entry = entries.emplace(id, Entry(segment)).first->second;
+
+        findCandidates(id, entry.bounds);
+        for (int other : candidates) {
+            auto pair = orderedPair(id, other);
+            auto intersections = intersect(entries.at(pair.first).segment, entries.at(pair.second).segment);
+            if (intersections.size() == 0) continue;
+
+            auto& stored = pairIntersections[pair];
+            for (auto& intersection : intersections) {
+                stored.push_back({pair.first, pair.second, intersection.alongA, intersection.alongB, intersection.position});
+            }
+            found.insert(found.end(), stored.begin(), stored.end());
+        }
+
+        CellRange range = cellRange(entry.bounds);
+        if (range.large()) {
+            largeSegments.push_back(id);
+        } else {
+            forEachCellKey(range, [&](long long key) {
+                cells[key].push_back(id);
+            });
+        }
+    }
+
+    // Removes the segment with its intersections, appending them to dropped
+    void unlink (int id, std::vector<BatchIntersection>& dropped) {
+        auto entry = entries.find(id);
+        if (entry == entries.end()) return;
+
+        findCandidates(id, entry->second.bounds);
+        for (int other : candidates) {
+            auto pair = pairIntersections.find(orderedPair(id, other));
+            if (pair == pairIntersections.end()) continue;
+            dropped.insert(dropped.end(), pair->second.begin(), pair->second.end());
+            pairIntersections.erase(pair);
+        }
+
+        CellRange range = cellRange(entry->second.bounds);
+        if (range.large()) {
+            largeSegments.erase(std::find(largeSegments.begin(), largeSegments.end(), id));
+        } else {
+            forEachCellKey(range, [&](long long key) {
+                auto& cell = cells[key];
+                cell.erase(std::find(cell.begin(), cell.end(), id));
+                if (cell.empty()) cells.erase(key);
+            });
+        }
+        entries.erase(entry);
+    }
+};
+
+#endif //COMPASS_INTERSECTION_GRAPH_H
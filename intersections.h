@@ -5,17 +5,19 @@
 #ifndef COMPASS_INTERSECTIONS_H
 #define COMPASS_INTERSECTIONS_H
 
+#include <algorithm>
+#include <limits>
+#include <utility>
 #include "primitives.h"
 #include "at-most.h"
-#include "lzy/lzy.h"
-
-using namespace lzy;
+#include "predicates.h"
 
 const float ROUGH_TOLERANCE = 0.0000001;
 
 template<typename N1, typename N2, typename N3>
 bool roughlyEqual(N1 a, N2 b, N3 tolerance) {
-    return std::abs(b - a) <= tolerance;
+    using std::abs;
+    return abs(b - a) <= tolerance;
 }
 
 template <typename N3>
@@ -32,163 +34,390 @@ float pointToLineDistance (vec2 point, vec2 start, vec2 direction) {
     return std::abs((point - start).dot(direction.unitOrthogonal()));
 }
 
-struct Intersection {
-    float alongA;
-    float alongB;
-    vec2 position;
-
-    Intersection (float alongA, float alongB, vec2 position)
-            : alongA(alongA), alongB(alongB), position(position) {};
+template <typename Scalar>
+struct IntersectionT {
+    Scalar alongA;
+    Scalar alongB;
+    Vec2<Scalar> position;
 
-    Intersection (Intersection&& other)
-            : alongA(other.alongA), alongB(other.alongB), position(std::move(other.position)) {};
+    // uninitialized, for buffers that are filled later
+    IntersectionT () {};
 
-    Intersection (const Intersection&& other)
-            : alongA(other.alongA), alongB(other.alongB), position(std::move(other.position)) {};
+    IntersectionT (Scalar alongA, Scalar alongB, Vec2<Scalar> position)
+            : alongA(alongA), alongB(alongB), position(position) {};
 
-    Intersection swapped () const {
-        return Intersection(alongB, alongA, position);
+    IntersectionT swapped () const {
+        return IntersectionT(alongB, alongA, position);
     }
 };
 
+typedef IntersectionT<float> Intersection;
+typedef IntersectionT<double> Intersectiond;
+
+// swaps the roles of a and b, in place
+template <int N, typename Scalar>
+void swapAlongs (AtMost<N, IntersectionT<Scalar>>& intersections) {
+    for (auto& i : intersections) std::swap(i.alongA, i.alongB);
+}
+
 // FUNDAMENTAL INTERSECTIONS
 
-AtMost<1, Intersection> intersect (Line a, Line b) {
-    auto det = b.direction[0] * a.direction[1] - b.direction[1] * a.direction[0];
+template <typename Scalar>
+bool roughlyParallel (const Vec2<Scalar>& a, const Vec2<Scalar>& b) {
+    return orientationWithin(b, a, Vec2<Scalar>(0, 0), double(Tolerances<Scalar>::rough()));
+}
 
-    if (roughlyEqual(0, det)) return {};
+// Each writes its intersections to out, which has room for two, and returns how many there are.
+// The intersect() overloads below collect them in an AtMost, bulk queries use these directly.
+
+template <typename Scalar>
+int writeIntersections (LineT<Scalar> a, LineT<Scalar> b, IntersectionT<Scalar>* out) {
+    instrument(LINE_LINE_CALLS);
+    Scalar detLeft = b.direction[0] * a.direction[1];
+    Scalar detRight = b.direction[1] * a.direction[0];
+    Scalar det = detLeft - detRight;
+
+    // Only trust det to decide if it's clearly away from the tolerance,
+    // otherwise compare the orientation of the two directions exactly
+    using std::abs;
+    Scalar detError = 4 * std::numeric_limits<Scalar>::epsilon() * (abs(detLeft) + abs(detRight));
+    if (abs(det) <= Tolerances<Scalar>::rough() + detError) {
+        if (abs(det) < Tolerances<Scalar>::rough() - detError) {
+            instrument(PARALLEL_LINES);
+            return 0;
+        }
+        instrument(NEARLY_PARALLEL_LINES);
+        if (roughlyParallel(a.direction, b.direction)) return 0;
+    }
 
     auto delta = b.start - a.start;
     auto alongA = (delta[1] * b.direction[0] - delta[0] * b.direction[1]) / det;
     auto alongB = (delta[1] * a.direction[0] - delta[0] * a.direction[1]) / det;
 
-    return {Intersection(alongA, alongB, a.start + alongA * a.direction)};
+    out[0] = IntersectionT<Scalar>(alongA, alongB, a.start + alongA * a.direction);
+    return 1;
 };
 
-AtMost<2, Intersection> intersect (Circle& a, Circle& b) {
-    auto aToB = (b.center - a.center);
+// The writeCrossings() variants find the same intersections as writeIntersections(), but leave
+// offsets along circles at 0, because those take trig. For arcs that compute their own offsets.
+
+template <typename Scalar>
+int writeCrossings (CircleT<Scalar>& a, CircleT<Scalar>& b, IntersectionT<Scalar>* out) {
+    instrument(CIRCLE_CIRCLE_CALLS);
+    const Scalar thickness = Tolerances<Scalar>::thickness();
+    Vec2<Scalar> aToB = (b.center - a.center);
     auto aToBDist = aToB.norm();
 
-    if ((roughlyEqual(aToBDist, 0, thickness) && roughlyEqual(a.radius, b.radius, thickness))
-        || aToBDist > (a.radius + b.radius + thickness)
-        || aToBDist < std::abs(a.radius - b.radius) - thickness)
-        return {};
+    if (roughlyEqual(aToBDist, 0, thickness) && roughlyEqual(a.radius, b.radius, thickness)) {
+        instrument(CONCENTRIC_CIRCLES);
+        return 0;
+    }
+    if (aToBDist > (a.radius + b.radius + thickness)) {
+        instrument(SEPARATE_CIRCLES);
+        return 0;
+    }
+    using std::abs;
+    if (aToBDist < abs(a.radius - b.radius) - thickness) {
+        instrument(NESTED_CIRCLES);
+        return 0;
+    }
 
+    using std::pow;
+    using std::sqrt;
     auto aToCentroidDist = (pow(a.radius, 2) - pow(b.radius, 2) + pow(aToBDist, 2)) / (2 * aToBDist);
     auto intersectionToCentroidDist = sqrt(pow(a.radius, 2) - pow(aToCentroidDist, 2));
 
-    auto centroid = a.center + (aToB * aToCentroidDist / aToBDist);
+    Vec2<Scalar> centroid = a.center + (aToB * aToCentroidDist / aToBDist);
 
-    auto centroidToIntersection = aToB.unitOrthogonal() * intersectionToCentroidDist;
+    Vec2<Scalar> centroidToIntersection = aToB.unitOrthogonal() * intersectionToCentroidDist;
 
     // solution 1P
-    auto solution1Position = centroid + centroidToIntersection;
-    auto&& solution1 = Intersection(
-            a.offsetAt(solution1Position),
-            b.offsetAt(solution1Position),
-            solution1Position
-    );
+    out[0] = IntersectionT<Scalar>(0, 0, centroid + centroidToIntersection);
 
-    if (roughlyEqual((centroid - a.center).norm() - a.radius, 0, thickness)) return {std::move(solution1)};
+    if (roughlyEqual((centroid - a.center).norm() - a.radius, 0, thickness)) {
+        instrument(TANGENT_CIRCLES);
+        return 1;
+    }
 
     // solution 2
-    auto solution2Position = centroid - centroidToIntersection;
-    auto&& solution2 = Intersection(
-            a.offsetAt(solution2Position),
-            b.offsetAt(solution2Position),
-            solution2Position
-    );
-
-    return {std::move(solution1), std::move(solution2)};
+    out[1] = IntersectionT<Scalar>(0, 0, centroid - centroidToIntersection);
+
+    return 2;
 };
 
-AtMost<2, Intersection> intersect (Line& a, Circle& b) {
+template <typename Scalar>
+int writeIntersections (CircleT<Scalar>& a, CircleT<Scalar>& b, IntersectionT<Scalar>* out) {
+    int n = writeCrossings(a, b, out);
+    for (int k = 0; k < n; k++) {
+        out[k].alongA = a.offsetAt(out[k].position);
+        out[k].alongB = b.offsetAt(out[k].position);
+    }
+    return n;
+};
+
+template <typename Scalar>
+int writeCrossings (LineT<Scalar>& a, CircleT<Scalar>& b, IntersectionT<Scalar>* out) {
     // TODO: tolerance: make radius always thickness bigger
     // then check if two solutions are close enough together to be one
     // if (((solution1Position + solution2Position)/2 - b.center).norm() > radius - thickness) ...
+    instrument(LINE_CIRCLE_CALLS);
     auto delta = a.start - b.center;
     auto directionDotDelta = a.direction.dot(delta);
-    auto det = std::pow(directionDotDelta, 2.0) - (delta.squaredNorm() - std::pow(b.radius, 2.0));
+    using std::pow;
+    using std::sqrt;
+    auto det = pow(directionDotDelta, 2.0) - (delta.squaredNorm() - pow(b.radius, 2.0));
+
+    if (det < 0) {
+        instrument(LINE_MISSES_CIRCLE);
+        return 0;
+    }
+
+    auto t1 = (-directionDotDelta - sqrt(det));
+    out[0] = IntersectionT<Scalar>(t1, 0, a.start + t1 * a.direction);
+
+    if (det == 0) {
+        instrument(TANGENT_LINE);
+        return 1;
+    }
+
+    auto t2 = (-directionDotDelta + sqrt(det));
+    out[1] = IntersectionT<Scalar>(t2, 0, a.start + t2 * a.direction);
 
-    if (det < 0) return {};
+    return 2;
+};
 
-    auto t1 = (-directionDotDelta - std::sqrt(det));
-    auto solution1Position = a.start + t1 * a.direction;
-    auto&& solution1 = Intersection(
-            t1,
-            b.offsetAt(solution1Position),
-            solution1Position
-    );
+template <typename Scalar>
+int writeIntersections (LineT<Scalar>& a, CircleT<Scalar>& b, IntersectionT<Scalar>* out) {
+    int n = writeCrossings(a, b, out);
+    for (int k = 0; k < n; k++) out[k].alongB = b.offsetAt(out[k].position);
+    return n;
+};
 
-    if (det == 0) return {std::move(solution1)};
+template <int N, typename Scalar>
+AtMost<N, IntersectionT<Scalar>> collectIntersections (IntersectionT<Scalar>* written, int n) {
+    if (n == 2) return {written[0], written[1]};
+    else if (n == 1) return {written[0]};
+    else return {};
+}
+
+template <typename Scalar>
+AtMost<1, IntersectionT<Scalar>> intersect (LineT<Scalar> a, LineT<Scalar> b) {
+    IntersectionT<Scalar> written[2];
+    return collectIntersections<1>(written, writeIntersections(a, b, written));
+};
 
-    auto t2 = (-directionDotDelta + std::sqrt(det));
-    auto solution2Position = a.start + t2 * a.direction;
-    auto&& solution2 = Intersection(
-            t2,
-            b.offsetAt(solution2Position),
-            solution2Position
-    );
+template <typename Scalar>
+AtMost<2, IntersectionT<Scalar>> intersect (CircleT<Scalar>& a, CircleT<Scalar>& b) {
+    IntersectionT<Scalar> written[2];
+    return collectIntersections<2>(written, writeIntersections(a, b, written));
+};
 
-    return {std::move(solution1), std::move(solution2)};
+template <typename Scalar>
+AtMost<2, IntersectionT<Scalar>> intersect (LineT<Scalar>& a, CircleT<Scalar>& b) {
+    IntersectionT<Scalar> written[2];
+    return collectIntersections<2>(written, writeIntersections(a, b, written));
 };
 
-AtMost<2, Intersection> intersect (Circle& a, Line& b) {
-    return from(intersect(b, a)) >> map([](const Intersection& i) {return i.swapped();}) >> to<AtMost<2, Intersection>>();
+template <typename Scalar>
+AtMost<2, IntersectionT<Scalar>> intersect (CircleT<Scalar>& a, LineT<Scalar>& b) {
+    auto result = intersect(b, a);
+    swapAlongs(result);
+    return result;
 };
 
+// CONSTRAINTS
+// Each constraint clamps an intersection of the unconstrained primitive
+// onto the constrained one in place, or rejects it by returning false
+
+template <typename Scalar>
+bool constrainToRay (IntersectionT<Scalar>& i) {
+    // TODO: handle more exotic case where angles between a and b are pointy
+    // TODO: and the intersection point is far but the touch point close
+    if (!(i.alongA > -Tolerances<Scalar>::thickness()/2)) {
+        instrument(RAY_START_REJECTED);
+        return false;
+    }
+    if (i.alongA < 0) {
+        instrument(RAY_START_CLAMPED);
+        i.alongA = 0;
+    }
+    return true;
+}
+
+// expects an intersection that is already constrained to the ray along a
+template <typename Scalar>
+bool constrainToSegmentEnd (IntersectionT<Scalar>& i, SegmentT<Scalar>& a) {
+    if (!(i.alongA < a.length() + Tolerances<Scalar>::thickness()/2)) {
+        instrument(SEGMENT_END_REJECTED);
+        return false;
+    }
+    if (i.alongA > a.length()) {
+        instrument(SEGMENT_END_CLAMPED);
+        i.alongA = a.length();
+    }
+    return true;
+}
+
+// How far around the circle, in radians, offsetAt() may be off from the true angle. Its acos loses
+// about half the digits of float near 0 and pi, this stays well above that.
+const double ARC_ANGLE_MARGIN = 0.01;
+
+// Whether contains() is sure to reject point for arc a, decided without trig: point lies outside the
+// arc's angle by more than the margins of offsetAt() (by the signs of cross products with the end
+// vectors), so the distance to the closer end decides, and it is not within thickness of either end.
+template <typename Scalar>
+bool clearlyOffArc (Vec2<Scalar> point, SegmentT<Scalar>& a) {
+    const Scalar halfThickness = Tolerances<Scalar>::thickness()/2;
+    if (!((point - a.start).norm() >= halfThickness && (point - a.end).norm() >= halfThickness)) return false;
+
+    Scalar margin = Scalar(ARC_ANGLE_MARGIN) + Tolerances<Scalar>::thickness() / a.radius();
+    if (!(margin < 1)) return false;
+
+    Vec2<Scalar> fromCenter = point - a.radialCenter();
+    Scalar turn = a.signedRadius() >= 0 ? 1 : -1;
+    // sines of the angles from start to point and from point to end, in the arc's direction, scaled
+    Scalar pastStart = turn * cross<Scalar>(a.start - a.radialCenter(), fromCenter);
+    Scalar beforeEnd = turn * cross<Scalar>(fromCenter, a.end - a.radialCenter());
+    Scalar limit = -margin * a.radius() * fromCenter.norm();
+
+    // up to a half circle, points before start or past end are off the arc,
+    // beyond that only points that are both
+    if (a.angleSpan() <= M_PI) return pastStart < limit || beforeEnd < limit;
+    else return pastStart < limit && beforeEnd < limit;
+}
+
+// Keeps i if a.contains(i.position), computing the offset along the arc only once for both,
+// and not at all for points that are clearly off the arc
+template <typename Scalar>
+bool constrainToArc (IntersectionT<Scalar>& i, SegmentT<Scalar>& a) {
+    if (clearlyOffArc(i.position, a)) {
+        instrument(ARC_REJECTED);
+        return false;
+    }
+    Scalar along = a.offsetAt(i.position);
+    if (!a.contains(i.position, along)) {
+        instrument(ARC_REJECTED);
+        return false;
+    }
+    if (INSTRUMENTATION && (along < 0 || along > a.length())) instrument(ARC_END_CLAMPED);
+    i.alongA = std::min(std::max(along, Scalar(0)), a.length());
+    return true;
+}
+
+// Moves the accepted ones of at most two candidates into the result
+template <int N, typename Scalar>
+AtMost<2, IntersectionT<Scalar>> keepAccepted (AtMost<N, IntersectionT<Scalar>>& candidates,
+                                               bool firstAccepted, bool secondAccepted) {
+    if (firstAccepted && secondAccepted) return {std::move(candidates[0]), std::move(candidates[1])};
+    else if (firstAccepted) return {std::move(candidates[0])};
+    else if (secondAccepted) return {std::move(candidates[1])};
+    else return {};
+}
+
 // CONSTRAINED INTERSECTIONS
 
-template <typename OtherPrimitive, typename std::enable_if<
-        !std::is_same<OtherPrimitive, Segment>::value>::type* = nullptr>
-AtMost<2, Intersection> intersect (Ray& a, OtherPrimitive& b) {
-    return from(intersect(reinterpret_cast<Line&>(a), b)) >> (filter([](const Intersection& i) {
-        return i.alongA > -thickness/2;
-        // TODO: handle more exotic case where angles between a and b are pointy
-        // TODO: and the intersection point is far but the touch point close
-    }) | map([](const Intersection& i) -> Intersection {
-        if (i.alongA >= 0) return std::move(i);
-        else return Intersection(0, i.alongB, i.position);
-    })) >> to<AtMost<2, Intersection>>();
+template <typename Scalar, typename OtherPrimitive, typename std::enable_if<
+        !std::is_same<OtherPrimitive, SegmentT<Scalar>>::value>::type* = nullptr>
+AtMost<2, IntersectionT<Scalar>> intersect (RayT<Scalar>& a, OtherPrimitive& b) {
+    instrument(RAY_CALLS);
+    auto rayAsLine = LineT<Scalar>(a.start, a.direction);
+    auto candidates = intersect(rayAsLine, b);
+    int n = candidates.size();
+    return keepAccepted(candidates, n > 0 && constrainToRay(candidates[0]), n > 1 && constrainToRay(candidates[1]));
 };
 
-template <typename OtherPrimitive, typename std::enable_if<
-        !std::is_same<OtherPrimitive, Ray>::value && !std::is_same<OtherPrimitive, Segment>::value>::type* = nullptr>
-AtMost<2, Intersection> intersect (OtherPrimitive& a, Ray& b) {
-    return from(intersect(b, a)) >> map([](const Intersection& i) {return i.swapped();}) >> to<AtMost<2, Intersection>>();
+template <typename Scalar, typename OtherPrimitive, typename std::enable_if<
+        !std::is_same<OtherPrimitive, RayT<Scalar>>::value
+        && !std::is_same<OtherPrimitive, SegmentT<Scalar>>::value>::type* = nullptr>
+AtMost<2, IntersectionT<Scalar>> intersect (OtherPrimitive& a, RayT<Scalar>& b) {
+    auto result = intersect(b, a);
+    swapAlongs(result);
+    return result;
 };
 
-template <typename OtherPrimitive>
-AtMost<2, Intersection> intersect (Segment& a, OtherPrimitive& b) {
+template <typename Scalar, typename OtherPrimitive>
+AtMost<2, IntersectionT<Scalar>> intersect (SegmentT<Scalar>& a, OtherPrimitive& b) {
+    instrument(SEGMENT_CALLS);
     if (a.isStraight()) {
-        auto segmentAsRay = Ray(a.start, a.direction);
-        return from(intersect(segmentAsRay, b)) >> (filter([&](const Intersection& i) {
-            return i.alongA < a.length() + thickness/2;
-            // TODO: handle more exotic case where angles between a and b are pointy
-            // TODO: and the intersection point is far but the touch point close
-        }) | map([&](const Intersection& i) -> Intersection {
-            if (i.alongA <= a.length()) return std::move(i);
-            else return Intersection(a.length(), i.alongB, i.position);
-        })) >> to<AtMost<2, Intersection>>();
+        auto segmentAsRay = RayT<Scalar>(a.start, a.direction);
+        auto candidates = intersect(segmentAsRay, b);
+        int n = candidates.size();
+        return keepAccepted(candidates, n > 0 && constrainToSegmentEnd(candidates[0], a),
+                            n > 1 && constrainToSegmentEnd(candidates[1], a));
     } else {
-        auto segmentAsCircle = Circle(a.radialCenter(), a.radius());
-        return from(intersect(segmentAsCircle, b)) >> (filter([&](const Intersection& i) {
-            return a.contains(i.position);
-            // TODO: handle more exotic case where angles between a and b are pointy
-            // TODO: and the intersection point is far but the touch point close
-        }) | map([&](const Intersection& i) -> Intersection {
-            float alongA = a.offsetAt(i.position);
-            if (alongA < 0) return Intersection(0, i.alongB, i.position);
-            else if (alongA > a.length()) return Intersection(a.length(), i.alongB, i.position);
-            else return Intersection(alongA, i.alongB, i.position);
-        })) >> to<AtMost<2, Intersection>>();
+        // arcs against segments have their own kernel in intersectInto
+        auto segmentAsCircle = CircleT<Scalar>(a.radialCenter(), a.radius());
+        auto candidates = intersect(segmentAsCircle, b);
+        int n = candidates.size();
+        return keepAccepted(candidates, n > 0 && constrainToArc(candidates[0], a),
+                            n > 1 && constrainToArc(candidates[1], a));
     }
 };
 
-template <typename OtherPrimitive, typename std::enable_if<
-        !std::is_same<OtherPrimitive, Segment>::value>::type* = nullptr>
-AtMost<2, Intersection> intersect (OtherPrimitive& a, Segment& b) {
-    return from(intersect(b, a)) >> map([](const Intersection& i) {return i.swapped();}) >> to<AtMost<2, Intersection>>();
+template <typename Scalar, typename OtherPrimitive, typename std::enable_if<
+        !std::is_same<OtherPrimitive, SegmentT<Scalar>>::value>::type* = nullptr>
+AtMost<2, IntersectionT<Scalar>> intersect (OtherPrimitive& a, SegmentT<Scalar>& b) {
+    auto result = intersect(b, a);
+    swapAlongs(result);
+    return result;
+};
+
+// SINK INTERSECTIONS
+
+template <typename Scalar>
+bool constrainToSegment (IntersectionT<Scalar>& i, SegmentT<Scalar>& a) {
+    if (a.isStraight()) return constrainToRay(i) && constrainToSegmentEnd(i, a);
+    else return constrainToArc(i, a);
+}
+
+// Intersections of two segments passed to sink(IntersectionT<Scalar>&) one by one instead of going
+// through an AtMost at every step, for bulk queries that append them to their own buffers.
+// Arcs are solved as full circles without offsets, constrainToArc() computes the one offset each
+// accepted point needs on each arc. The order is the one of solving b against a.
+template <typename Scalar, typename Sink>
+void intersectInto (SegmentT<Scalar>& a, SegmentT<Scalar>& b, Sink&& sink) {
+    ScopedTiming timing(SEGMENT_SINK_CALLS);
+    IntersectionT<Scalar> candidates[2];
+    int n;
+    if (a.isStraight()) {
+        LineT<Scalar> lineA(a.start, a.direction);
+        if (b.isStraight()) {
+            n = writeIntersections(lineA, LineT<Scalar>(b.start, b.direction), candidates);
+        } else {
+            CircleT<Scalar> circleB(b.radialCenter(), b.radius());
+            n = writeCrossings(lineA, circleB, candidates);
+        }
+    } else {
+        CircleT<Scalar> circleA(a.radialCenter(), a.radius());
+        if (b.isStraight()) {
+            LineT<Scalar> lineB(b.start, b.direction);
+            n = writeCrossings(lineB, circleA, candidates);
+        } else {
+            CircleT<Scalar> circleB(b.radialCenter(), b.radius());
+            n = writeCrossings(circleB, circleA, candidates);
+        }
+        for (int k = 0; k < n; k++) std::swap(candidates[k].alongA, candidates[k].alongB);
+    }
+
+    for (int k = 0; k < n; k++) {
+        auto& i = candidates[k];
+        // a straight side rejects cheaper than an arc, try it first
+        if (a.isStraight() && !constrainToSegment(i, a)) continue;
+        std::swap(i.alongA, i.alongB);
+        bool onB = constrainToSegment(i, b);
+        std::swap(i.alongA, i.alongB);
+        if (!onB || (!a.isStraight() && !constrainToSegment(i, a))) continue;
+        sink(i);
+    }
+}
+
+template <typename Scalar>
+AtMost<2, IntersectionT<Scalar>> intersect (SegmentT<Scalar>& a, SegmentT<Scalar>& b) {
+    instrument(SEGMENT_CALLS);
+    IntersectionT<Scalar> written[2];
+    int n = 0;
+    intersectInto(a, b, [&](IntersectionT<Scalar>& i) { written[n++] = i; });
+    return collectIntersections<2>(written, n);
 };
 
 #endif //COMPASS_INTERSECTIONS_H
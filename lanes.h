@@ -0,0 +1,124 @@
+#ifndef COMPASS_LANES_H
+#define COMPASS_LANES_H
+
+// Thin wrappers around SSE/AVX float registers, so that batch kernels
+// can be written once and run 4 or 8 lanes at a time, depending on
+// what the compiler is allowed to emit. Without SSE this degrades to
+// a single scalar lane with the exact same semantics.
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX__)
+
+#include <immintrin.h>
+
+struct Lanes {
+    __m256 value;
+};
+const int LANE_COUNT = 8;
+
+inline Lanes lanesLoad (const float* source) {return {_mm256_loadu_ps(source)};}
+inline Lanes lanesLoadMask (const int32_t* source) {
+    return {_mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(source)))};
+}
+inline void lanesStore (float* target, Lanes lanes) {_mm256_storeu_ps(target, lanes.value);}
+inline Lanes lanesBroadcast (float value) {return {_mm256_set1_ps(value)};}
+
+inline Lanes operator+ (Lanes a, Lanes b) {return {_mm256_add_ps(a.value, b.value)};}
+inline Lanes operator- (Lanes a, Lanes b) {return {_mm256_sub_ps(a.value, b.value)};}
+inline Lanes operator* (Lanes a, Lanes b) {return {_mm256_mul_ps(a.value, b.value)};}
+inline Lanes operator/ (Lanes a, Lanes b) {return {_mm256_div_ps(a.value, b.value)};}
+inline Lanes lanesSqrt (Lanes a) {return {_mm256_sqrt_ps(a.value)};}
+inline Lanes lanesAbs (Lanes a) {return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.value)};}
+
+inline Lanes lanesLess (Lanes a, Lanes b) {return {_mm256_cmp_ps(a.value, b.value, _CMP_LT_OQ)};}
+inline Lanes lanesLessOrEqual (Lanes a, Lanes b) {return {_mm256_cmp_ps(a.value, b.value, _CMP_LE_OQ)};}
+inline Lanes lanesGreater (Lanes a, Lanes b) {return {_mm256_cmp_ps(a.value, b.value, _CMP_GT_OQ)};}
+// true for NaN, mirroring a negated scalar "<=" test
+inline Lanes lanesNotLessOrEqual (Lanes a, Lanes b) {return {_mm256_cmp_ps(a.value, b.value, _CMP_NLE_UQ)};}
+
+inline Lanes lanesAnd (Lanes a, Lanes b) {return {_mm256_and_ps(a.value, b.value)};}
+inline Lanes lanesOr (Lanes a, Lanes b) {return {_mm256_or_ps(a.value, b.value)};}
+inline Lanes lanesAndNot (Lanes mask, Lanes a) {return {_mm256_andnot_ps(mask.value, a.value)};}
+inline int lanesBits (Lanes mask) {return _mm256_movemask_ps(mask.value);}
+
+#elif defined(__SSE2__)
+
+#include <emmintrin.h>
+
+struct Lanes {
+    __m128 value;
+};
+const int LANE_COUNT = 4;
+
+inline Lanes lanesLoad (const float* source) {return {_mm_loadu_ps(source)};}
+inline Lanes lanesLoadMask (const int32_t* source) {
+    return {_mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(source)))};
+}
+inline void lanesStore (float* target, Lanes lanes) {_mm_storeu_ps(target, lanes.value);}
+inline Lanes lanesBroadcast (float value) {return {_mm_set1_ps(value)};}
+
+inline Lanes operator+ (Lanes a, Lanes b) {return {_mm_add_ps(a.value, b.value)};}
+inline Lanes operator- (Lanes a, Lanes b) {return {_mm_sub_ps(a.value, b.value)};}
+inline Lanes operator* (Lanes a, Lanes b) {return {_mm_mul_ps(a.value, b.value)};}
+inline Lanes operator/ (Lanes a, Lanes b) {return {_mm_div_ps(a.value, b.value)};}
+inline Lanes lanesSqrt (Lanes a) {return {_mm_sqrt_ps(a.value)};}
+inline Lanes lanesAbs (Lanes a) {return {_mm_andnot_ps(_mm_set1_ps(-0.0f), a.value)};}
+
+inline Lanes lanesLess (Lanes a, Lanes b) {return {_mm_cmplt_ps(a.value, b.value)};}
+inline Lanes lanesLessOrEqual (Lanes a, Lanes b) {return {_mm_cmple_ps(a.value, b.value)};}
+inline Lanes lanesGreater (Lanes a, Lanes b) {return {_mm_cmpgt_ps(a.value, b.value)};}
+// true for NaN, mirroring a negated scalar "<=" test
+inline Lanes lanesNotLessOrEqual (Lanes a, Lanes b) {return {_mm_cmpnle_ps(a.value, b.value)};}
+
+inline Lanes lanesAnd (Lanes a, Lanes b) {return {_mm_and_ps(a.value, b.value)};}
+inline Lanes lanesOr (Lanes a, Lanes b) {return {_mm_or_ps(a.value, b.value)};}
+inline Lanes lanesAndNot (Lanes mask, Lanes a) {return {_mm_andnot_ps(mask.value, a.value)};}
+inline int lanesBits (Lanes mask) {return _mm_movemask_ps(mask.value);}
+
+#else
+
+// single lane fallback, masks are floats carrying all-ones or all-zeros bits
+struct Lanes {
+    float value;
+};
+const int LANE_COUNT = 1;
+
+inline Lanes lanesFromBits (uint32_t bits) {Lanes lanes; std::memcpy(&lanes.value, &bits, 4); return lanes;}
+inline uint32_t lanesToBits (Lanes lanes) {uint32_t bits; std::memcpy(&bits, &lanes.value, 4); return bits;}
+inline Lanes lanesMask (bool condition) {return lanesFromBits(condition ? 0xFFFFFFFF : 0);}
+
+inline Lanes lanesLoad (const float* source) {return {*source};}
+inline Lanes lanesLoadMask (const int32_t* source) {return lanesFromBits(uint32_t(*source));}
+inline void lanesStore (float* target, Lanes lanes) {*target = lanes.value;}
+inline Lanes lanesBroadcast (float value) {return {value};}
+
+inline Lanes operator+ (Lanes a, Lanes b) {return {a.value + b.value};}
+inline Lanes operator- (Lanes a, Lanes b) {return {a.value - b.value};}
+inline Lanes operator* (Lanes a, Lanes b) {return {a.value * b.value};}
+inline Lanes operator/ (Lanes a, Lanes b) {return {a.value / b.value};}
+inline Lanes lanesSqrt (Lanes a) {return {std::sqrt(a.value)};}
+inline Lanes lanesAbs (Lanes a) {return {std::abs(a.value)};}
+
+inline Lanes lanesLess (Lanes a, Lanes b) {return lanesMask(a.value < b.value);}
+inline Lanes lanesLessOrEqual (Lanes a, Lanes b) {return lanesMask(a.value <= b.value);}
+inline Lanes lanesGreater (Lanes a, Lanes b) {return lanesMask(a.value > b.value);}
+inline Lanes lanesNotLessOrEqual (Lanes a, Lanes b) {return lanesMask(!(a.value <= b.value));}
+
+inline Lanes lanesAnd (Lanes a, Lanes b) {return lanesFromBits(lanesToBits(a) & lanesToBits(b));}
+inline Lanes lanesOr (Lanes a, Lanes b) {return lanesFromBits(lanesToBits(a) | lanesToBits(b));}
+inline Lanes lanesAndNot (Lanes mask, Lanes a) {return lanesFromBits(~lanesToBits(mask) & lanesToBits(a));}
+inline int lanesBits (Lanes mask) {return lanesToBits(mask) >> 31;}
+
+#endif
+
+// built from the ones above, for every lane count
+
+// a where mask is set, b elsewhere
+inline Lanes lanesSelect (Lanes mask, Lanes a, Lanes b) {return lanesOr(lanesAnd(mask, a), lanesAndNot(mask, b));}
+inline Lanes lanesMin (Lanes a, Lanes b) {return lanesSelect(lanesLess(a, b), a, b);}
+inline Lanes lanesMax (Lanes a, Lanes b) {return lanesSelect(lanesGreater(a, b), a, b);}
+
+#endif //COMPASS_LANES_H
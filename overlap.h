@@ -0,0 +1,200 @@
+#ifndef COMPASS_OVERLAP_H
+#define COMPASS_OVERLAP_H
+
+#include <vector>
+#include <algorithm>
+#include "primitives.h"
+#include "intersections.h"
+#include "bounding-box.h"
+#include "predicates.h"
+#include "path.h"
+
+// Yes/no overlap tests between closed paths, for collision checks like placing a building
+// among existing ones. Shapes overlap if their areas share a point, so touching counts.
+// Nothing is computed beyond what's needed for the answer, no Intersection is ever kept.
+
+// Bounds of all segments of a path
+BoundingBox boundsOf (Path& path) {
+    if (path.segments.empty()) return BoundingBox();
+    BoundingBox box = boundsOf(path.segments[0]);
+    for (int i = 1; i < path.segments.size(); i++) box.include(boundsOf(path.segments[i]));
+    return box;
+}
+
+// CONVEX_POLYGONS turn only one way (straight continuations are fine) and go around once
+enum ShapeKind {CONVEX_POLYGON, POLYGON, CURVED};
+
+ShapeKind shapeKind (Path& path) {
+    int n = path.segments.size();
+    bool leftTurns = false, rightTurns = false;
+    int xFlips = 0;
+    for (int i = 0; i < n; i++) {
+        Segment& segment = path.segments[i];
+        if (!segment.isStraight()) return CURVED;
+        Segment& next = path.segments[(i + 1) % n];
+        double turn = orientation(segment.start, segment.end, next.end);
+        leftTurns |= turn > 0;
+        rightTurns |= turn < 0;
+        // a convex polygon changes between going left and going right exactly twice
+        if ((segment.end[0] - segment.start[0]) * (next.end[0] - next.start[0]) < 0) xFlips++;
+    }
+    return (leftTurns && rightTurns) || xFlips > 2 ? POLYGON : CONVEX_POLYGON;
+}
+
+// Whether all corners of polygon b lie strictly outside of one edge of the convex polygon a.
+// Edges of b are chords between its corners, so b then lies outside of a entirely.
+bool separatedByEdgeOf (Path& a, Path& b) {
+    bool counterClockwise = !a.isClockwise();
+    for (auto& edge : a.segments) {
+        bool allOutside = true;
+        for (auto& other : b.segments) {
+            double side = orientation(edge.start, edge.end, other.start);
+            if (counterClockwise ? side >= 0 : side <= 0) {
+                allOutside = false;
+                break;
+            }
+        }
+        if (allOutside) return true;
+    }
+    return false;
+}
+
+// Whether two segments share a point. Lines are decided exactly with orientations,
+// everything with an arc by whether intersectInto finds anything.
+bool touches (Segment& a, Segment& b) {
+    if (a.isStraight() && b.isStraight()) {
+        double bStart = orientation(a.start, a.end, b.start), bEnd = orientation(a.start, a.end, b.end);
+        if ((bStart > 0 && bEnd > 0) || (bStart < 0 && bEnd < 0)) return false;
+        double aStart = orientation(b.start, b.end, a.start), aEnd = orientation(b.start, b.end, a.end);
+        if ((aStart > 0 && aEnd > 0) || (aStart < 0 && aEnd < 0)) return false;
+        if (bStart != 0 || bEnd != 0) return true;
+
+        // collinear: their projections onto a have to overlap
+        vec2 along = a.end - a.start;
+        float bFrom = (b.start - a.start).dot(along), bTo = (b.end - a.start).dot(along);
+        return std::max(bFrom, bTo) >= 0 && std::min(bFrom, bTo) <= along.squaredNorm();
+    }
+
+    bool found = false;
+    intersectInto(a, b, [&](IntersectionT<float>&) { found = true; });
+    return found;
+}
+
+// Answers overlap tests with bounds rejection first, then separating edges if both shapes
+// are polygons and one is convex (which decides it if both are convex), then a sweep over
+// the edges in the common bounds that stops at the first touching pair. Without touching
+// edges, shapes only overlap if one lies inside the other.
+// The sweep lists only grow, so a tester that lives as long as the shapes answers overlapping()
+// and firstOverlapping() for any number of candidates without allocating.
+class OverlapTester {
+    struct SweepEdge {
+        BoundingBox bounds;
+        Segment* segment;
+        bool ofA;
+    };
+
+    std::vector<SweepEdge> sweep;
+    std::vector<SweepEdge*> activeA;
+    std::vector<SweepEdge*> activeB;
+
+public:
+    bool overlaps (Path& a, Path& b) {
+        return overlaps(a, boundsOf(a), shapeKind(a), b, boundsOf(b), shapeKind(b));
+    }
+
+    // With bounds and kinds known already, for shapes that are tested again and again
+    bool overlaps (Path& a, const BoundingBox& aBounds, ShapeKind aKind,
+                   Path& b, const BoundingBox& bBounds, ShapeKind bKind) {
+        if (a.segments.empty() || b.segments.empty() || !aBounds.overlaps(bBounds)) return false;
+
+        if (aKind != CURVED && bKind != CURVED) {
+            if (aKind == CONVEX_POLYGON && separatedByEdgeOf(a, b)) return false;
+            if (bKind == CONVEX_POLYGON && separatedByEdgeOf(b, a)) return false;
+            if (aKind == CONVEX_POLYGON && bKind == CONVEX_POLYGON) return true;
+        }
+
+        BoundingBox common(aBounds.min.cwiseMax(bBounds.min), aBounds.max.cwiseMin(bBounds.max));
+        if (edgesTouch(a, b, common)) return true;
+        return (bBounds.contains(a.segments[0].start) && b.contains(a.segments[0].start))
+            || (aBounds.contains(b.segments[0].start) && a.contains(b.segments[0].start));
+    }
+
+    // BATCHED
+
+    // Indices of all shapes that candidate overlaps, in order, written to out. shapeBounds and shapeKinds
+    // belong to shapes (see prepareShapes), so they are computed only once for shapes that stay.
+    // Returns how many there are.
+    int overlapping (Path& candidate, std::vector<Path>& shapes, std::vector<BoundingBox>& shapeBounds,
+                     std::vector<ShapeKind>& shapeKinds, std::vector<int>& out) {
+        out.clear();
+        BoundingBox candidateBounds = boundsOf(candidate);
+        ShapeKind candidateKind = shapeKind(candidate);
+        for (int i = 0; i < shapes.size(); i++) {
+            if (overlaps(candidate, candidateBounds, candidateKind, shapes[i], shapeBounds[i], shapeKinds[i])) {
+                out.push_back(i);
+            }
+        }
+        return out.size();
+    }
+
+    // The index of the first shape that candidate overlaps, -1 if it is free, stopping at the first one
+    int firstOverlapping (Path& candidate, std::vector<Path>& shapes, std::vector<BoundingBox>& shapeBounds,
+                          std::vector<ShapeKind>& shapeKinds) {
+        BoundingBox candidateBounds = boundsOf(candidate);
+        ShapeKind candidateKind = shapeKind(candidate);
+        for (int i = 0; i < shapes.size(); i++) {
+            if (overlaps(candidate, candidateBounds, candidateKind, shapes[i], shapeBounds[i], shapeKinds[i])) return i;
+        }
+        return -1;
+    }
+
+private:
+    // Sweeps edges of both shapes that reach into common from left to right by their bounds,
+    // each one is checked against the edges of the other shape still overlapping it in x
+    bool edgesTouch (Path& a, Path& b, const BoundingBox& common) {
+        sweep.clear();
+        for (bool ofA : {true, false}) {
+            for (auto& segment : (ofA ? a : b).segments) {
+                BoundingBox bounds = boundsOf(segment);
+                if (bounds.overlaps(common)) sweep.push_back({bounds, &segment, ofA});
+            }
+        }
+        std::sort(sweep.begin(), sweep.end(), [](const SweepEdge& e1, const SweepEdge& e2) {
+            return e1.bounds.min[0] < e2.bounds.min[0];
+        });
+
+        activeA.clear();
+        activeB.clear();
+        for (auto& edge : sweep) {
+            auto& others = edge.ofA ? activeB : activeA;
+            for (int o = 0; o < others.size();) {
+                // unordered, removed by swapping in the last one
+                if (others[o]->bounds.max[0] < edge.bounds.min[0]) {
+                    others[o] = others.back();
+                    others.pop_back();
+                    continue;
+                }
+                if (others[o]->bounds.overlaps(edge.bounds) && touches(*edge.segment, *others[o]->segment)) return true;
+                o++;
+            }
+            (edge.ofA ? activeA : activeB).push_back(&edge);
+        }
+        return false;
+    }
+};
+
+bool overlaps (Path& a, Path& b) {
+    return OverlapTester().overlaps(a, b);
+}
+
+// Bounds and kinds of shapes for the batched tests of OverlapTester
+void prepareShapes (std::vector<Path>& shapes, std::vector<BoundingBox>& bounds, std::vector<ShapeKind>& kinds) {
+    bounds.clear();
+    kinds.clear();
+    for (auto& shape : shapes) {
+        bounds.push_back(boundsOf(shape));
+        kinds.push_back(shapeKind(shape));
+    }
+}
+
+#endif //COMPASS_OVERLAP_H
@@ -0,0 +1,280 @@
+/*
+
+    Adaptive precision geometric predicates, after:
+
+ Adaptive Precision Floating-Point Arithmetic and Fast Robust Geometric Predicates
+ =================================================================================
+
+                          by Jonathan Richard Shewchuk
+
+ Each predicate first evaluates its determinant in plain double arithmetic and
+ compares it against an error bound. Only if the result is too close to zero for
+ its sign to be trusted, it is evaluated again exactly, as a sum of non-overlapping
+ doubles (an "expansion"). Shewchuk's intermediate adaptive stages are left out:
+ escalations are rare enough that going straight to the exact stage is cheaper to maintain.
+
+ Float inputs are exact in double, so these work for both scalar types.
+ Needs IEEE double arithmetic with round-to-nearest, so no -ffast-math.
+
+ */
+
+#ifndef COMPASS_PREDICATES_H
+#define COMPASS_PREDICATES_H
+
+#include <cmath>
+#include "angles.h"
+#include "instrumentation.h"
+
+// EXPANSION ARITHMETIC
+
+const double PREDICATE_EPSILON = 1.1102230246251565e-16; // 2^-53
+const double PREDICATE_SPLITTER = 134217729.0; // 2^27 + 1
+const double ORIENTATION_ERROR_BOUND = (3.0 + 16.0 * PREDICATE_EPSILON) * PREDICATE_EPSILON;
+const double IN_CIRCLE_ERROR_BOUND = (10.0 + 96.0 * PREDICATE_EPSILON) * PREDICATE_EPSILON;
+
+// x + y == a + b exactly, with x the rounded sum
+void twoSum (double a, double b, double& x, double& y) {
+    x = a + b;
+    double bVirtual = x - a;
+    double aVirtual = x - bVirtual;
+    y = (a - aVirtual) + (b - bVirtual);
+}
+
+// hi + lo == a, each with at most 26 significant bits
+void split (double a, double& hi, double& lo) {
+    double c = PREDICATE_SPLITTER * a;
+    double aBig = c - a;
+    hi = c - aBig;
+    lo = a - hi;
+}
+
+// x + y == a * b exactly, with x the rounded product
+void twoProduct (double a, double b, double& x, double& y) {
+    x = a * b;
+    double aHi, aLo, bHi, bLo;
+    split(a, aHi, aLo);
+    split(b, bHi, bLo);
+    double error1 = x - aHi * bHi;
+    double error2 = error1 - aLo * bHi;
+    double error3 = error2 - aHi * bLo;
+    y = aLo * bLo - error3;
+}
+
+// h = e + f, Shewchuk's fast_expansion_sum_zeroelim, returns the length of h
+int expansionSum (int eLength, const double* e, int fLength, const double* f, double* h) {
+    if (eLength == 0 || fLength == 0) {
+        for (int i = 0; i < eLength; i++) h[i] = e[i];
+        for (int i = 0; i < fLength; i++) h[i] = f[i];
+        return eLength + fLength;
+    }
+
+    int eIndex = 0, fIndex = 0, hLength = 0;
+    double q, next, sum, error;
+    if ((f[0] > e[0]) == (f[0] > -e[0])) q = e[eIndex++];
+    else q = f[fIndex++];
+
+    if (eIndex < eLength && fIndex < fLength) {
+        if ((f[fIndex] > e[eIndex]) == (f[fIndex] > -e[eIndex])) next = e[eIndex++];
+        else next = f[fIndex++];
+        // fast two sum, valid since |q| <= |next|
+        sum = next + q;
+        error = q - (sum - next);
+        q = sum;
+        if (error != 0) h[hLength++] = error;
+
+        while (eIndex < eLength && fIndex < fLength) {
+            if ((f[fIndex] > e[eIndex]) == (f[fIndex] > -e[eIndex])) next = e[eIndex++];
+            else next = f[fIndex++];
+            twoSum(q, next, sum, error);
+            q = sum;
+            if (error != 0) h[hLength++] = error;
+        }
+    }
+    while (eIndex < eLength) {
+        twoSum(q, e[eIndex++], sum, error);
+        q = sum;
+        if (error != 0) h[hLength++] = error;
+    }
+    while (fIndex < fLength) {
+        twoSum(q, f[fIndex++], sum, error);
+        q = sum;
+        if (error != 0) h[hLength++] = error;
+    }
+    if (q != 0 || hLength == 0) h[hLength++] = q;
+    return hLength;
+}
+
+// h = e * b, Shewchuk's scale_expansion_zeroelim, returns the length of h
+int expansionScale (int eLength, const double* e, double b, double* h) {
+    int hLength = 0;
+    double q, product, productError, sum, error;
+    twoProduct(e[0], b, q, error);
+    if (error != 0) h[hLength++] = error;
+    for (int i = 1; i < eLength; i++) {
+        twoProduct(e[i], b, product, productError);
+        twoSum(q, productError, sum, error);
+        if (error != 0) h[hLength++] = error;
+        // fast two sum, the product dominates
+        q = product + sum;
+        error = sum - (q - product);
+        if (error != 0) h[hLength++] = error;
+    }
+    if (q != 0 || hLength == 0) h[hLength++] = q;
+    return hLength;
+}
+
+// An exact sum of non-overlapping doubles, ordered by increasing magnitude.
+// The capacities follow from the operations, so the exact stage never allocates.
+template <int Capacity>
+struct Expansion {
+    int length;
+    double components[Capacity];
+
+    Expansion () : length(0) {};
+
+    // the largest component carries the sign and is within an ulp of the exact value
+    double estimate () const {
+        return length ? components[length - 1] : 0;
+    }
+
+    Expansion negated () const {
+        Expansion negated;
+        negated.length = length;
+        for (int i = 0; i < length; i++) negated.components[i] = -components[i];
+        return negated;
+    }
+};
+
+// exactly a - b
+Expansion<2> expansionDifference (double a, double b) {
+    Expansion<2> difference;
+    double x, y;
+    twoSum(a, -b, x, y);
+    if (y != 0) difference.components[difference.length++] = y;
+    difference.components[difference.length++] = x;
+    return difference;
+}
+
+template <int A, int B>
+Expansion<A + B> operator+ (const Expansion<A>& e, const Expansion<B>& f) {
+    Expansion<A + B> h;
+    h.length = expansionSum(e.length, e.components, f.length, f.components, h.components);
+    return h;
+}
+
+template <int A, int B>
+Expansion<2 * A * B> operator* (const Expansion<A>& e, const Expansion<B>& f) {
+    Expansion<2 * A * B> h, accumulated;
+    double scaled[2 * A];
+    for (int i = 0; i < f.length; i++) {
+        int scaledLength = expansionScale(e.length, e.components, f.components[i], scaled);
+        accumulated = h;
+        h.length = expansionSum(accumulated.length, accumulated.components, scaledLength, scaled, h.components);
+    }
+    return h;
+}
+
+// PREDICATES
+
+Expansion<16> orientationExpansion (vec2d a, vec2d b, vec2d c) {
+    auto acx = expansionDifference(a[0], c[0]);
+    auto acy = expansionDifference(a[1], c[1]);
+    auto bcx = expansionDifference(b[0], c[0]);
+    auto bcy = expansionDifference(b[1], c[1]);
+    return acx * bcy + (acy * bcx).negated();
+}
+
+double orientationExact (vec2d a, vec2d b, vec2d c) {
+    return orientationExpansion(a, b, c).estimate();
+}
+
+// Twice the signed area of the triangle a, b, c: positive if c lies to the left of a -> b,
+// negative if it lies to the right, exactly zero only if the three points are exactly collinear.
+// The sign is always exact, the magnitude only where it comes from the exact stage. Otherwise
+// it's the plain double determinant: a few ulps off for float inputs, whose products are exact
+// in double, but for double inputs up to about a third off just above the error bound.
+// Compare it against a tolerance with orientationWithin().
+template <typename Scalar>
+double orientation (Vec2<Scalar> a, Vec2<Scalar> b, Vec2<Scalar> c) {
+    instrument(ORIENTATION_CALLS);
+
+    double detLeft = (double(a[0]) - c[0]) * (double(b[1]) - c[1]);
+    double detRight = (double(a[1]) - c[1]) * (double(b[0]) - c[0]);
+    double det = detLeft - detRight;
+
+    // with opposite signs, the subtraction can't cancel
+    if ((detLeft > 0) != (detRight > 0) || detLeft == 0 || detRight == 0) return det;
+
+    double bound = ORIENTATION_ERROR_BOUND * (std::abs(detLeft) + std::abs(detRight));
+    if (std::abs(det) >= bound) return det;
+
+    instrument(ORIENTATION_ESCALATIONS);
+    return orientationExact(a.template cast<double>(), b.template cast<double>(), c.template cast<double>());
+}
+
+// Whether |orientation(a, b, c)| <= tolerance, decided exactly for float and double inputs alike.
+// The plain double determinant only decides if it's further from the tolerance than its error bound.
+template <typename Scalar>
+bool orientationWithin (Vec2<Scalar> a, Vec2<Scalar> b, Vec2<Scalar> c, double tolerance) {
+    instrument(ORIENTATION_CALLS);
+
+    double detLeft = (double(a[0]) - c[0]) * (double(b[1]) - c[1]);
+    double detRight = (double(a[1]) - c[1]) * (double(b[0]) - c[0]);
+    double det = std::abs(detLeft - detRight);
+
+    // widened by a few ulps, the sums and products of the comparison round too
+    double bound = ORIENTATION_ERROR_BOUND * (std::abs(detLeft) + std::abs(detRight));
+    if (det > (tolerance + bound) * (1 + 4 * PREDICATE_EPSILON)) return false;
+    if (det < (tolerance - bound) * (1 - 4 * PREDICATE_EPSILON)) return true;
+
+    instrument(ORIENTATION_ESCALATIONS);
+    auto exact = orientationExpansion(a.template cast<double>(), b.template cast<double>(), c.template cast<double>());
+    Expansion<1> limit;
+    limit.components[limit.length++] = tolerance;
+    return (exact + limit.negated()).estimate() <= 0 && (exact + limit).estimate() >= 0;
+}
+
+double inCircleExact (vec2d a, vec2d b, vec2d c, vec2d d) {
+    auto adx = expansionDifference(a[0], d[0]), ady = expansionDifference(a[1], d[1]);
+    auto bdx = expansionDifference(b[0], d[0]), bdy = expansionDifference(b[1], d[1]);
+    auto cdx = expansionDifference(c[0], d[0]), cdy = expansionDifference(c[1], d[1]);
+
+    auto aLift = adx * adx + ady * ady;
+    auto bLift = bdx * bdx + bdy * bdy;
+    auto cLift = cdx * cdx + cdy * cdy;
+    auto bcCross = bdx * cdy + (bdy * cdx).negated();
+    auto caCross = cdx * ady + (cdy * adx).negated();
+    auto abCross = adx * bdy + (ady * bdx).negated();
+
+    return (aLift * bcCross + bLift * caCross + cLift * abCross).estimate();
+}
+
+// Positive if d lies inside the circle through a, b and c (given counter-clockwise),
+// negative if outside, exactly zero only if the four points are exactly cocircular
+template <typename Scalar>
+double inCircle (Vec2<Scalar> a, Vec2<Scalar> b, Vec2<Scalar> c, Vec2<Scalar> d) {
+    instrument(IN_CIRCLE_CALLS);
+
+    double adx = double(a[0]) - d[0], ady = double(a[1]) - d[1];
+    double bdx = double(b[0]) - d[0], bdy = double(b[1]) - d[1];
+    double cdx = double(c[0]) - d[0], cdy = double(c[1]) - d[1];
+
+    double bdxcdy = bdx * cdy, cdxbdy = cdx * bdy;
+    double cdxady = cdx * ady, adxcdy = adx * cdy;
+    double adxbdy = adx * bdy, bdxady = bdx * ady;
+    double aLift = adx * adx + ady * ady;
+    double bLift = bdx * bdx + bdy * bdy;
+    double cLift = cdx * cdx + cdy * cdy;
+
+    double det = aLift * (bdxcdy - cdxbdy) + bLift * (cdxady - adxcdy) + cLift * (adxbdy - bdxady);
+    double permanent = (std::abs(bdxcdy) + std::abs(cdxbdy)) * aLift
+                       + (std::abs(cdxady) + std::abs(adxcdy)) * bLift
+                       + (std::abs(adxbdy) + std::abs(bdxady)) * cLift;
+    if (std::abs(det) > IN_CIRCLE_ERROR_BOUND * permanent) return det;
+
+    instrument(IN_CIRCLE_ESCALATIONS);
+    return inCircleExact(a.template cast<double>(), b.template cast<double>(),
+                         c.template cast<double>(), d.template cast<double>());
+}
+
+#endif //COMPASS_PREDICATES_H
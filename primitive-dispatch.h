@@ -0,0 +1,144 @@
+#ifndef COMPASS_PRIMITIVE_DISPATCH_H
+#define COMPASS_PRIMITIVE_DISPATCH_H
+
+#include <vector>
+#include <utility>
+#include <new>
+#include "primitives.h"
+#include "intersections.h"
+#include "segment-batch.h"
+
+enum PrimitiveKind {LINE, RAY, CIRCLE, SEGMENT};
+const int PRIMITIVE_KIND_COUNT = 4;
+
+// Any one of the primitives, stored inline and tagged by kind, for mixed collections
+class Primitive {
+public:
+    PrimitiveKind kind;
+    union {
+        Line line;
+        Ray ray;
+        Circle circle;
+        Segment segment;
+    };
+
+    Primitive (Line line) : kind(LINE), line(line) {};
+    Primitive (Ray ray) : kind(RAY), ray(ray) {};
+    Primitive (Circle circle) : kind(CIRCLE), circle(circle) {};
+    Primitive (Segment segment) : kind(SEGMENT), segment(segment) {};
+
+    Primitive (const Primitive& other) : kind(other.kind) {
+        switch (kind) {
+            case LINE: new (&line) Line(other.line); break;
+            case RAY: new (&ray) Ray(other.ray); break;
+            case CIRCLE: new (&circle) Circle(other.circle); break;
+            case SEGMENT: new (&segment) Segment(other.segment); break;
+        }
+    }
+
+    // all primitives are trivially destructible
+    ~Primitive () {};
+};
+
+// Maps a kind to its primitive type and how to get it out of a Primitive
+template <PrimitiveKind Kind> struct PrimitiveOfKind;
+
+template <> struct PrimitiveOfKind<LINE> {
+    static Line& of (Primitive& primitive) { return primitive.line; }
+};
+
+template <> struct PrimitiveOfKind<RAY> {
+    static Ray& of (Primitive& primitive) { return primitive.ray; }
+};
+
+template <> struct PrimitiveOfKind<CIRCLE> {
+    static Circle& of (Primitive& primitive) { return primitive.circle; }
+};
+
+template <> struct PrimitiveOfKind<SEGMENT> {
+    static Segment& of (Primitive& primitive) { return primitive.segment; }
+};
+
+AtMost<2, Intersection> atMostTwo (AtMost<1, Intersection>&& intersections) {
+    if (intersections.size() == 1) return {std::move(intersections[0])};
+    else return {};
+}
+
+AtMost<2, Intersection> atMostTwo (AtMost<2, Intersection>&& intersections) {
+    return std::move(intersections);
+}
+
+template <PrimitiveKind KindA, PrimitiveKind KindB>
+AtMost<2, Intersection> intersectAs (Primitive& a, Primitive& b) {
+    return atMostTwo(intersect(PrimitiveOfKind<KindA>::of(a), PrimitiveOfKind<KindB>::of(b)));
+}
+
+typedef AtMost<2, Intersection> (*PrimitiveIntersector) (Primitive& a, Primitive& b);
+
+// intersectAs instantiated for every pair of kinds, indexed by [a.kind][b.kind]
+constexpr PrimitiveIntersector primitiveIntersectors[PRIMITIVE_KIND_COUNT][PRIMITIVE_KIND_COUNT] = {
+        {&intersectAs<LINE, LINE>, &intersectAs<LINE, RAY>, &intersectAs<LINE, CIRCLE>, &intersectAs<LINE, SEGMENT>},
+        {&intersectAs<RAY, LINE>, &intersectAs<RAY, RAY>, &intersectAs<RAY, CIRCLE>, &intersectAs<RAY, SEGMENT>},
+        {&intersectAs<CIRCLE, LINE>, &intersectAs<CIRCLE, RAY>, &intersectAs<CIRCLE, CIRCLE>, &intersectAs<CIRCLE, SEGMENT>},
+        {&intersectAs<SEGMENT, LINE>, &intersectAs<SEGMENT, RAY>, &intersectAs<SEGMENT, CIRCLE>, &intersectAs<SEGMENT, SEGMENT>}
+};
+
+AtMost<2, Intersection> intersect (Primitive& a, Primitive& b) {
+    return primitiveIntersectors[a.kind][b.kind](a, b);
+}
+
+// BATCHED DISPATCH
+
+typedef std::pair<int, int> PrimitivePair;
+
+// Intersects a run of pairs that all have the same kinds, without any per pair dispatch
+template <PrimitiveKind KindA, PrimitiveKind KindB>
+void intersectRunAs (std::vector<Primitive>& primitives, const PrimitivePair* pairs, int n,
+                     std::vector<BatchIntersection>& out) {
+    for (int p = 0; p < n; p++) {
+        auto& a = PrimitiveOfKind<KindA>::of(primitives[pairs[p].first]);
+        auto& b = PrimitiveOfKind<KindB>::of(primitives[pairs[p].second]);
+        for (auto& i : intersect(a, b)) {
+            out.push_back({pairs[p].first, pairs[p].second, i.alongA, i.alongB, i.position});
+        }
+    }
+}
+
+typedef void (*PrimitiveRunIntersector) (std::vector<Primitive>& primitives, const PrimitivePair* pairs, int n,
+                                         std::vector<BatchIntersection>& out);
+
+constexpr PrimitiveRunIntersector primitiveRunIntersectors[PRIMITIVE_KIND_COUNT][PRIMITIVE_KIND_COUNT] = {
+        {&intersectRunAs<LINE, LINE>, &intersectRunAs<LINE, RAY>, &intersectRunAs<LINE, CIRCLE>, &intersectRunAs<LINE, SEGMENT>},
+        {&intersectRunAs<RAY, LINE>, &intersectRunAs<RAY, RAY>, &intersectRunAs<RAY, CIRCLE>, &intersectRunAs<RAY, SEGMENT>},
+        {&intersectRunAs<CIRCLE, LINE>, &intersectRunAs<CIRCLE, RAY>, &intersectRunAs<CIRCLE, CIRCLE>, &intersectRunAs<CIRCLE, SEGMENT>},
+        {&intersectRunAs<SEGMENT, LINE>, &intersectRunAs<SEGMENT, RAY>, &intersectRunAs<SEGMENT, CIRCLE>, &intersectRunAs<SEGMENT, SEGMENT>}
+};
+
+// Intersects the given pairs of primitives, after sorting them by their kinds (a counting sort,
+// stable within each pair type), so each run of pairs goes through one specialized kernel.
+// Results are grouped by pair type, ordered as the pairs were given within each group.
+void intersectPairs (std::vector<Primitive>& primitives, std::vector<PrimitivePair>& pairs,
+                     std::vector<BatchIntersection>& out) {
+    const int pairTypeCount = PRIMITIVE_KIND_COUNT * PRIMITIVE_KIND_COUNT;
+    auto pairType = [&](const PrimitivePair& pair) {
+        return primitives[pair.first].kind * PRIMITIVE_KIND_COUNT + primitives[pair.second].kind;
+    };
+
+    int runStarts[pairTypeCount + 1] = {};
+    for (auto& pair : pairs) runStarts[pairType(pair) + 1]++;
+    for (int type = 0; type < pairTypeCount; type++) runStarts[type + 1] += runStarts[type];
+
+    std::vector<PrimitivePair> sorted(pairs.size());
+    int runEnds[pairTypeCount];
+    for (int type = 0; type < pairTypeCount; type++) runEnds[type] = runStarts[type];
+    for (auto& pair : pairs) sorted[runEnds[pairType(pair)]++] = pair;
+
+    for (int type = 0; type < pairTypeCount; type++) {
+        int n = runStarts[type + 1] - runStarts[type];
+        if (n == 0) continue;
+        primitiveRunIntersectors[type / PRIMITIVE_KIND_COUNT][type % PRIMITIVE_KIND_COUNT](
+                primitives, sorted.data() + runStarts[type], n, out);
+    }
+}
+
+#endif //COMPASS_PRIMITIVE_DISPATCH_H
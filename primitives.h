@@ -7,65 +7,109 @@
 #include <Eigen/Dense>
 #include "at-most.h"
 #include "angles.h"
+#include "instrumentation.h"
 
 typedef Eigen::Vector2f vec2;
 
 const float thickness = 0.0001;
 
-class Circle {
+// Tolerances per scalar type. For float, thickness is about a thousand ulps of unit sized
+// coordinates, for double it is about a thousand ulps of coordinates in the 10 km range.
+// rough() is a relative tolerance, for comparing normalized quantities like determinants.
+template <typename Scalar> struct Tolerances;
+
+template <> struct Tolerances<float> {
+    static constexpr float thickness () { return 0.0001f; }
+    static constexpr float rough () { return 0.0000001f; }
+};
+
+template <> struct Tolerances<double> {
+    static constexpr double thickness () { return 0.00000001; }
+    static constexpr double rough () { return 0.000000000000001; }
+};
+
+template <typename Scalar>
+class CircleT {
 public:
-    vec2 center;
-    float radius;
+    Vec2<Scalar> center;
+    Scalar radius;
 
-    Circle (vec2 center, float radius) : center(center), radius(radius) {};
+    CircleT (Vec2<Scalar> center, Scalar radius) : center(center), radius(radius) {};
 
-    bool contains(vec2 point) {
-        return (center - point).norm() <= radius + thickness/2;
+    bool contains(Vec2<Scalar> point) {
+        return (center - point).norm() <= radius + Tolerances<Scalar>::thickness()/2;
     }
 
-    float offsetAt(vec2 point) {
-        return angleBetweenWithDirection({1, 0}, {0, 1}, point - center) * radius;
+    Scalar offsetAt(Vec2<Scalar> point) {
+        return angleBetweenWithDirection<Scalar>(Vec2<Scalar>(1, 0), Vec2<Scalar>(0, 1), point - center) * radius;
+    }
+
+    template <typename OtherScalar>
+    CircleT<OtherScalar> cast () {
+        return CircleT<OtherScalar>(center.template cast<OtherScalar>(), OtherScalar(radius));
     }
 };
 
-class Line {
+template <typename Scalar>
+class LineT {
 public:
-    vec2 start;
-    vec2 direction;
+    Vec2<Scalar> start;
+    Vec2<Scalar> direction;
+
+    LineT (Vec2<Scalar> start, Vec2<Scalar> direction) : start(start), direction(direction) {};
 
-    Line (vec2 start, vec2 direction) : start(start), direction(direction) {};
+    template <typename OtherScalar>
+    LineT<OtherScalar> cast () {
+        return LineT<OtherScalar>(start.template cast<OtherScalar>(), direction.template cast<OtherScalar>());
+    }
 };
 
-class Ray {
+template <typename Scalar>
+class RayT {
 public:
-    vec2 start;
-    vec2 direction;
+    Vec2<Scalar> start;
+    Vec2<Scalar> direction;
 
-    Ray (vec2 start, vec2 direction) : start(start), direction(direction) {};
+    RayT (Vec2<Scalar> start, Vec2<Scalar> direction) : start(start), direction(direction) {};
+
+    template <typename OtherScalar>
+    RayT<OtherScalar> cast () {
+        return RayT<OtherScalar>(start.template cast<OtherScalar>(), direction.template cast<OtherScalar>());
+    }
 };
 
-class Segment {
-    float _lengthAndStraightInfo;
+template <typename Scalar>
+class SegmentT {
+    typedef Vec2<Scalar> V;
+
+    Scalar _lengthAndStraightInfo;
+    // derived arc quantities, computed once on construction
+    V _radialCenter;
+    Scalar _signedRadius;
+    Scalar _startAngle;
+    Scalar _angleSpan;
 
 public:
-    const vec2 start;
-    const vec2 end;
-    const vec2 direction;
+    const V start;
+    const V end;
+    const V direction;
 
-    Segment () {}
+    SegmentT () {}
 
     // LineSegment
-    Segment (vec2 start, vec2 end)
+    SegmentT (V start, V end)
         :start(start), direction((end - start).normalized()), end(end)
     {
         _lengthAndStraightInfo = (end - start).norm();
+        cacheArcQuantities(false);
     }
 
     // CircleSegment
-    Segment (vec2 start, vec2 direction, vec2 end)
+    SegmentT (V start, V direction, V end)
         :start(start), direction(direction), end(end)
     {
         bool isStraight = (end - start).normalized() == direction;
+        cacheArcQuantities(!isStraight);
         if (isStraight) {
             _lengthAndStraightInfo = (end - start).norm();
         } else {
@@ -73,105 +117,285 @@ public:
         }
     }
 
+    // Restores a segment from its stored fields without recomputing any of them, for loading saved segments
+    SegmentT (V start, V direction, V end, Scalar lengthAndStraightInfo,
+              V radialCenter, Scalar signedRadius, Scalar startAngle, Scalar angleSpan)
+        :_lengthAndStraightInfo(lengthAndStraightInfo), _radialCenter(radialCenter), _signedRadius(signedRadius),
+         _startAngle(startAngle), _angleSpan(angleSpan), start(start), end(end), direction(direction) {}
+
+    // negative for arcs, whose length it is too
+    Scalar lengthAndStraightInfo () {
+        return _lengthAndStraightInfo;
+    }
+
 private:
-    float angleSpan() {
-        vec2 center = radialCenter();
-        return angleBetweenWithDirection(start - center, direction, end - center);
+    void cacheArcQuantities (bool isArc) {
+        V halfChord = (end - start) / 2;
+        _signedRadius = halfChord.squaredNorm() / (direction.unitOrthogonal().dot(halfChord));
+        _radialCenter = start + _signedRadius * direction.unitOrthogonal();
+
+        if (isArc) {
+            instrument(ARC_CONSTRUCTIONS);
+            V startFromCenter = start - _radialCenter;
+            using std::atan2;
+            _startAngle = atan2(startFromCenter[1], startFromCenter[0]);
+            _angleSpan = angleBetweenWithDirection<Scalar>(startFromCenter, direction, end - _radialCenter);
+        } else {
+            _startAngle = 0;
+            _angleSpan = 0;
+        }
+    }
+
+    // 1 for arcs turning counter-clockwise, -1 for clockwise ones
+    Scalar turn () {
+        using std::copysign;
+        return copysign(Scalar(1), _signedRadius);
     }
 
 public:
 
-    float length() {
-        return std::abs(_lengthAndStraightInfo);
+    Scalar length() {
+        using std::abs;
+        return abs(_lengthAndStraightInfo);
     }
 
     bool isStraight() {
         return _lengthAndStraightInfo > 0;
     }
 
-    vec2 radialCenter () {
-        return start + signedRadius() * direction.unitOrthogonal();
+    V radialCenter () {
+        return _radialCenter;
     }
-private:
-    float signedRadius () {
-        auto halfChord = (end - start) / 2;
-        return halfChord.squaredNorm() / (direction.unitOrthogonal().dot(halfChord));
+
+    // positive if the arc turns counter-clockwise
+    Scalar signedRadius () {
+        return _signedRadius;
     }
-public:
 
-    float radius () {
-        return std::abs(signedRadius());
+    Scalar radius () {
+        using std::abs;
+        return abs(_signedRadius);
     }
 
-    vec2 midpoint () {
-        auto linearMidpoint = (end + start) / 2;
-        if (isStraight()) return linearMidpoint;
+    // angle of start - radialCenter(), measured from the x axis
+    Scalar startAngle () {
+        return _startAngle;
+    }
+
+    // always positive, independent of the turning direction
+    Scalar angleSpan() {
+        return _angleSpan;
+    }
+
+    V midpoint () {
+        if (isStraight()) return (end + start) / 2;
         else {
-            auto center = radialCenter();
-            return center + ((linearMidpoint - center).normalized() * radius());
+            auto rotation = Eigen::Rotation2D<Scalar>(turn() * _angleSpan / 2);
+            return _radialCenter + rotation * (start - _radialCenter);
         }
     }
 
-    vec2 endDirection () {
+    V endDirection () {
         if (isStraight()) return direction;
-        else return std::copysign(1, signedRadius()) * (end - radialCenter()).unitOrthogonal();
+        else return turn() * (end - _radialCenter).unitOrthogonal();
     }
 
-    vec2 directionOf (float offset) {
+    V pointAt (Scalar offset) {
+        if (isStraight()) return start + offset * direction;
+        else {
+            auto rotation = Eigen::Rotation2D<Scalar>(turn() * (offset/length()) * _angleSpan);
+            return _radialCenter + rotation * (start - _radialCenter);
+        }
+    }
+
+    V directionOf (Scalar offset) {
         if (isStraight()) return direction;
         else {
-            auto rotation = Eigen::Rotation2D<float>((offset/length()) * angleSpan());
-            return std::copysign(1, signedRadius()) * (rotation * (start - radialCenter())).unitOrthogonal();
+            auto rotation = Eigen::Rotation2D<Scalar>(turn() * (offset/length()) * _angleSpan);
+            return turn() * (rotation * (start - _radialCenter)).unitOrthogonal();
         }
     }
 
-    float offsetAt (vec2 point) {
+    Scalar offsetAt (V point) {
         if (isStraight()) return direction.dot(point - start);
         else {
-            float angleAToPoint = angleBetweenWithDirection(start - radialCenter(), direction, point - radialCenter());
-            float angleBToPoint = angleBetweenWithDirection(end - radialCenter(), -endDirection(), point - radialCenter());
-            float tolerance = thickness / radius();
-
-            if (angleAToPoint <= angleSpan() + tolerance &&
-                angleBToPoint <= angleSpan() + tolerance) {
-                return std::min(angleSpan(), std::max(0.0f, angleAToPoint)) * radius();
+            instrument(ARC_OFFSET_LOOKUPS);
+            Scalar angleAToPoint = angleBetweenWithDirection<Scalar>(start - _radialCenter, direction, point - _radialCenter);
+            Scalar angleBToPoint = angleBetweenWithDirection<Scalar>(end - _radialCenter, -endDirection(), point - _radialCenter);
+            Scalar tolerance = Tolerances<Scalar>::thickness() / radius();
+
+            if (angleAToPoint <= _angleSpan + tolerance &&
+                angleBToPoint <= _angleSpan + tolerance) {
+                return std::min(_angleSpan, std::max(Scalar(0), angleAToPoint)) * radius();
             } else {
                 if (angleAToPoint <= angleBToPoint) return angleAToPoint * radius();
-                else return -(angleBToPoint - angleSpan()) * radius();
+                else return -(angleBToPoint - _angleSpan) * radius();
             }
         }
     }
 
-    float distanceTo(vec2 point) {
-            float offsetAlong = offsetAt(point);
+    Scalar distanceTo(V point) {
+        return distanceTo(point, offsetAt(point));
+    }
+
+    // with offsetAlong = offsetAt(point) known already, arc offsets take trig
+    Scalar distanceTo(V point, Scalar offsetAlong) {
+            using std::abs;
             if (offsetAlong < 0)
                 return (point - start).norm();
             else if (offsetAlong <= length())
                 if (isStraight())
-                    return std::abs(direction.unitOrthogonal().dot(point - start));
-                else return std::abs((point - radialCenter()).norm() - radius());
+                    return abs(direction.unitOrthogonal().dot(point - start));
+                else return abs((point - _radialCenter).norm() - radius());
             else
                 return (point - end).norm();
     }
 
-    bool contains (vec2 pointAnywhere) {
-        float distance = distanceTo(pointAnywhere);
-        return distance < thickness/2;
+    bool contains (V pointAnywhere) {
+        return contains(pointAnywhere, offsetAt(pointAnywhere));
+    }
+
+    bool contains (V pointAnywhere, Scalar offsetAlong) {
+        Scalar distance = distanceTo(pointAnywhere, offsetAlong);
+        return distance < Tolerances<Scalar>::thickness()/2;
     }
 
-    Segment reverse() {
-        if (isStraight()) return Segment(end, start);
-        else return Segment(end, endDirection(), start);
+    // The same segment moved by shift, keeping all cached quantities but the center
+    SegmentT movedBy (V shift) {
+        return SegmentT(start + shift, direction, end + shift, _lengthAndStraightInfo,
+                        _radialCenter + shift, _signedRadius, _startAngle, _angleSpan);
     }
 
-    AtMost<2, Segment> subdivide (vec2 divider) {
+    // The parallel segment at distance to the left (negative: to the right), without any trig.
+    // Arcs keep their center and angles and change their radius, an arc offset past its center
+    // to the inside comes out with the opposite turn and has to be dropped by the caller.
+    SegmentT offsetBy (Scalar distance) {
+        V shift = distance * direction.unitOrthogonal();
         if (isStraight()) {
-            return {Segment(start, divider), Segment(divider, end)};
+            return SegmentT(start + shift, direction, end + shift, _lengthAndStraightInfo,
+                            _radialCenter + shift, _signedRadius, _startAngle, _angleSpan);
         } else {
-            vec2 dividerDirection = std::copysign(1, signedRadius()) * (divider - radialCenter()).unitOrthogonal();
-            return {Segment(start, direction, divider), Segment(divider, dividerDirection, end)};
+            Scalar signedRadius = _signedRadius - distance;
+            using std::abs;
+            return SegmentT(start + shift, direction, end + distance * endDirection().unitOrthogonal(),
+                            -_angleSpan * abs(signedRadius), _radialCenter, signedRadius, _startAngle, _angleSpan);
+        }
+    }
+
+    SegmentT reverse() {
+        if (isStraight()) return SegmentT(end, start);
+        else return SegmentT(end, endDirection(), start);
+    }
+
+    template <typename OtherScalar>
+    SegmentT<OtherScalar> cast () {
+        if (isStraight()) return SegmentT<OtherScalar>(start.template cast<OtherScalar>(), end.template cast<OtherScalar>());
+        else return SegmentT<OtherScalar>(start.template cast<OtherScalar>(), direction.template cast<OtherScalar>(),
+                                          end.template cast<OtherScalar>());
+    }
+
+    AtMost<2, SegmentT> subdivide (V divider) {
+        if (isStraight()) {
+            return {SegmentT(start, divider), SegmentT(divider, end)};
+        } else {
+            V dividerDirection = turn() * (divider - _radialCenter).unitOrthogonal();
+            return {SegmentT(start, direction, divider), SegmentT(divider, dividerDirection, end)};
         }
     };
 };
 
+typedef CircleT<float> Circle;
+typedef LineT<float> Line;
+typedef RayT<float> Ray;
+typedef SegmentT<float> Segment;
+
+typedef CircleT<double> Circled;
+typedef LineT<double> Lined;
+typedef RayT<double> Rayd;
+typedef SegmentT<double> Segmentd;
+
+// Trimmed, assignable copy of a Segment for hot loops. Lines keep their
+// direction and arcs their center in the same slot. Angular queries start
+// from the cached start angle and need one atan2, where Segment uses two acos.
+// Results agree with Segment up to float precision.
+class CompactSegment {
+public:
+    vec2 start;
+    vec2 end;
+    vec2 directionOrCenter;
+    float signedRadius;
+    float startAngle;
+    float angleSpan;
+    float lengthAndStraightInfo;
+
+    CompactSegment () {}
+
+    CompactSegment (Segment& segment)
+        : start(segment.start), end(segment.end),
+          directionOrCenter(segment.isStraight() ? segment.direction : segment.radialCenter()),
+          signedRadius(segment.signedRadius()), startAngle(segment.startAngle()), angleSpan(segment.angleSpan()),
+          lengthAndStraightInfo(segment.isStraight() ? segment.length() : -segment.length()) {};
+
+    float length () {
+        return std::abs(lengthAndStraightInfo);
+    }
+
+    bool isStraight () {
+        return lengthAndStraightInfo > 0;
+    }
+
+    float radius () {
+        return std::abs(signedRadius);
+    }
+
+    float turn () {
+        return std::copysign(1.0f, signedRadius);
+    }
+
+    vec2 pointAtAngle (float angle) {
+        return directionOrCenter + radius() * vec2(std::cos(angle), std::sin(angle));
+    }
+
+    vec2 midpoint () {
+        if (isStraight()) return (start + end) / 2;
+        else return pointAtAngle(startAngle + turn() * angleSpan / 2);
+    }
+
+    vec2 directionOf (float offset) {
+        if (isStraight()) return directionOrCenter;
+        else {
+            float angle = startAngle + turn() * offset / radius();
+            return turn() * vec2(-std::sin(angle), std::cos(angle));
+        }
+    }
+
+    float offsetAt (vec2 point) {
+        if (isStraight()) return directionOrCenter.dot(point - start);
+        else {
+            vec2 fromCenter = point - directionOrCenter;
+            float angle = turn() * (std::atan2(fromCenter[1], fromCenter[0]) - startAngle);
+            angle -= 2 * M_PI * std::floor(angle / (2 * M_PI));
+            // points outside the arc count from the closer end
+            if (angle > M_PI + angleSpan / 2) angle -= 2 * M_PI;
+            return angle * radius();
+        }
+    }
+
+    float distanceTo (vec2 point) {
+        float offsetAlong = offsetAt(point);
+        if (offsetAlong < 0)
+            return (point - start).norm();
+        else if (offsetAlong <= length())
+            if (isStraight())
+                return std::abs(directionOrCenter.unitOrthogonal().dot(point - start));
+            else return std::abs((point - directionOrCenter).norm() - radius());
+        else
+            return (point - end).norm();
+    }
+
+    bool contains (vec2 pointAnywhere) {
+        return distanceTo(pointAnywhere) < thickness/2;
+    }
+};
+
 #endif //COMPASS_PRIMITIVES_H
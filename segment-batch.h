@@ -0,0 +1,332 @@
+#ifndef COMPASS_SEGMENT_BATCH_H
+#define COMPASS_SEGMENT_BATCH_H
+
+#include <vector>
+#include <cstdint>
+#include <limits>
+#include "primitives.h"
+#include "intersections.h"
+#include "lanes.h"
+
+// all arrays are padded to a multiple of this, so every lane width
+// can load full registers without a scalar tail loop
+const int SEGMENT_BATCH_PADDING = 8;
+
+// The columns of a SegmentBatch, or of anything else laid out the same way,
+// such as a block of a mapped segment file. This is what the kernels read,
+// the view owns nothing and is only valid as long as the columns are.
+struct SegmentBatchView {
+    int count;
+    // a multiple of SEGMENT_BATCH_PADDING, every column holds this many entries
+    int paddedCount;
+    const float* startX;
+    const float* startY;
+    const float* endX;
+    const float* endY;
+    const float* directionX;
+    const float* directionY;
+    const float* length;
+    const float* radius;
+    const float* centerX;
+    const float* centerY;
+    const float* signedRadius;
+    const float* startAngle;
+    const float* angleSpan;
+    const int32_t* straightMask;
+    const int32_t* arcMask;
+
+    int size () const {
+        return count;
+    }
+
+    int paddedSize () const {
+        return paddedCount;
+    }
+
+    bool isStraight (int i) const {
+        return straightMask[i] != 0;
+    }
+
+    // restored from the stored fields, with the same cached quantities as the added segment
+    Segment segment (int i) const {
+        return Segment(vec2(startX[i], startY[i]), vec2(directionX[i], directionY[i]), vec2(endX[i], endY[i]),
+                       isStraight(i) ? length[i] : -length[i], vec2(centerX[i], centerY[i]), signedRadius[i],
+                       startAngle[i], angleSpan[i]);
+    }
+};
+
+// Structure-of-arrays storage for many Segments, laid out for the
+// lane-parallel intersection kernels below. Padding entries are
+// neither straight nor arc and never produce intersections.
+class SegmentBatch {
+    int count;
+
+public:
+    std::vector<float> startX, startY;
+    std::vector<float> endX, endY;
+    std::vector<float> directionX, directionY;
+    std::vector<float> length;
+    // only meaningful for arcs, zero for straight segments
+    std::vector<float> radius;
+    // the cached quantities of Segment, so segment() restores them without recomputing anything.
+    // Straight segments have far away or infinite centers here, the kernels only read them for arcs.
+    std::vector<float> centerX, centerY;
+    std::vector<float> signedRadius;
+    std::vector<float> startAngle, angleSpan;
+    // all bits set for a straight segment / an arc, zero otherwise
+    std::vector<int32_t> straightMask;
+    std::vector<int32_t> arcMask;
+
+    SegmentBatch () : count(0) {};
+
+    SegmentBatch (std::vector<Segment>& segments) : count(0) {
+        reserve(segments.size());
+        for (auto& segment : segments) add(segment);
+    };
+
+    int size () {
+        return count;
+    }
+
+    int paddedSize () {
+        return int(startX.size());
+    }
+
+    void reserve (int n) {
+        int padded = (n + SEGMENT_BATCH_PADDING - 1) / SEGMENT_BATCH_PADDING * SEGMENT_BATCH_PADDING;
+        for (auto array : {&startX, &startY, &endX, &endY, &directionX, &directionY, &length, &radius,
+                           &centerX, &centerY, &signedRadius, &startAngle, &angleSpan}) array->reserve(padded);
+        straightMask.reserve(padded);
+        arcMask.reserve(padded);
+    }
+
+    void clear () {
+        count = 0;
+        for (auto array : {&startX, &startY, &endX, &endY, &directionX, &directionY, &length, &radius,
+                           &centerX, &centerY, &signedRadius, &startAngle, &angleSpan}) array->clear();
+        straightMask.clear();
+        arcMask.clear();
+    }
+
+    void add (Segment segment) {
+        if (count == paddedSize()) {
+            int padded = count + SEGMENT_BATCH_PADDING;
+            for (auto array : {&startX, &startY, &endX, &endY, &directionX, &directionY, &length, &radius,
+                               &centerX, &centerY, &signedRadius, &startAngle, &angleSpan}) {
+                array->resize(padded, 0.0f);
+            }
+            straightMask.resize(padded, 0);
+            arcMask.resize(padded, 0);
+        }
+
+        int i = count++;
+        startX[i] = segment.start[0];
+        startY[i] = segment.start[1];
+        endX[i] = segment.end[0];
+        endY[i] = segment.end[1];
+        directionX[i] = segment.direction[0];
+        directionY[i] = segment.direction[1];
+        length[i] = segment.length();
+        vec2 center = segment.radialCenter();
+        centerX[i] = center[0];
+        centerY[i] = center[1];
+        signedRadius[i] = segment.signedRadius();
+        startAngle[i] = segment.startAngle();
+        angleSpan[i] = segment.angleSpan();
+
+        if (segment.isStraight()) {
+            straightMask[i] = -1;
+        } else {
+            arcMask[i] = -1;
+            radius[i] = segment.radius();
+        }
+    }
+
+    bool isStraight (int i) {
+        return straightMask[i] != 0;
+    }
+
+    Segment segment (int i) {
+        return view().segment(i);
+    }
+
+    // invalidated by add() and clear()
+    SegmentBatchView view () {
+        return {count, paddedSize(), startX.data(), startY.data(), endX.data(), endY.data(),
+                directionX.data(), directionY.data(), length.data(), radius.data(), centerX.data(), centerY.data(),
+                signedRadius.data(), startAngle.data(), angleSpan.data(), straightMask.data(), arcMask.data()};
+    }
+};
+
+struct BatchIntersection {
+    int indexA;
+    int indexB;
+    float alongA;
+    float alongB;
+    vec2 position;
+};
+
+// relative slack for the lane-parallel rejection tests, which must never reject
+// a pair that the scalar overloads (partly working in double) would accept
+const float BATCH_REJECTION_SLACK = 0.00001;
+
+// intersect(Line, Line) falls back to the exact orientation for determinants within
+// 4 epsilon (relative) of the parallel tolerance, leave twice that band to it, so the
+// decision is always the same as in the scalar overload
+const float BATCH_PARALLEL_UNCERTAINTY = 8 * std::numeric_limits<float>::epsilon();
+
+// Runs the scalar overload on a candidate pair that the lanes could not reject.
+// Arc offsets go through acos, so they are resolved one pair at a time.
+void intersectCandidate (Segment& a, int indexA, const SegmentBatchView& b, int indexB,
+                         std::vector<BatchIntersection>& out) {
+    auto segmentB = b.segment(indexB);
+    intersectInto(a, segmentB, [&](Intersection& i) {
+        out.push_back({indexA, indexB, i.alongA, i.alongB, i.position});
+    });
+}
+
+// Conservatively rejects lines (one per lane) against a circle (broadcast), everything
+// that survives might have a non-negative discriminant in intersect(Line&, Circle&)
+Lanes lineCircleCandidates (Lanes mask, Lanes lineStartX, Lanes lineStartY, Lanes lineDirectionX, Lanes lineDirectionY,
+                            Lanes centerX, Lanes centerY, Lanes radius) {
+    auto deltaX = lineStartX - centerX;
+    auto deltaY = lineStartY - centerY;
+    auto directionDotDelta = lineDirectionX * deltaX + lineDirectionY * deltaY;
+    auto squaredDirectionDotDelta = directionDotDelta * directionDotDelta;
+    auto deltaSquaredNorm = deltaX * deltaX + deltaY * deltaY;
+    auto squaredRadius = radius * radius;
+    auto det = squaredDirectionDotDelta - (deltaSquaredNorm - squaredRadius);
+    auto slack = lanesBroadcast(BATCH_REJECTION_SLACK) * (squaredDirectionDotDelta + deltaSquaredNorm + squaredRadius);
+    return lanesAndNot(lanesLess(det, lanesBroadcast(0.0f) - slack), mask);
+}
+
+// Conservatively rejects circles (one per lane) against a circle (broadcast),
+// using the "too far apart" and "one inside the other" early outs of intersect(Circle&, Circle&)
+Lanes circleCircleCandidates (Lanes mask, Lanes centerX, Lanes centerY, Lanes radius,
+                              Lanes otherCenterX, Lanes otherCenterY, Lanes otherRadius) {
+    auto aToBX = otherCenterX - centerX;
+    auto aToBY = otherCenterY - centerY;
+    auto aToBDist = lanesSqrt(aToBX * aToBX + aToBY * aToBY);
+    auto tolerance = lanesBroadcast(thickness);
+    auto slack = lanesBroadcast(1.0f + BATCH_REJECTION_SLACK);
+    auto tooFarApart = lanesGreater(aToBDist, (radius + otherRadius + tolerance) * slack);
+    auto oneInsideOther = lanesLess(aToBDist * slack, lanesAbs(radius - otherRadius) - tolerance);
+    return lanesAndNot(lanesOr(tooFarApart, oneInsideOther), mask);
+}
+
+// same clamping as the Ray and Segment overloads apply to their own offset
+float clampAlong (float along, float length) {
+    if (!(along >= 0)) along = 0;
+    if (!(along <= length)) along = length;
+    return along;
+}
+
+void intersectStraightWithBatch (const SegmentBatchView& a, int indexA, const SegmentBatchView& b,
+                                 std::vector<BatchIntersection>& out) {
+    auto segmentA = a.segment(indexA);
+    float aLength = a.length[indexA];
+
+    auto aStartX = lanesBroadcast(a.startX[indexA]);
+    auto aStartY = lanesBroadcast(a.startY[indexA]);
+    auto aDirectionX = lanesBroadcast(a.directionX[indexA]);
+    auto aDirectionY = lanesBroadcast(a.directionY[indexA]);
+    auto aLengthLimit = lanesBroadcast(aLength + thickness/2);
+    auto halfThickness = lanesBroadcast(thickness/2);
+    auto lowerLimit = lanesBroadcast(-thickness/2);
+    auto parallelTolerance = lanesBroadcast(ROUGH_TOLERANCE);
+
+    float alongAs[LANE_COUNT];
+    float alongBs[LANE_COUNT];
+
+    for (int j = 0; j < b.paddedSize(); j += LANE_COUNT) {
+        auto bStartX = lanesLoad(&b.startX[j]);
+        auto bStartY = lanesLoad(&b.startY[j]);
+        auto bDirectionX = lanesLoad(&b.directionX[j]);
+        auto bDirectionY = lanesLoad(&b.directionY[j]);
+
+        // intersect(Line, Line), then the Ray and Segment limits of both sides
+        auto det = bDirectionX * aDirectionY - bDirectionY * aDirectionX;
+        auto deltaX = bStartX - aStartX;
+        auto deltaY = bStartY - aStartY;
+        auto alongA = (deltaY * bDirectionX - deltaX * bDirectionY) / det;
+        auto alongB = (deltaY * aDirectionX - deltaX * aDirectionY) / det;
+
+        // near the tolerance, leave the parallel decision to the scalar overload
+        auto detError = lanesAbs(bDirectionX * aDirectionY) + lanesAbs(bDirectionY * aDirectionX);
+        auto uncertain = lanesAnd(lanesLoadMask(&b.straightMask[j]), lanesLessOrEqual(
+                lanesAbs(lanesAbs(det) - parallelTolerance), lanesBroadcast(BATCH_PARALLEL_UNCERTAINTY) * detError));
+
+        auto hits = lanesAndNot(uncertain, lanesAnd(lanesLoadMask(&b.straightMask[j]),
+                                                    lanesNotLessOrEqual(lanesAbs(det), parallelTolerance)));
+        hits = lanesAnd(hits, lanesAnd(lanesGreater(alongA, lowerLimit), lanesLess(alongA, aLengthLimit)));
+        hits = lanesAnd(hits, lanesAnd(lanesGreater(alongB, lowerLimit),
+                                       lanesLess(alongB, lanesLoad(&b.length[j]) + halfThickness)));
+
+        auto candidates = lineCircleCandidates(lanesLoadMask(&b.arcMask[j]), aStartX, aStartY, aDirectionX, aDirectionY,
+                                               lanesLoad(&b.centerX[j]), lanesLoad(&b.centerY[j]), lanesLoad(&b.radius[j]));
+        candidates = lanesOr(candidates, uncertain);
+
+        int hitBits = lanesBits(hits);
+        int candidateBits = lanesBits(candidates);
+        if (!(hitBits | candidateBits)) continue;
+
+        lanesStore(alongAs, alongA);
+        lanesStore(alongBs, alongB);
+
+        for (int lane = 0; lane < LANE_COUNT; lane++) {
+            int indexB = j + lane;
+            if (hitBits & (1 << lane)) {
+                out.push_back({indexA, indexB,
+                               clampAlong(alongAs[lane], aLength),
+                               clampAlong(alongBs[lane], b.length[indexB]),
+                               segmentA.start + alongAs[lane] * segmentA.direction});
+            } else if (candidateBits & (1 << lane)) {
+                intersectCandidate(segmentA, indexA, b, indexB, out);
+            }
+        }
+    }
+}
+
+void intersectArcWithBatch (const SegmentBatchView& a, int indexA, const SegmentBatchView& b,
+                            std::vector<BatchIntersection>& out) {
+    auto segmentA = a.segment(indexA);
+
+    auto aCenterX = lanesBroadcast(a.centerX[indexA]);
+    auto aCenterY = lanesBroadcast(a.centerY[indexA]);
+    auto aRadius = lanesBroadcast(a.radius[indexA]);
+
+    for (int j = 0; j < b.paddedSize(); j += LANE_COUNT) {
+        auto lineCandidates = lineCircleCandidates(lanesLoadMask(&b.straightMask[j]),
+                                                   lanesLoad(&b.startX[j]), lanesLoad(&b.startY[j]),
+                                                   lanesLoad(&b.directionX[j]), lanesLoad(&b.directionY[j]),
+                                                   aCenterX, aCenterY, aRadius);
+        auto arcCandidates = circleCircleCandidates(lanesLoadMask(&b.arcMask[j]),
+                                                    lanesLoad(&b.centerX[j]), lanesLoad(&b.centerY[j]), lanesLoad(&b.radius[j]),
+                                                    aCenterX, aCenterY, aRadius);
+
+        int candidateBits = lanesBits(lanesOr(lineCandidates, arcCandidates));
+        if (!candidateBits) continue;
+
+        for (int lane = 0; lane < LANE_COUNT; lane++) {
+            if (candidateBits & (1 << lane)) intersectCandidate(segmentA, indexA, b, j + lane, out);
+        }
+    }
+}
+
+// Intersects every segment of a with every segment of b and appends the results
+// to out, ordered by indexA, then indexB - the same order and the same values
+// as calling intersect(Segment&, Segment&) in a nested loop.
+// Line-line pairs are solved completely in lanes, pairs involving arcs are
+// rejected in lanes where possible and finished by the scalar overloads.
+void intersectMany (const SegmentBatchView& a, const SegmentBatchView& b, std::vector<BatchIntersection>& out) {
+    for (int i = 0; i < a.size(); i++) {
+        if (a.isStraight(i)) intersectStraightWithBatch(a, i, b, out);
+        else intersectArcWithBatch(a, i, b, out);
+    }
+}
+
+void intersectMany (SegmentBatch& a, SegmentBatch& b, std::vector<BatchIntersection>& out) {
+    intersectMany(a.view(), b.view(), out);
+}
+
+#endif //COMPASS_SEGMENT_BATCH_H
@@ -0,0 +1,272 @@
+#ifndef COMPASS_SEGMENT_BVH_H
+#define COMPASS_SEGMENT_BVH_H
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <cmath>
+#include "primitives.h"
+#include "bounding-box.h"
+#include "predicates.h"
+
+class Path;
+
+// Segments per leaf of a SegmentBVH
+const int BVH_LEAF_SIZE = 4;
+
+// Enough for any tree built by median splits, which are at most log2(n) deep
+const int BVH_STACK_SIZE = 64;
+
+// A static bounding volume hierarchy over line and arc segments, for point queries against
+// many segments: the nearest ones and how often closed paths wind around a point.
+// Built once by median splits along the longer axis of the segment bounds' centers,
+// nodes are stored flat with both children next to each other.
+// Queries don't allocate and can run concurrently.
+class SegmentBVH {
+    struct Node {
+        BoundingBox bounds;
+        // the first child for inner nodes, the first entry of order for leaves
+        int first;
+        // 0 for inner nodes
+        int count;
+    };
+
+public:
+    std::vector<Segment> segments;
+    std::vector<BoundingBox> bounds;
+    // pathStarts[p] is the first segment of the p-th path, if built from paths
+    std::vector<int> pathStarts;
+
+    SegmentBVH (std::vector<Segment> segments) : segments(std::move(segments)) {
+        build();
+    };
+
+    // All segments of the given closed paths, a shape and its holes for example. Defined in path.h
+    SegmentBVH (std::vector<Path>& paths);
+
+    int size () const {
+        return segments.size();
+    }
+
+    int pathOf (int segment) const {
+        return int(std::upper_bound(pathStarts.begin(), pathStarts.end(), segment) - pathStarts.begin()) - 1;
+    }
+
+    // NEAREST SEGMENTS
+
+    // Index of the segment closest to point, the lowest one among equally close ones - the same as
+    // the first minimum of segments[i].distanceTo(point). -1 without segments.
+    int nearest (vec2 point) {
+        float distance;
+        return nearestFrom(point, -1, distance);
+    }
+
+    // Indices of the k segments closest to point, closest first, equally close ones by index
+    void kNearest (vec2 point, int k, std::vector<std::pair<float, int>>& out) {
+        out.clear();
+        if (nodes.empty() || k <= 0) return;
+        auto closer = [](const std::pair<float, int>& a, const std::pair<float, int>& b) { return a < b; };
+
+        int stack[BVH_STACK_SIZE];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize) {
+            Node& node = nodes[stack[--stackSize]];
+            if (out.size() == k && node.bounds.distanceTo(point) > out.front().first) continue;
+
+            if (node.count) {
+                for (int e = node.first; e < node.first + node.count; e++) {
+                    if (out.size() == k && bounds[order[e]].distanceTo(point) > out.front().first) continue;
+                    std::pair<float, int> candidate(segments[order[e]].distanceTo(point), order[e]);
+                    if (out.size() < k) {
+                        out.push_back(candidate);
+                        std::push_heap(out.begin(), out.end(), closer);
+                    } else if (candidate < out.front()) {
+                        std::pop_heap(out.begin(), out.end(), closer);
+                        out.back() = candidate;
+                        std::push_heap(out.begin(), out.end(), closer);
+                    }
+                }
+            } else {
+                pushChildren(node, point, stack, stackSize);
+            }
+        }
+
+        std::sort_heap(out.begin(), out.end(), closer);
+    }
+
+    // POINT IN SHAPE
+
+    // How often the closed paths among the segments wind around point, counter-clockwise positive.
+    // Counts signed crossings of the chords with a ray from point in +x direction, using the exact
+    // orientation. An arc adds its turn if point lies between it and its chord. Only segments whose
+    // bounds reach the ray are looked at.
+    int windingNumber (vec2 point) {
+        if (nodes.empty()) return 0;
+        int winding = 0;
+
+        int stack[BVH_STACK_SIZE];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize) {
+            Node& node = nodes[stack[--stackSize]];
+            if (!reachesRay(node.bounds, point)) continue;
+
+            if (node.count) {
+                for (int e = node.first; e < node.first + node.count; e++) {
+                    if (reachesRay(bounds[order[e]], point)) winding += windingOf(segments[order[e]], point);
+                }
+            } else {
+                stack[stackSize++] = node.first;
+                stack[stackSize++] = node.first + 1;
+            }
+        }
+
+        return winding;
+    }
+
+    bool contains (vec2 point) {
+        return windingNumber(point) != 0;
+    }
+
+    // BATCHED QUERIES
+
+    // nearest() for many points. The previous point's nearest segment bounds the search of the next,
+    // which helps when points follow each other closely, like a cursor's path.
+    void nearestMany (const std::vector<vec2>& points, std::vector<int>& out) {
+        out.resize(points.size());
+        int previous = -1;
+        float distance;
+        for (int p = 0; p < points.size(); p++) {
+            previous = nearestFrom(points[p], previous, distance);
+            out[p] = previous;
+        }
+    }
+
+    void windingNumbers (const std::vector<vec2>& points, std::vector<int>& out) {
+        out.resize(points.size());
+        for (int p = 0; p < points.size(); p++) out[p] = windingNumber(points[p]);
+    }
+
+private:
+    std::vector<Node> nodes;
+    // segment indices, each leaf owns a contiguous range
+    std::vector<int> order;
+
+    void build () {
+        bounds.clear();
+        bounds.reserve(segments.size());
+        for (auto& segment : segments) bounds.push_back(boundsOf(segment));
+
+        order.resize(segments.size());
+        for (int i = 0; i < segments.size(); i++) order[i] = i;
+        nodes.clear();
+        if (segments.empty()) return;
+        nodes.reserve(2 * segments.size() / BVH_LEAF_SIZE + 1);
+        nodes.push_back(Node());
+        buildNode(0, 0, segments.size());
+    }
+
+    void buildNode (int index, int first, int count) {
+        BoundingBox box = bounds[order[first]];
+        BoundingBox centers(bounds[order[first]].min, bounds[order[first]].min);
+        for (int e = first; e < first + count; e++) {
+            box.include(bounds[order[e]]);
+            centers.include(vec2((bounds[order[e]].min + bounds[order[e]].max) / 2));
+        }
+        nodes[index].bounds = box;
+
+        if (count <= BVH_LEAF_SIZE) {
+            nodes[index].first = first;
+            nodes[index].count = count;
+            return;
+        }
+
+        int axis = centers.extent()[0] >= centers.extent()[1] ? 0 : 1;
+        int half = count / 2;
+        std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count,
+                         [&](int a, int b) {
+                             return bounds[a].min[axis] + bounds[a].max[axis] < bounds[b].min[axis] + bounds[b].max[axis];
+                         });
+
+        int children = nodes.size();
+        nodes[index].first = children;
+        nodes[index].count = 0;
+        nodes.push_back(Node());
+        nodes.push_back(Node());
+        buildNode(children, first, half);
+        buildNode(children + 1, first + half, count - half);
+    }
+
+    // pushes the farther child first, so the nearer one is searched first
+    void pushChildren (Node& node, vec2 point, int* stack, int& stackSize) {
+        float toFirst = nodes[node.first].bounds.distanceTo(point);
+        float toSecond = nodes[node.first + 1].bounds.distanceTo(point);
+        if (toFirst <= toSecond) {
+            stack[stackSize++] = node.first + 1;
+            stack[stackSize++] = node.first;
+        } else {
+            stack[stackSize++] = node.first;
+            stack[stackSize++] = node.first + 1;
+        }
+    }
+
+    // nearest(), starting from the distance to the segment guess, if there is one
+    int nearestFrom (vec2 point, int guess, float& bestDistance) {
+        int best = guess;
+        bestDistance = guess >= 0 ? segments[guess].distanceTo(point) : INFINITY;
+        if (nodes.empty()) return -1;
+
+        int stack[BVH_STACK_SIZE];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize) {
+            Node& node = nodes[stack[--stackSize]];
+            // equally close segments with a lower index can still be in there
+            if (node.bounds.distanceTo(point) > bestDistance) continue;
+
+            if (node.count) {
+                for (int e = node.first; e < node.first + node.count; e++) {
+                    int i = order[e];
+                    if (bounds[i].distanceTo(point) > bestDistance) continue;
+                    float distance = segments[i].distanceTo(point);
+                    if (distance < bestDistance || (distance == bestDistance && i < best)) {
+                        best = i;
+                        bestDistance = distance;
+                    }
+                }
+            } else {
+                pushChildren(node, point, stack, stackSize);
+            }
+        }
+
+        return best;
+    }
+
+    static bool reachesRay (const BoundingBox& box, vec2 point) {
+        return box.min[1] <= point[1] && point[1] <= box.max[1] && box.max[0] >= point[0];
+    }
+
+    // The chord's crossing with the ray, counted for chords going up when point lies to their left
+    // and going down when it lies to their right, each vertex belongs to the segment above it.
+    // Plus the winding of the loop of an arc and its reversed chord.
+    static int windingOf (Segment& segment, vec2 point) {
+        int winding = 0;
+        if (segment.start[1] <= point[1]) {
+            if (segment.end[1] > point[1] && orientation(segment.start, segment.end, point) > 0) winding++;
+        } else {
+            if (segment.end[1] <= point[1] && orientation(segment.start, segment.end, point) < 0) winding--;
+        }
+
+        if (!segment.isStraight() && (point - segment.radialCenter()).norm() < segment.radius()) {
+            // between a counter-clockwise arc and its chord means right of the chord
+            double side = orientation(segment.start, segment.end, point);
+            if (segment.signedRadius() > 0 && side < 0) winding++;
+            if (segment.signedRadius() < 0 && side > 0) winding--;
+        }
+
+        return winding;
+    }
+};
+
+#endif //COMPASS_SEGMENT_BVH_H
@@ -0,0 +1,284 @@
+#ifndef COMPASS_SEGMENT_FILE_H
+#define COMPASS_SEGMENT_FILE_H
+
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "primitives.h"
+#include "segment-batch.h"
+
+// A binary file format for large segment networks. Segments are stored with all their
+// cached quantities, so loading never runs the Segment constructors (normalized(),
+// angleSpan(), acos). After a header, segments follow in blocks of SEGMENT_FILE_BLOCK_SIZE,
+// each block is structure-of-arrays with the columns of SegmentBatch, so the batch kernels
+// run straight on the mapping. The last block is padded with zeros. Files are written in native (little endian) byte order, a reader on a machine
+// with the other order sees a swapped magic number and refuses them.
+
+const uint32_t SEGMENT_FILE_MAGIC = 0x47455343; // "CSEG"
+// bump on every layout change, readers only accept their own version
+const uint32_t SEGMENT_FILE_VERSION = 2;
+// a multiple of SEGMENT_BATCH_PADDING, so lanes can load full registers from a block
+const int SEGMENT_FILE_BLOCK_SIZE = 1024;
+static_assert(SEGMENT_FILE_BLOCK_SIZE % SEGMENT_BATCH_PADDING == 0,
+              "blocks are viewed as SegmentBatches, which are padded to SEGMENT_BATCH_PADDING");
+
+// the columns of SegmentBatch, the masks are int32 in float sized slots
+enum SegmentColumn {
+    START_X, START_Y, END_X, END_Y, DIRECTION_X, DIRECTION_Y, LENGTH, RADIUS,
+    CENTER_X, CENTER_Y, SIGNED_RADIUS, START_ANGLE, ANGLE_SPAN,
+    STRAIGHT_MASK, ARC_MASK,
+    SEGMENT_COLUMNS
+};
+
+// 64 bytes, so blocks stay aligned for vector loads
+struct SegmentFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t blockSize;
+    uint32_t columns;
+    uint64_t segmentCount;
+    uint8_t reserved[40];
+};
+
+const size_t SEGMENT_FILE_BLOCK_BYTES = size_t(SEGMENT_COLUMNS) * SEGMENT_FILE_BLOCK_SIZE * sizeof(float);
+
+// WRITING
+
+// Writes segments one by one, only ever holding one block in memory,
+// so networks larger than memory can be saved. The segment count is
+// written into the header on close().
+class SegmentFileWriter {
+    FILE* file;
+    uint64_t count;
+    int inBlock;
+    bool writeFailed;
+    const char* failure;
+    std::vector<float> block;
+
+public:
+    SegmentFileWriter ()
+        : file(nullptr), count(0), inBlock(0), writeFailed(false), failure(nullptr),
+          block(SEGMENT_COLUMNS * SEGMENT_FILE_BLOCK_SIZE) {};
+
+    SegmentFileWriter (const SegmentFileWriter&) = delete;
+    SegmentFileWriter& operator= (const SegmentFileWriter&) = delete;
+
+    ~SegmentFileWriter () {
+        close();
+    }
+
+    bool open (const char* fileName) {
+        close();
+        failure = nullptr;
+        file = std::fopen(fileName, "wb");
+        if (!file) {
+            failure = "could not open the file for writing";
+            return false;
+        }
+        count = 0;
+        inBlock = 0;
+        writeFailed = false;
+        if (writeHeader()) return true;
+        failure = "could not write the header";
+        return false;
+    }
+
+    bool isOpen () const {
+        return file != nullptr;
+    }
+
+    // why the last open() or close() returned false, nullptr if it didn't
+    const char* error () const {
+        return failure;
+    }
+
+    // does nothing unless a file is open
+    void add (Segment& segment) {
+        if (!file) return;
+        float* column = block.data() + inBlock;
+        vec2 center = segment.radialCenter();
+        bool straight = segment.isStraight();
+        float fields[STRAIGHT_MASK] = {
+                segment.start[0], segment.start[1], segment.end[0], segment.end[1],
+                segment.direction[0], segment.direction[1], segment.length(), straight ? 0.0f : segment.radius(),
+                center[0], center[1], segment.signedRadius(), segment.startAngle(), segment.angleSpan()
+        };
+        for (int c = 0; c < STRAIGHT_MASK; c++) column[c * SEGMENT_FILE_BLOCK_SIZE] = fields[c];
+        int32_t masks[] = {straight ? -1 : 0, straight ? 0 : -1};
+        std::memcpy(column + STRAIGHT_MASK * SEGMENT_FILE_BLOCK_SIZE, &masks[0], sizeof(int32_t));
+        std::memcpy(column + ARC_MASK * SEGMENT_FILE_BLOCK_SIZE, &masks[1], sizeof(int32_t));
+
+        count++;
+        if (++inBlock == SEGMENT_FILE_BLOCK_SIZE) writeFailed |= !flushBlock();
+    }
+
+    void add (std::vector<Segment>& segments) {
+        for (auto& segment : segments) add(segment);
+    }
+
+    // Pads and writes the last block and completes the header, false if anything could not be written
+    bool close () {
+        if (!file) return true;
+        bool written = !writeFailed;
+        if (inBlock) {
+            for (int c = 0; c < SEGMENT_COLUMNS; c++) {
+                float* column = block.data() + c * SEGMENT_FILE_BLOCK_SIZE;
+                std::fill(column + inBlock, column + SEGMENT_FILE_BLOCK_SIZE, 0.0f);
+            }
+            written = flushBlock() && written;
+        }
+        written = written && std::fseek(file, 0, SEEK_SET) == 0 && writeHeader();
+        written = std::fclose(file) == 0 && written;
+        file = nullptr;
+        if (!written) failure = "could not write all segments";
+        return written;
+    }
+
+private:
+    bool writeHeader () {
+        SegmentFileHeader header;
+        std::memset(&header, 0, sizeof(header));
+        header.magic = SEGMENT_FILE_MAGIC;
+        header.version = SEGMENT_FILE_VERSION;
+        header.blockSize = SEGMENT_FILE_BLOCK_SIZE;
+        header.columns = SEGMENT_COLUMNS;
+        header.segmentCount = count;
+        return std::fwrite(&header, sizeof(header), 1, file) == 1;
+    }
+
+    bool flushBlock () {
+        inBlock = 0;
+        return std::fwrite(block.data(), SEGMENT_FILE_BLOCK_BYTES, 1, file) == 1;
+    }
+};
+
+// READING
+
+// A segment file mapped into memory. Nothing is copied or parsed on open, the
+// columns of every block are read straight from the mapping, which the OS pages
+// in as they are touched. Every block is a SegmentBatchView for the batch kernels,
+// single segments are restored from their stored fields.
+// Counts and indices are 64 bit, files may hold more segments than fit in memory.
+class MappedSegments {
+    void* mapping;
+    size_t mappedBytes;
+    const float* blocks;
+    int64_t count;
+    const char* failure;
+
+public:
+    MappedSegments () : mapping(nullptr), mappedBytes(0), blocks(nullptr), count(0), failure(nullptr) {};
+
+    MappedSegments (const MappedSegments&) = delete;
+    MappedSegments& operator= (const MappedSegments&) = delete;
+
+    ~MappedSegments () {
+        close();
+    }
+
+    // false if the file can't be mapped or isn't a segment file of this version
+    bool open (const char* fileName) {
+        close();
+        failure = nullptr;
+        int descriptor = ::open(fileName, O_RDONLY);
+        if (descriptor < 0) {
+            failure = "could not open the file";
+            return false;
+        }
+
+        struct stat status;
+        bool mapped = false;
+        if (fstat(descriptor, &status) == 0 && status.st_size >= sizeof(SegmentFileHeader)) {
+            mappedBytes = status.st_size;
+            mapping = mmap(nullptr, mappedBytes, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            mapped = mapping != MAP_FAILED;
+            if (!mapped) mapping = nullptr;
+        }
+        ::close(descriptor);
+
+        if (!mapped) failure = "could not map the file";
+        else if (!validate()) failure = "not a segment file of this version, or truncated";
+        if (failure) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    // why the last open() returned false, nullptr if it didn't
+    const char* error () const {
+        return failure;
+    }
+
+    void close () {
+        if (mapping) munmap(mapping, mappedBytes);
+        mapping = nullptr;
+        mappedBytes = 0;
+        blocks = nullptr;
+        count = 0;
+    }
+
+    int64_t size () const {
+        return count;
+    }
+
+    int64_t blockCount () const {
+        return (count + SEGMENT_FILE_BLOCK_SIZE - 1) / SEGMENT_FILE_BLOCK_SIZE;
+    }
+
+    // SEGMENT_FILE_BLOCK_SIZE values of one field, for the segments of one block
+    const float* column (int64_t block, SegmentColumn column) const {
+        return blocks + (size_t(block) * SEGMENT_COLUMNS + column) * SEGMENT_FILE_BLOCK_SIZE;
+    }
+
+    // not for the masks, which aren't floats
+    float field (int64_t i, SegmentColumn field) const {
+        return column(i / SEGMENT_FILE_BLOCK_SIZE, field)[i % SEGMENT_FILE_BLOCK_SIZE];
+    }
+
+    // the segments of one block, indices in intersectMany() results are relative to the block
+    SegmentBatchView batch (int64_t block) const {
+        int64_t remaining = count - block * SEGMENT_FILE_BLOCK_SIZE;
+        int blockCount = int(std::min(remaining, int64_t(SEGMENT_FILE_BLOCK_SIZE)));
+        return {blockCount, SEGMENT_FILE_BLOCK_SIZE,
+                column(block, START_X), column(block, START_Y), column(block, END_X), column(block, END_Y),
+                column(block, DIRECTION_X), column(block, DIRECTION_Y), column(block, LENGTH), column(block, RADIUS),
+                column(block, CENTER_X), column(block, CENTER_Y), column(block, SIGNED_RADIUS),
+                column(block, START_ANGLE), column(block, ANGLE_SPAN),
+                reinterpret_cast<const int32_t*>(column(block, STRAIGHT_MASK)),
+                reinterpret_cast<const int32_t*>(column(block, ARC_MASK))};
+    }
+
+    Segment segment (int64_t i) const {
+        return batch(i / SEGMENT_FILE_BLOCK_SIZE).segment(int(i % SEGMENT_FILE_BLOCK_SIZE));
+    }
+
+    void segments (std::vector<Segment>& out) const {
+        out.clear();
+        out.reserve(count);
+        for (int64_t i = 0; i < count; i++) out.push_back(segment(i));
+    }
+
+private:
+    bool validate () {
+        auto header = static_cast<const SegmentFileHeader*>(mapping);
+        if (header->magic != SEGMENT_FILE_MAGIC || header->version != SEGMENT_FILE_VERSION
+            || header->blockSize != SEGMENT_FILE_BLOCK_SIZE || header->columns != SEGMENT_COLUMNS) return false;
+
+        uint64_t blockCount = header->segmentCount / SEGMENT_FILE_BLOCK_SIZE
+                              + (header->segmentCount % SEGMENT_FILE_BLOCK_SIZE != 0);
+        // truncated files would fault on access instead, divided so a corrupt count can't overflow
+        if ((mappedBytes - sizeof(SegmentFileHeader)) / SEGMENT_FILE_BLOCK_BYTES < blockCount) return false;
+
+        count = int64_t(header->segmentCount);
+        blocks = reinterpret_cast<const float*>(static_cast<const char*>(mapping) + sizeof(SegmentFileHeader));
+        return true;
+    }
+};
+
+#endif //COMPASS_SEGMENT_FILE_H
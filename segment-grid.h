@@ -0,0 +1,139 @@
+#ifndef COMPASS_SEGMENT_GRID_H
+#define COMPASS_SEGMENT_GRID_H
+
+#include <vector>
+#include <cmath>
+#include "primitives.h"
+#include "bounding-box.h"
+
+// Uniform grid over segment bounds, stored as one flat entry array with
+// per-cell start offsets. Every segment is entered into all cells its
+// bounds touch.
+class SegmentGrid {
+public:
+    std::vector<BoundingBox> bounds;
+    BoundingBox area;
+    float cellSize;
+    int columns;
+    int rows;
+    // entries of cell c are cellEntries[cellStarts[c]] ... cellEntries[cellStarts[c + 1] - 1]
+    std::vector<int> cellStarts;
+    std::vector<int> cellEntries;
+
+    // a cellSize of 0 picks one from the average segment extent
+    SegmentGrid (std::vector<Segment>& segments, float cellSize = 0) {
+        bounds.reserve(segments.size());
+        for (auto& segment : segments) bounds.push_back(boundsOf(segment));
+        build(cellSize);
+    };
+
+    SegmentGrid (std::vector<BoundingBox> bounds, float cellSize = 0) : bounds(std::move(bounds)) {
+        build(cellSize);
+    };
+
+    // clamped while still a float, coordinates far outside area don't fit an int
+    int cellColumn (float x) const {
+        return int(std::max(0.0f, std::min(float(columns - 1), std::floor((x - area.min[0]) / cellSize))));
+    }
+
+    int cellRow (float y) const {
+        return int(std::max(0.0f, std::min(float(rows - 1), std::floor((y - area.min[1]) / cellSize))));
+    }
+
+    // Calls f(i, j) with i < j exactly once for every pair of segments with overlapping bounds.
+    // A pair is only reported by the cell containing the min corner of the bounds' overlap.
+    template <typename F>
+    void forEachCandidatePair (F f) const {
+        for (int row = 0; row < rows; row++) {
+            for (int column = 0; column < columns; column++) {
+                forEachCandidatePairInCell(column, row, f);
+            }
+        }
+    }
+
+    // The part of forEachCandidatePair that is reported by one cell, cells can be processed independently
+    template <typename F>
+    void forEachCandidatePairInCell (int column, int row, F& f) const {
+        int cell = row * columns + column;
+        for (int e1 = cellStarts[cell]; e1 < cellStarts[cell + 1]; e1++) {
+            for (int e2 = e1 + 1; e2 < cellStarts[cell + 1]; e2++) {
+                int i = cellEntries[e1];
+                int j = cellEntries[e2];
+                auto& boundsI = bounds[i];
+                auto& boundsJ = bounds[j];
+                if (!boundsI.overlaps(boundsJ)) continue;
+
+                vec2 overlapMin = boundsI.min.cwiseMax(boundsJ.min);
+                if (cellColumn(overlapMin[0]) != column || cellRow(overlapMin[1]) != row) continue;
+
+                if (i < j) f(i, j);
+                else f(j, i);
+            }
+        }
+    }
+
+    // Appends every segment whose bounds overlap box to out, possibly more than once
+    void query (const BoundingBox& box, std::vector<int>& out) const {
+        for (int row = cellRow(box.min[1]); row <= cellRow(box.max[1]); row++) {
+            for (int column = cellColumn(box.min[0]); column <= cellColumn(box.max[0]); column++) {
+                int cell = row * columns + column;
+                for (int e = cellStarts[cell]; e < cellStarts[cell + 1]; e++) {
+                    if (bounds[cellEntries[e]].overlaps(box)) out.push_back(cellEntries[e]);
+                }
+            }
+        }
+    }
+
+private:
+    void build (float requestedCellSize) {
+        int n = bounds.size();
+        area = n ? bounds[0] : BoundingBox();
+        float averageExtent = 0;
+        for (auto& box : bounds) {
+            area.include(box);
+            averageExtent += box.extent().maxCoeff() / n;
+        }
+
+        float areaExtent = area.extent().maxCoeff();
+        cellSize = requestedCellSize;
+        if (cellSize <= 0) cellSize = averageExtent;
+        if (cellSize <= 0) cellSize = areaExtent / std::sqrt(float(std::max(1, n)));
+        if (cellSize <= 0) cellSize = 1;
+
+        // never more than a few cells per segment, counted in float until they fit an int
+        while (true) {
+            float columnCount = std::floor(area.extent()[0] / cellSize) + 1;
+            float rowCount = std::floor(area.extent()[1] / cellSize) + 1;
+            if (columnCount * rowCount <= 4.0f * std::max(1, n)) {
+                columns = int(columnCount);
+                rows = int(rowCount);
+                break;
+            }
+            cellSize *= 2;
+        }
+
+        // counting sort of (cell, segment) entries into the flat array
+        cellStarts.assign(columns * rows + 1, 0);
+        for (auto& box : bounds) {
+            for (int row = cellRow(box.min[1]); row <= cellRow(box.max[1]); row++) {
+                for (int column = cellColumn(box.min[0]); column <= cellColumn(box.max[0]); column++) {
+                    cellStarts[row * columns + column + 1]++;
+                }
+            }
+        }
+        for (int cell = 0; cell < columns * rows; cell++) cellStarts[cell + 1] += cellStarts[cell];
+
+        cellEntries.resize(cellStarts.back());
+        std::vector<int> fill(cellStarts.begin(), cellStarts.end() - 1);
+        for (int i = 0; i < n; i++) {
+            auto& box = bounds[i];
+            for (int row = cellRow(box.min[1]); row <= cellRow(box.max[1]); row++) {
+                for (int column = cellColumn(box.min[0]); column <= cellColumn(box.max[0]); column++) {
+                    cellEntries[fill[row * columns + column]++] = i;
+                }
+            }
+        }
+    }
+};
+
+#endif //COMPASS_SEGMENT_GRID_H
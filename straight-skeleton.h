@@ -0,0 +1,356 @@
+#ifndef COMPASS_STRAIGHT_SKELETON_H
+#define COMPASS_STRAIGHT_SKELETON_H
+
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <initializer_list>
+#include <cmath>
+#include <cfloat>
+#include "primitives.h"
+#include "intersections.h"
+#include "predicates.h"
+#include "work-stealing-pool.h"
+
+// A node of a straight skeleton, its height is the offset distance at which
+// the shrinking polygon reaches it, which is also its height on a 45 degree roof
+struct SkeletonNode {
+    vec2 position;
+    float height;
+};
+
+// The first nodes are the polygon's own vertices, in order and at height 0,
+// every arc goes from a lower node to the node it runs into
+struct StraightSkeleton {
+    std::vector<SkeletonNode> nodes;
+    std::vector<std::pair<int, int>> arcs;
+};
+
+// Computes straight skeletons of simple polygons without holes, given counter-clockwise,
+// following Felkel & Obdrzalek: the polygon shrinks by moving every vertex along the bisector
+// of its edges, events where a vertex meets a neighbour (edge events) or where a reflex vertex
+// runs into an opposite edge (split events) are processed in order of height from a priority queue.
+// Edges, vertices and the event heap are cleared but not freed between polygons, so building into
+// a StraightSkeleton that is reused as well doesn't allocate once they fit the biggest polygon.
+class StraightSkeletonBuilder {
+    struct Edge {
+        vec2 start;
+        vec2 direction;
+        vec2 normal;
+        float length;
+    };
+
+    // a vertex of a shrinking polygon, polygons are doubly linked cycles of these
+    struct Vertex {
+        // where it is at height, the height of the event that created it
+        vec2 position;
+        float height;
+        vec2 bisector;
+        // height gained per unit moved along the bisector, 0 between antiparallel edges
+        float rate;
+        int edgeIn;
+        int edgeOut;
+        int previous;
+        int next;
+        int node;
+        bool reflex;
+        bool valid;
+    };
+
+    enum EventKind {EDGE_EVENT, SPLIT_EVENT};
+
+    struct Event {
+        float height;
+        // how far the vertices move to get there, orders events at the same height
+        float travel;
+        int sequence;
+        EventKind kind;
+        vec2 position;
+        // the vertex and its next one for edge events, the vertex and the edge it runs into for split events
+        int vertex;
+        int other;
+    };
+
+    struct Later {
+        bool operator() (const Event& a, const Event& b) const {
+            return a.height > b.height || (a.height == b.height && a.sequence > b.sequence);
+        }
+    };
+
+    std::vector<Edge> edges;
+    std::vector<Vertex> vertices;
+    // a min heap by height, kept as a plain vector to keep its capacity between polygons
+    std::vector<Event> events;
+    std::vector<Event> simultaneous;
+    int eventSequence;
+    // thickness scaled to the size of the polygon, events and positions closer than this coincide
+    float tolerance;
+    // no vertex moves further than this inside the polygon
+    float diameter;
+    StraightSkeleton* skeleton;
+
+public:
+    void build (const std::vector<vec2>& polygon, StraightSkeleton& out) {
+        int n = polygon.size();
+        skeleton = &out;
+        out.nodes.clear();
+        out.arcs.clear();
+        edges.clear();
+        vertices.clear();
+        events.clear();
+        eventSequence = 0;
+
+        // work relative to the first vertex, for precision far from the origin
+        vec2 origin = n ? polygon[0] : vec2(0, 0);
+        float extent = 0;
+        for (auto& point : polygon) extent = std::max(extent, (point - origin).norm());
+        tolerance = thickness / 8 * extent;
+        diameter = 2 * extent;
+        for (int i = 0; i < n; i++) {
+            vec2 vector = polygon[(i + 1) % n] - polygon[i];
+            vec2 direction = vector.normalized();
+            edges.push_back({polygon[i] - origin, direction, vec2(-direction[1], direction[0]), vector.norm()});
+            out.nodes.push_back({polygon[i] - origin, 0});
+        }
+        for (int i = 0; i < n; i++) {
+            vertices.push_back(makeVertex(polygon[i] - origin, 0, (i + n - 1) % n, i, (i + n - 1) % n, (i + 1) % n, i));
+        }
+        for (int i = 0; i < n; i++) {
+            addEdgeEvent(i, vertices[i].next);
+            if (vertices[i].reflex) addSplitEvents(i);
+        }
+
+        float reached = 0;
+        while (!events.empty()) {
+            // Events at the same height (each within tolerance of the next) happen together, splits first, since the
+            // new vertices of one split can run along the collapsed wavefront of another. Vertices
+            // between antiparallel edges move without gaining height, so nearer events go first.
+            // Rounding can put an event below the height already reached, it happens there instead.
+            simultaneous.clear();
+            while (!events.empty() && (simultaneous.empty()
+                                       || events.front().height <= simultaneous.back().height + tolerance)) {
+                std::pop_heap(events.begin(), events.end(), Later());
+                simultaneous.push_back(events.back());
+                simultaneous.back().height = std::max(simultaneous.back().height, reached);
+                events.pop_back();
+            }
+            reached = simultaneous.back().height;
+            std::sort(simultaneous.begin(), simultaneous.end(), [](const Event& a, const Event& b) {
+                if (a.kind != b.kind) return a.kind == SPLIT_EVENT;
+                return a.travel < b.travel || (a.travel == b.travel && a.sequence < b.sequence);
+            });
+            for (auto& event : simultaneous) {
+                if (event.kind == SPLIT_EVENT) handleSplitEvent(event);
+                else handleEdgeEvent(event);
+            }
+        }
+
+        for (auto& node : out.nodes) node.position += origin;
+    }
+
+private:
+    Vertex makeVertex (vec2 position, float height, int edgeIn, int edgeOut, int previous, int next, int node) {
+        vec2 in = edges[edgeIn].direction, out = edges[edgeOut].direction;
+        // Between antiparallel edges (spikes, or opposite edges that met), move along the outgoing one.
+        // They are antiparallel if the shorter one ends within tolerance of the other's direction,
+        // rounding tilts short edges the most.
+        float longer = std::max(edges[edgeIn].length, edges[edgeOut].length);
+        bool antiparallel = in.dot(out) < 0
+                            && orientationWithin(vec2(0, 0), vec2(edges[edgeIn].length * in),
+                                                 vec2(edges[edgeOut].length * out), tolerance * longer);
+        vec2 bisector = antiparallel ? out : vec2((edges[edgeIn].normal + edges[edgeOut].normal).normalized());
+        float rate = antiparallel ? 0 : edges[edgeIn].normal.dot(bisector);
+        bool reflex = !antiparallel && orientation(vec2(0, 0), in, out) < 0;
+        return {position, height, bisector, rate, edgeIn, edgeOut, previous, next, node, reflex, true};
+    }
+
+    vec2 positionAt (int v, float height) {
+        auto& vertex = vertices[v];
+        return vertex.rate > 0 ? vec2(vertex.position + (height - vertex.height) / vertex.rate * vertex.bisector)
+                               : vertex.position;
+    }
+
+    void pushEvent (Event event) {
+        events.push_back(event);
+        std::push_heap(events.begin(), events.end(), Later());
+    }
+
+    float distanceToLine (int edge, vec2 point) {
+        return edges[edge].normal.dot(point - edges[edge].start);
+    }
+
+    int addNode (vec2 position, float height) {
+        skeleton->nodes.push_back({position, height});
+        return skeleton->nodes.size() - 1;
+    }
+
+    // reuses the node of a vertex that is already at position, to avoid zero length arcs
+    int nodeAt (vec2 position, float height, std::initializer_list<int> meetingVertices) {
+        for (int v : meetingVertices) {
+            if ((skeleton->nodes[vertices[v].node].position - position).norm() < tolerance) return vertices[v].node;
+        }
+        return addNode(position, height);
+    }
+
+    void addArc (int from, int to) {
+        if (from != to) skeleton->arcs.push_back({from, to});
+    }
+
+    void addEdgeEvent (int a, int b) {
+        // vertices that are already at the same place, like the new vertex of a split at the end of
+        // the split edge, meet right away, their rays are (nearly) collinear and meet anywhere
+        float height = std::max(vertices[a].height, vertices[b].height);
+        vec2 atA = positionAt(a, height), atB = positionAt(b, height);
+        if ((atA - atB).norm() <= tolerance) {
+            vec2 position = vertices[a].height >= vertices[b].height ? atA : atB;
+            pushEvent({height, 0, eventSequence++, EDGE_EVENT, position, a, b});
+            return;
+        }
+
+        // Two vertices sweeping along a collapsed part of the wavefront run towards each other on the
+        // same line, or never meet. They meet after everything else at the height, whatever the
+        // vertex rising onto that line does decides where the collapsed part ends.
+        if (vertices[a].rate == 0 && vertices[b].rate == 0) {
+            vec2 start = vertices[a].position;
+            if (!orientationWithin(start, vec2(start + vertices[a].bisector), vertices[b].position, tolerance)) return;
+            pushEvent({height, FLT_MAX, eventSequence++, EDGE_EVENT, vertices[b].position, a, b});
+            return;
+        }
+
+        Ray rayA(vertices[a].position, vertices[a].bisector);
+        Ray rayB(vertices[b].position, vertices[b].bisector);
+        auto intersections = intersect(rayA, rayB);
+        if (intersections.size() == 0) return;
+
+        vec2 position = intersections[0].position;
+        float travel = (position - vertices[a].position).norm() + (position - vertices[b].position).norm();
+        pushEvent({distanceToLine(vertices[a].edgeOut, position), travel, eventSequence++, EDGE_EVENT, position, a, b});
+    }
+
+    // A reflex vertex moves towards the lines of all other edges, the point where it's as far from
+    // an edge's line as from its own edges' lines is a split candidate, validated when it's due
+    void addSplitEvents (int v) {
+        auto& vertex = vertices[v];
+        float height = distanceToLine(vertex.edgeIn, vertex.position);
+
+        for (int e = 0; e < edges.size(); e++) {
+            if (e == vertex.edgeIn || e == vertex.edgeOut) continue;
+            // candidates further than across the polygon are never due, nearly parallel lines included
+            float closingRate = vertex.rate - edges[e].normal.dot(vertex.bisector);
+            float gap = distanceToLine(e, vertex.position) - height;
+            if (gap < 0 || gap >= closingRate * diameter) continue;
+            // a vertex that is already on the line splits right where it is
+            float along = gap / closingRate > tolerance ? gap / closingRate : 0;
+
+            vec2 position = vertex.position + along * vertex.bisector;
+            pushEvent({height + along * vertex.rate, along, eventSequence++, SPLIT_EVENT, position, v, e});
+        }
+    }
+
+    void addEvents (int v) {
+        addEdgeEvent(vertices[v].previous, v);
+        addEdgeEvent(v, vertices[v].next);
+        if (vertices[v].reflex) addSplitEvents(v);
+    }
+
+    void handleEdgeEvent (Event& event) {
+        Vertex& a = vertices[event.vertex];
+        Vertex& b = vertices[event.other];
+        if (!a.valid || !b.valid || a.next != event.other) return;
+
+        // the last triangle of this polygon shrinks to a point
+        bool triangle = a.previous == b.next;
+        int node = nodeAt(event.position, event.height, {event.vertex, event.other, a.previous});
+        addArc(a.node, node);
+        addArc(b.node, node);
+        a.valid = false;
+        b.valid = false;
+
+        if (a.previous == event.other) return;
+
+        if (triangle) {
+            Vertex& c = vertices[a.previous];
+            addArc(c.node, node);
+            c.valid = false;
+            return;
+        }
+
+        int merged = vertices.size();
+        vertices.push_back(makeVertex(event.position, event.height, a.edgeIn, b.edgeOut, a.previous, b.next, node));
+        vertices[vertices[merged].previous].next = merged;
+        vertices[vertices[merged].next].previous = merged;
+        addEvents(merged);
+    }
+
+    void handleSplitEvent (Event& event) {
+        int v = event.vertex;
+        if (!vertices[v].valid) return;
+
+        // find the part of the opposite edge whose area contains the event, among the current polygon
+        int before = -1;
+        for (int y = vertices[v].next; vertices[y].next != v; y = vertices[y].next) {
+            int x = vertices[y].next;
+            if (vertices[y].edgeOut != event.other) continue;
+            bool afterStart = cross(vertices[y].bisector, vec2(event.position - vertices[y].position)) <= tolerance;
+            bool beforeEnd = cross(vertices[x].bisector, vec2(event.position - vertices[x].position)) >= -tolerance;
+            if (afterStart && beforeEnd) {
+                before = y;
+                break;
+            }
+        }
+        if (before == -1) return;
+        int after = vertices[before].next;
+
+        Vertex vertex = vertices[v];
+        vertices[v].valid = false;
+        int node = nodeAt(event.position, event.height, {v});
+        addArc(vertex.node, node);
+
+        // one polygon continues from the previous vertex over the opposite edge, the other from it
+        int first = vertices.size();
+        int second = first + 1;
+        vec2 position = event.position;
+        float height = event.height;
+        vertices.push_back(makeVertex(position, height, vertex.edgeIn, event.other, vertex.previous, after, node));
+        vertices.push_back(makeVertex(position, height, event.other, vertex.edgeOut, before, vertex.next, node));
+        vertices[vertices[first].previous].next = first;
+        vertices[after].previous = first;
+        vertices[before].next = second;
+        vertices[vertices[second].next].previous = second;
+
+        for (int split : {first, second}) {
+            if (vertices[split].next == vertices[split].previous) {
+                // only two vertices left, they are connected directly
+                int other = vertices[split].next;
+                addArc(vertices[other].node, node);
+                vertices[split].valid = false;
+                vertices[other].valid = false;
+            } else {
+                addEvents(split);
+            }
+        }
+    }
+};
+
+StraightSkeleton straightSkeleton (const std::vector<vec2>& polygon) {
+    StraightSkeleton skeleton;
+    StraightSkeletonBuilder().build(polygon, skeleton);
+    return skeleton;
+}
+
+// BATCHED
+
+// Polygons per task of straightSkeletons, about a millisecond of building footprints
+const int SKELETONS_PER_TASK = 256;
+
+// Straight skeletons of many independent polygons on the threads of pool, out[i] belongs to polygons[i]
+void straightSkeletons (const std::vector<std::vector<vec2>>& polygons, std::vector<StraightSkeleton>& out,
+                        WorkStealingPool& pool) {
+    out.resize(polygons.size());
+    pool.runRanges(polygons.size(), SKELETONS_PER_TASK, [&](int begin, int end) {
+        StraightSkeletonBuilder builder;
+        for (int i = begin; i < end; i++) builder.build(polygons[i], out[i]);
+    });
+}
+
+#endif //COMPASS_STRAIGHT_SKELETON_H
@@ -0,0 +1,167 @@
+#ifndef COMPASS_TESSELLATION_H
+#define COMPASS_TESSELLATION_H
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include "primitives.h"
+#include "work-stealing-pool.h"
+
+// Upper limit for the chords of one arc, for tolerances far below float precision
+const int MAX_ARC_CHORDS = 1 << 16;
+
+// How many equal chords an arc needs so that none is further than maxError from the arc.
+// A chord spanning the angle a is r (1 - cos(a / 2)) away from the arc at its middle,
+// so each chord can span at most 2 acos(1 - maxError / r). Lines need one.
+// That is computed as 4 asin(sqrt(maxError / 2r)) instead, 1 - maxError / r rounds to 1
+// for large radii and acos would leave nothing of the angle.
+int chordCount (Segment& segment, float maxError) {
+    if (segment.isStraight()) return 1;
+    double maxChordAngle = 4 * std::asin(std::sqrt(std::min(1.0, double(maxError) / (2 * double(segment.radius())))));
+    if (!(maxChordAngle > 0)) return MAX_ARC_CHORDS;
+    return std::min(MAX_ARC_CHORDS, std::max(1, int(std::ceil(segment.angleSpan() / maxChordAngle))));
+}
+
+// Writes the chordCount(segment, maxError) + 1 vertices of the polyline of segment to out, from
+// start to end. Arc vertices come from rotating the previous one by a fixed step around the center,
+// which only needs one sin and cos per arc, the last one is the exact end.
+void tessellateInto (Segment& segment, float maxError, vec2* out) {
+    int chords = chordCount(segment, maxError);
+    out[0] = segment.start;
+    if (!segment.isStraight()) {
+        // in double, since rounding errors of the rotation add up over the steps
+        double step = std::copysign(1.0, segment.signedRadius()) * segment.angleSpan() / chords;
+        double cosine = std::cos(step), sine = std::sin(step);
+        vec2 center = segment.radialCenter();
+        vec2d fromCenter = (segment.start - center).cast<double>();
+        for (int i = 1; i < chords; i++) {
+            fromCenter = vec2d(cosine * fromCenter[0] - sine * fromCenter[1], sine * fromCenter[0] + cosine * fromCenter[1]);
+            out[i] = center + fromCenter.cast<float>();
+        }
+    }
+    out[chords] = segment.end;
+}
+
+// Appends the polyline of segment to out, see tessellateInto
+void tessellate (Segment& segment, float maxError, std::vector<vec2>& out) {
+    int first = out.size();
+    out.resize(first + chordCount(segment, maxError) + 1);
+    tessellateInto(segment, maxError, out.data() + first);
+}
+
+// CACHE
+
+// Remembers polylines of segments, so segments drawn every frame are only tessellated once.
+// Segments are identified by their defining points and direction, together with the tolerance.
+// Polylines are kept in one growing buffer until clear().
+class TessellationCache {
+    struct Key {
+        float fields[7];
+
+        bool operator== (const Key& other) const {
+            return std::memcmp(fields, other.fields, sizeof(fields)) == 0;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator() (const Key& key) const {
+            uint32_t bits[7];
+            std::memcpy(bits, key.fields, sizeof(bits));
+            size_t hash = 0;
+            for (uint32_t b : bits) hash = hash * 0x9E3779B1u + b;
+            return hash;
+        }
+    };
+
+    struct Entry {
+        int first;
+        int count;
+    };
+
+    std::unordered_map<Key, Entry, KeyHash> entries;
+    std::vector<vec2> vertices;
+
+public:
+    long hits = 0;
+    long misses = 0;
+
+    // The polyline of segment, which stays valid until the next call or clear()
+    const vec2* polyline (Segment& segment, float maxError, int& count) {
+        Key key = {{segment.start[0], segment.start[1], segment.direction[0], segment.direction[1],
+                    segment.end[0], segment.end[1], maxError}};
+        auto found = entries.find(key);
+        if (found != entries.end()) {
+            hits++;
+            count = found->second.count;
+            return vertices.data() + found->second.first;
+        }
+
+        misses++;
+        int first = vertices.size();
+        ::tessellate(segment, maxError, vertices);
+        count = vertices.size() - first;
+        entries.emplace(key, Entry{first, count});
+        return vertices.data() + first;
+    }
+
+    // Appends the polyline of segment to out, like tessellate
+    void tessellate (Segment& segment, float maxError, std::vector<vec2>& out) {
+        int count;
+        const vec2* cached = polyline(segment, maxError, count);
+        out.insert(out.end(), cached, cached + count);
+    }
+
+    int size () const {
+        return entries.size();
+    }
+
+    void clear () {
+        entries.clear();
+        vertices.clear();
+    }
+};
+
+// BATCHED
+
+// The polylines of many segments in one contiguous buffer, the polyline of segment i is
+// vertices[starts[i]] ... vertices[starts[i + 1] - 1]
+struct Tessellation {
+    std::vector<vec2> vertices;
+    std::vector<int> starts;
+
+    int polylineSize (int i) const {
+        return starts[i + 1] - starts[i];
+    }
+};
+
+// Counts all vertices first, so the buffer is sized once and every polyline is written in place
+void tessellateAll (std::vector<Segment>& segments, float maxError, Tessellation& out) {
+    out.starts.resize(segments.size() + 1);
+    out.starts[0] = 0;
+    for (int i = 0; i < segments.size(); i++) out.starts[i + 1] = out.starts[i] + chordCount(segments[i], maxError) + 1;
+    out.vertices.resize(out.starts.back());
+    for (int i = 0; i < segments.size(); i++) tessellateInto(segments[i], maxError, out.vertices.data() + out.starts[i]);
+}
+
+// Segments per task of the parallel tessellateAll, just under a millisecond even if all of them are arcs
+const int TESSELLATION_SEGMENTS_PER_TASK = 4096;
+
+// tessellateAll on the threads of pool, with the same result
+void tessellateAll (std::vector<Segment>& segments, float maxError, Tessellation& out, WorkStealingPool& pool) {
+    out.starts.resize(segments.size() + 1);
+    out.starts[0] = 0;
+    pool.runRanges(segments.size(), TESSELLATION_SEGMENTS_PER_TASK, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) out.starts[i + 1] = chordCount(segments[i], maxError) + 1;
+    });
+    for (int i = 0; i < segments.size(); i++) out.starts[i + 1] += out.starts[i];
+
+    out.vertices.resize(out.starts.back());
+    pool.runRanges(segments.size(), TESSELLATION_SEGMENTS_PER_TASK, [&](int begin, int end) {
+        for (int i = begin; i < end; i++) tessellateInto(segments[i], maxError, out.vertices.data() + out.starts[i]);
+    });
+}
+
+#endif //COMPASS_TESSELLATION_H
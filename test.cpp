@@ -8,6 +8,23 @@
 #include "intersections.h"
 #include "whiteboard/whiteboard.h"
 #include "whiteboard-compass.h"
+#include "segment-batch.h"
+#include "intersect-all.h"
+#include "clipper.h"
+#include "primitive-dispatch.h"
+#include "predicates.h"
+#include "fixed-point.h"
+#include "intersection-graph.h"
+#include "straight-skeleton.h"
+#include "segment-bvh.h"
+#include "segment-file.h"
+#include "tessellation.h"
+#include "buffer.h"
+#include "overlap.h"
+#include <atomic>
+#include <random>
+#include <sstream>
+#include <thread>
 
 typedef Eigen::Vector2f vec2;
 
@@ -83,6 +100,44 @@ auto whiteboard = wb::draw(std::cout);
 //    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(0.5, 1.0), pieces[1].end);
 //}
 
+TEST(CompassPrimitives, ClockwiseArcSegmentDirectionOf) {
+    auto a = Segment({0, 1}, {1, 0}, {1, 0});
+
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(0, 0), a.radialCenter());
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(0.707107, -0.707107), a.directionOf(0.5 * a.length()));
+    EXPECT_VECTOR_ROUGHLY_EQUAL(a.endDirection(), a.directionOf(a.length()));
+}
+
+TEST(CompassPrimitives, ArcSegmentMidpointBeyondHalfCircle) {
+    auto a = Segment({1, 0}, {0, 1}, {0, -1});
+
+    EXPECT_NEAR(1.5 * M_PI, a.length(), PRECISION);
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(-0.707107, 0.707107), a.midpoint());
+}
+
+TEST(CompassPrimitives, CompactSegmentMatchesSegment) {
+    std::vector<Segment> segments = {
+        Segment({0, 0}, {1, 1}),
+        Segment({1, 0}, {0, 1}, {0, 1}),
+        Segment({0, 1}, {1, 0}, {1, 0}),
+        Segment({1, 0}, {0, 1}, {0, -1})
+    };
+    std::vector<vec2> points = {{0.5, 0.5}, {2, 0}, {-1, -0.3}, {0, 1.5}, {0.3, -0.9}, {0.9, 0.2}};
+
+    for (auto& segment : segments) {
+        auto compact = CompactSegment(segment);
+        EXPECT_EQ(segment.isStraight(), compact.isStraight());
+        EXPECT_NEAR(segment.length(), compact.length(), PRECISION);
+        EXPECT_VECTOR_ROUGHLY_EQUAL(segment.midpoint(), compact.midpoint());
+        EXPECT_VECTOR_ROUGHLY_EQUAL(segment.directionOf(0.3 * segment.length()), compact.directionOf(0.3 * segment.length()));
+
+        for (auto& point : points) {
+            EXPECT_NEAR(segment.offsetAt(point), compact.offsetAt(point), PRECISION);
+            EXPECT_NEAR(segment.distanceTo(point), compact.distanceTo(point), PRECISION);
+        }
+    }
+}
+
 // CIRCLE-CIRCLE
 
 TEST(CompassIntersections, CircleCircleIntersection) {
@@ -513,6 +568,1817 @@ TEST(CompassIntersections, ArcSegmentArcSegmentIntersection2) {
     EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(0.5, 1 - 0.0669872984290123), i[1].position);
 }
 
+// DOUBLE PRECISION
+
+// 20 km from the origin, where float only has millimeters left
+const vec2d FAR_AWAY(20000, 20000);
+
+TEST(CompassDoublePrecision, LineSegmentLineSegmentFarFromOrigin) {
+    auto a = Segmentd(FAR_AWAY + vec2d(0, 0), FAR_AWAY + vec2d(1, 1));
+    auto b = Segmentd(FAR_AWAY + vec2d(0, 1), FAR_AWAY + vec2d(1, 0));
+    auto i = intersect(a, b);
+
+    ASSERT_EQ(1, i.size());
+    EXPECT_NEAR(FAR_AWAY[0] + 0.5, i[0].position[0], 1e-9);
+    EXPECT_NEAR(FAR_AWAY[1] + 0.5, i[0].position[1], 1e-9);
+    EXPECT_NEAR(0.5 * a.length(), i[0].alongA, 1e-9);
+    EXPECT_NEAR(0.5 * b.length(), i[0].alongB, 1e-9);
+}
+
+TEST(CompassDoublePrecision, ArcLineSegmentFarFromOrigin) {
+    auto arc = Segmentd(FAR_AWAY + vec2d(1, 0), vec2d(0, 1), FAR_AWAY + vec2d(-1, 0));
+    auto line = Segmentd(FAR_AWAY + vec2d(0.5, -1), FAR_AWAY + vec2d(0.5, 2));
+    auto i = intersect(arc, line);
+
+    ASSERT_EQ(1, i.size());
+    EXPECT_NEAR(FAR_AWAY[0] + 0.5, i[0].position[0], 1e-9);
+    EXPECT_NEAR(FAR_AWAY[1] + std::sqrt(0.75), i[0].position[1], 1e-9);
+    EXPECT_NEAR(M_PI / 3, i[0].alongA, 1e-7);
+    EXPECT_NEAR(1 + std::sqrt(0.75), i[0].alongB, 1e-9);
+}
+
+TEST(CompassDoublePrecision, CastKeepsShape) {
+    auto arc = Segment({1, 0}, {0, 1}, {-1, 0});
+    auto arcd = arc.cast<double>();
+
+    EXPECT_FALSE(arcd.isStraight());
+    EXPECT_NEAR(arc.length(), arcd.length(), PRECISION);
+    EXPECT_NEAR(arc.signedRadius(), arcd.signedRadius(), PRECISION);
+
+    auto ray = Rayd(FAR_AWAY, vec2d(1, 0));
+    auto circle = Circled(FAR_AWAY + vec2d(3, 0), 1);
+    EXPECT_EQ(2, intersect(ray, circle).size());
+    auto rayf = ray.cast<float>();
+    auto circlef = circle.cast<float>();
+    EXPECT_EQ(2, intersect(rayf, circlef).size());
+}
+
+// ANGLES
+
+TEST(CompassAngles, FastAtan2AndAcosWithinMaxError) {
+    const int n = 4099;
+    std::vector<float> ys(n), xs(n), cosines(n), atans(n), acoss(n);
+    for (int i = 0; i < n; i++) {
+        float angle = -M_PI + 2 * M_PI * i / (n - 1);
+        ys[i] = 3 * std::sin(angle);
+        xs[i] = 3 * std::cos(angle);
+        cosines[i] = -1 + 2.0f * i / (n - 1);
+    }
+    fastAtan2s(ys.data(), xs.data(), atans.data(), n);
+    fastAcoss(cosines.data(), acoss.data(), n);
+
+    for (int i = 0; i < n; i++) {
+        EXPECT_NEAR(std::atan2(ys[i], xs[i]), fastAtan2(ys[i], xs[i]), FAST_ANGLE_MAX_ERROR);
+        EXPECT_NEAR(fastAtan2(ys[i], xs[i]), atans[i], FAST_ANGLE_MAX_ERROR);
+        EXPECT_NEAR(std::acos(cosines[i]), fastAcos(cosines[i]), FAST_ANGLE_MAX_ERROR);
+        EXPECT_NEAR(fastAcos(cosines[i]), acoss[i], FAST_ANGLE_MAX_ERROR);
+    }
+    EXPECT_EQ(0, fastAtan2(0, 0));
+}
+
+TEST(CompassAngles, PseudoAnglesOrderLikeAngles) {
+    std::mt19937 generator(8);
+    std::uniform_real_distribution<float> angles(0, 2 * M_PI);
+    vec2 start(2, 0), counterClockwise(0, 1), clockwise(0, -1);
+
+    for (int i = 0; i < 1000; i++) {
+        float angleA = angles(generator), angleB = angles(generator);
+        vec2 a = 2 * vec2(std::cos(angleA), std::sin(angleA));
+        vec2 b = 2 * vec2(std::cos(angleB), std::sin(angleB));
+        if (std::abs(angleA - angleB) < 0.001f) continue;
+
+        EXPECT_EQ(angleA < angleB, diamondAngle<float>(a) < diamondAngle<float>(b));
+        for (vec2 direction : {counterClockwise, clockwise}) {
+            EXPECT_EQ(angleBetweenWithDirection(start, direction, a) < angleBetweenWithDirection(start, direction, b),
+                      pseudoAngleBetweenWithDirection<float>(start, direction, a)
+                      < pseudoAngleBetweenWithDirection<float>(start, direction, b));
+        }
+    }
+}
+
+// PREDICATES
+
+// counts only exist when compiled with COMPASS_INSTRUMENTATION
+long counted (long n) {
+    return INSTRUMENTATION ? n : 0;
+}
+
+TEST(CompassPredicates, OrientationSigns) {
+    EXPECT_GT(orientation<double>({0, 0}, {1, 0}, {0, 1}), 0);
+    EXPECT_LT(orientation<double>({0, 0}, {0, 1}, {1, 0}), 0);
+    EXPECT_EQ(0, orientation<float>({1, 1}, {3, 3}, {7, 7}));
+}
+
+TEST(CompassPredicates, OrientationNearlyCollinear) {
+    // the exact determinant is 2^-47, below the error bound of plain double arithmetic
+    double offset = std::ldexp(1.0, -48);
+    auto before = threadInstrumentation();
+
+    EXPECT_EQ(std::ldexp(1.0, -47), orientation<double>({1, 1}, {3, 3}, {7, 7 + offset}));
+    EXPECT_EQ(-std::ldexp(1.0, -47), orientation<double>({1, 1}, {3, 3}, {7, 7 - offset}));
+    auto counts = threadInstrumentation() - before;
+    EXPECT_EQ(counted(2), counts[ORIENTATION_CALLS]);
+    EXPECT_EQ(counted(2), counts[ORIENTATION_ESCALATIONS]);
+}
+
+TEST(CompassPredicates, InCircle) {
+    vec2d a(1, 0), b(0, 1), c(-1, 0);
+    auto before = threadInstrumentation();
+
+    EXPECT_GT(inCircle<double>(a, b, c, {0, 0}), 0);
+    EXPECT_LT(inCircle<double>(a, b, c, {2, 0}), 0);
+    EXPECT_EQ(0, (threadInstrumentation() - before)[IN_CIRCLE_ESCALATIONS]);
+
+    EXPECT_EQ(0, inCircle<double>(a, b, c, {0, -1}));
+    EXPECT_GT(inCircle<double>(a, b, c, {0, -1 + std::ldexp(1.0, -52)}), 0);
+    auto counts = threadInstrumentation() - before;
+    EXPECT_EQ(counted(4), counts[IN_CIRCLE_CALLS]);
+    EXPECT_GE(counts[IN_CIRCLE_ESCALATIONS], counted(1));
+}
+
+TEST(CompassPredicates, LineLineParallelDecidedExactly) {
+    // not axis aligned, so the determinant of the directions is rounded
+    vec2 direction = vec2(3, 7).normalized();
+    EXPECT_EQ(0, intersect(Line({0, 0}, direction), Line({1, 0}, direction)).size());
+    EXPECT_EQ(0, intersect(Lined({0, 0}, vec2d(3, 7).normalized()), Lined({1, 0}, vec2d(3, 7).normalized())).size());
+    EXPECT_EQ(1, intersect(Line({0, 0}, direction), Line({1, 0}, vec2(7, 3).normalized())).size());
+}
+
+TEST(CompassPredicates, DoubleParallelDecidedExactlyAtTolerance) {
+    // a = (0.5, ay), b = (bx, by) on a grid of 2^-52 and 2^-53, so the exact determinant
+    // bx * ay - by * a.x is an integer in units of 2^-104, and by is picked to put it within
+    // a few ulps of the tolerance, where the rounded determinant can land on either side
+    const double tolerance = Tolerances<double>::rough();
+    const __int128 limit = __int128(std::ldexp(tolerance, 104));
+    std::mt19937_64 generator(31);
+    std::uniform_int_distribution<long long> significand(1ll << 51, (1ll << 51) + (1ll << 49));
+    std::uniform_int_distribution<long long> nudge(-(1ll << 10), 1ll << 10);
+
+    int nearlyParallel = 0;
+    for (int i = 0; i < 20000; i++) {
+        long long ay = significand(generator), bx = significand(generator);
+        __int128 target = limit + __int128(nudge(generator)) * (__int128(1) << 40);
+        long long by = (long long)((__int128(bx) * ay - target) >> 50);
+        __int128 det = __int128(bx) * ay - (__int128(by) << 50);
+
+        vec2d a(0.5, std::ldexp(double(ay), -52)), b(std::ldexp(double(bx), -52), std::ldexp(double(by), -53));
+        bool exactlyWithin = (det < 0 ? -det : det) <= limit;
+        nearlyParallel += exactlyWithin;
+        ASSERT_EQ(exactlyWithin, roughlyParallel(a, b)) << i;
+    }
+    EXPECT_GT(nearlyParallel, 1000);
+    EXPECT_LT(nearlyParallel, 19000);
+}
+
+// SEGMENT BATCH
+
+std::vector<Segment> randomSegments (int n, unsigned int seed) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<float> coordinate(0, 1);
+    std::vector<Segment> segments;
+    for (int i = 0; i < n; i++) {
+        vec2 start(coordinate(generator), coordinate(generator));
+        vec2 end(coordinate(generator), coordinate(generator));
+        if (i % 3 == 0) {
+            vec2 direction = vec2(coordinate(generator) - 0.5f, coordinate(generator) - 0.5f).normalized();
+            segments.push_back(Segment(start, direction, end));
+        } else {
+            segments.push_back(Segment(start, end));
+        }
+    }
+    return segments;
+}
+
+bool sameFloat (float a, float b) {
+    return a == b || (std::isnan(a) && std::isnan(b));
+}
+
+TEST(CompassSegmentBatch, IntersectManyMatchesScalar) {
+    auto segmentsA = randomSegments(61, 1);
+    auto segmentsB = randomSegments(45, 2);
+    auto batchA = SegmentBatch(segmentsA);
+    auto batchB = SegmentBatch(segmentsB);
+
+    std::vector<BatchIntersection> batched;
+    intersectMany(batchA, batchB, batched);
+
+    int n = 0;
+    for (int a = 0; a < segmentsA.size(); a++) {
+        for (int b = 0; b < segmentsB.size(); b++) {
+            auto intersections = intersect(segmentsA[a], segmentsB[b]);
+            for (auto& i : intersections) {
+                ASSERT_LT(n, batched.size());
+                EXPECT_EQ(a, batched[n].indexA);
+                EXPECT_EQ(b, batched[n].indexB);
+                EXPECT_TRUE(sameFloat(i.alongA, batched[n].alongA));
+                EXPECT_TRUE(sameFloat(i.alongB, batched[n].alongB));
+                EXPECT_TRUE(sameFloat(i.position[0], batched[n].position[0]));
+                EXPECT_TRUE(sameFloat(i.position[1], batched[n].position[1]));
+                n++;
+            }
+        }
+    }
+
+    EXPECT_EQ(n, batched.size());
+    EXPECT_LT(0, n);
+}
+
+TEST(CompassSegmentBatch, RestoresSegments) {
+    auto segments = randomSegments(40, 3);
+    // offset segments whose direction isn't exactly that of end - start
+    for (int i = 0; i < 10; i++) segments.push_back(segments[i].offsetBy(0.013));
+    auto batch = SegmentBatch(segments);
+
+    for (int i = 0; i < segments.size(); i++) {
+        auto segment = batch.segment(i);
+        EXPECT_EQ(segments[i].start, segment.start);
+        EXPECT_EQ(segments[i].end, segment.end);
+        EXPECT_EQ(segments[i].direction, segment.direction);
+        EXPECT_EQ(segments[i].lengthAndStraightInfo(), segment.lengthAndStraightInfo());
+        EXPECT_EQ(segments[i].radialCenter(), segment.radialCenter());
+        EXPECT_EQ(segments[i].signedRadius(), segment.signedRadius());
+        EXPECT_EQ(segments[i].startAngle(), segment.startAngle());
+        EXPECT_EQ(segments[i].angleSpan(), segment.angleSpan());
+    }
+}
+
+TEST(CompassSegmentBatch, IntersectManyTips) {
+    std::vector<Segment> segmentsA = {Segment({0, 0}, {1, 1}), Segment({0, 0.5}, {1, 0.5})};
+    std::vector<Segment> segmentsB = {Segment({1, 1}, {1, 0}), Segment({0.5, 0.5}, {1, 0.5})};
+    auto batchA = SegmentBatch(segmentsA);
+    auto batchB = SegmentBatch(segmentsB);
+
+    std::vector<BatchIntersection> batched;
+    intersectMany(batchA, batchB, batched);
+
+    ASSERT_EQ(3, batched.size());
+
+    EXPECT_EQ(0, batched[0].indexA);
+    EXPECT_EQ(0, batched[0].indexB);
+    EXPECT_NEAR(segmentsA[0].length(), batched[0].alongA, PRECISION);
+    EXPECT_NEAR(0, batched[0].alongB, PRECISION);
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(1, 1), batched[0].position);
+
+    EXPECT_EQ(0, batched[1].indexA);
+    EXPECT_EQ(1, batched[1].indexB);
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(0.5, 0.5), batched[1].position);
+
+    EXPECT_EQ(1, batched[2].indexA);
+    EXPECT_EQ(0, batched[2].indexB);
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(1, 0.5), batched[2].position);
+}
+
+// INTERSECT ALL
+
+TEST(CompassIntersectAll, ArcBounds) {
+    auto quarter = Segment({1, 0}, {0, 1}, {0, 1});
+    auto box = boundsOf(quarter);
+
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(0, 0), box.min);
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(1, 1), box.max);
+
+    auto half = Segment({1, 0}, {0, 1}, {-1, 0});
+    box = boundsOf(half);
+
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(-1, 0), box.min);
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(1, 1), box.max);
+}
+
+TEST(CompassIntersectAll, GridQueryFarOutside) {
+    auto segments = randomSegments(50, 6);
+    SegmentGrid grid(segments);
+    std::vector<int> found;
+    grid.query(BoundingBox({-3e12, -3e12}, {-2e12, -2e12}), found);
+    grid.query(BoundingBox({2e12, 2e12}, {3e12, 3e12}), found);
+    EXPECT_TRUE(found.empty());
+
+    // covering the whole grid from far away finds every segment
+    grid.query(BoundingBox({-3e12, -3e12}, {3e12, 3e12}), found);
+    std::sort(found.begin(), found.end());
+    found.erase(std::unique(found.begin(), found.end()), found.end());
+    EXPECT_EQ(segments.size(), found.size());
+}
+
+void expectSameAsNestedLoop (std::vector<Segment>& segments, std::vector<BatchIntersection> results) {
+    int n = 0;
+    for (int a = 0; a < segments.size(); a++) {
+        for (int b = a + 1; b < segments.size(); b++) {
+            auto intersections = intersect(segments[a], segments[b]);
+            for (auto& i : intersections) {
+                ASSERT_LT(n, results.size());
+                EXPECT_EQ(a, results[n].indexA);
+                EXPECT_EQ(b, results[n].indexB);
+                EXPECT_TRUE(sameFloat(i.alongA, results[n].alongA));
+                EXPECT_TRUE(sameFloat(i.alongB, results[n].alongB));
+                n++;
+            }
+        }
+    }
+
+    EXPECT_EQ(n, results.size());
+    EXPECT_LT(0, n);
+}
+
+TEST(CompassIntersectAll, GridMatchesNestedLoop) {
+    auto segments = randomSegments(150, 3);
+    expectSameAsNestedLoop(segments, intersectAll(segments, GRID));
+}
+
+TEST(CompassIntersectAll, SweepLineMatchesNestedLoop) {
+    auto segments = randomSegments(150, 4);
+    expectSameAsNestedLoop(segments, intersectAll(segments, SWEEP_LINE));
+}
+
+TEST(CompassIntersectAll, ParallelMatchesNestedLoopForAnyThreadCount) {
+    auto segments = randomSegments(150, 5);
+    for (int threadCount : {1, 2, 3, 8}) {
+        expectSameAsNestedLoop(segments, intersectAllParallel(segments, threadCount));
+    }
+}
+
+TEST(CompassIntersectAll, ReusedPoolRunsEveryTaskOnce) {
+    // the helper threads stay between runs, whether a run needs all of them or not
+    WorkStealingPool pool(4);
+    for (int round = 0; round < 200; round++) {
+        int taskCount = round % 7 == 0 ? 0 : round % 5 == 0 ? 1 : round % 3 == 0 ? 3 : 100 + round;
+        std::vector<std::atomic<int>> calls(taskCount);
+        for (auto& count : calls) count = 0;
+        pool.run(taskCount, [&](int task) { calls[task]++; });
+        for (auto& count : calls) ASSERT_EQ(1, count);
+    }
+
+    auto segments = randomSegments(150, 5);
+    for (int run = 0; run < 3; run++) expectSameAsNestedLoop(segments, intersectAllParallel(segments, pool));
+}
+
+TEST(CompassIntersectAll, SinkMatchesIntersect) {
+    auto segments = randomSegments(60, 6);
+    for (auto& a : segments) {
+        for (auto& b : segments) {
+            auto intersections = intersect(a, b);
+            std::vector<Intersection> sunk;
+            intersectInto(a, b, [&](Intersection& i) { sunk.push_back(i); });
+
+            ASSERT_EQ(intersections.size(), sunk.size());
+            for (int k = 0; k < sunk.size(); k++) {
+                EXPECT_TRUE(sameFloat(intersections[k].alongA, sunk[k].alongA));
+                EXPECT_TRUE(sameFloat(intersections[k].alongB, sunk[k].alongB));
+                EXPECT_TRUE(sameFloat(intersections[k].position[0], sunk[k].position[0]));
+                EXPECT_TRUE(sameFloat(intersections[k].position[1], sunk[k].position[1]));
+            }
+        }
+    }
+}
+
+// what constrainToArc() decides, the slow way: contains() and offsetAt() each on their own
+bool keptOnArc (float& along, vec2 position, Segment& arc) {
+    if (!arc.contains(position)) return false;
+    along = std::min(std::max(arc.offsetAt(position), 0.0f), arc.length());
+    return true;
+}
+
+// arcs as full circles with offsets first, then filtered and remapped onto the arcs
+std::vector<Intersection> viaCircles (Segment& a, Segment& b) {
+    Circle circleA(a.radialCenter(), a.radius()), circleB(b.radialCenter(), b.radius());
+    Line lineA(a.start, a.direction), lineB(b.start, b.direction);
+    std::vector<Intersection> candidates;
+    if (a.isStraight()) for (auto& i : intersect(lineA, circleB)) candidates.push_back(i);
+    else if (b.isStraight()) for (auto& i : intersect(circleA, lineB)) candidates.push_back(i);
+    else for (auto& i : intersect(circleB, circleA)) candidates.push_back(i.swapped());
+
+    std::vector<Intersection> kept;
+    for (auto i : candidates) {
+        bool onA = a.isStraight() ? constrainToSegment(i, a) : keptOnArc(i.alongA, i.position, a);
+        std::swap(i.alongA, i.alongB);
+        bool onB = b.isStraight() ? constrainToSegment(i, b) : keptOnArc(i.alongA, i.position, b);
+        std::swap(i.alongA, i.alongB);
+        if (onA && onB) kept.push_back(i);
+    }
+    return kept;
+}
+
+TEST(CompassIntersectAll, ArcKernelMatchesCircleRoundTrip) {
+    auto segments = randomSegments(90, 8);
+    int compared = 0;
+    for (auto& a : segments) {
+        for (auto& b : segments) {
+            if (a.isStraight() && b.isStraight()) continue;
+            auto intersections = intersect(a, b);
+            auto expected = viaCircles(a, b);
+
+            ASSERT_EQ(expected.size(), intersections.size());
+            for (int k = 0; k < expected.size(); k++) {
+                EXPECT_TRUE(sameFloat(expected[k].alongA, intersections[k].alongA));
+                EXPECT_TRUE(sameFloat(expected[k].alongB, intersections[k].alongB));
+                EXPECT_TRUE(sameFloat(expected[k].position[0], intersections[k].position[0]));
+                EXPECT_TRUE(sameFloat(expected[k].position[1], intersections[k].position[1]));
+                compared++;
+            }
+        }
+    }
+    EXPECT_GT(compared, 500);
+}
+
+TEST(CompassIntersectAll, IntoReusedBuffer) {
+    auto segments = randomSegments(150, 7);
+    std::vector<BatchIntersection> buffer;
+    buffer.reserve(4096);
+    auto capacity = buffer.capacity();
+
+    for (int call = 0; call < 2; call++) {
+        buffer.clear();
+        intersectAllInto(segments, std::back_inserter(buffer));
+        expectSameAsNestedLoop(segments, buffer);
+        EXPECT_EQ(capacity, buffer.capacity());
+    }
+
+    std::vector<BatchIntersection> fixed(buffer.size());
+    auto end = intersectAllInto(segments, fixed.data(), SWEEP_LINE);
+    EXPECT_EQ(fixed.data() + fixed.size(), end);
+    expectSameAsNestedLoop(segments, fixed);
+}
+
+// INSTRUMENTATION
+
+TEST(CompassInstrumentation, CountsEarlyOuts) {
+    Segment arc({0, 0}, {0, 1}, {2, 0});
+    Segment crossing({1, -2}, {1, 2});
+    Segment parallel({5, 0}, {5, 1});
+    Segment touching({3, 0}, {2.00002, 0});
+    Segment crossed({2, -1}, {2, 1});
+    Circle unit({0, 0}, 1), apart({5, 0}, 1), tangent({2, 0}, 1);
+    auto before = threadInstrumentation();
+
+    EXPECT_EQ(0, intersect(Line({0, 0}, {1, 0}), Line({0, 1}, {1, 0})).size());
+    EXPECT_EQ(0, intersect(unit, apart).size());
+    EXPECT_EQ(1, intersect(unit, tangent).size());
+    EXPECT_EQ(1, intersect(crossing, arc).size());
+    EXPECT_EQ(0, intersect(crossing, parallel).size());
+    // ends just short of the other one, within thickness
+    EXPECT_EQ(1, intersect(touching, crossed).size());
+    auto counts = threadInstrumentation() - before;
+
+    EXPECT_EQ(counted(2), counts[PARALLEL_LINES]);
+    EXPECT_EQ(counted(1), counts[SEPARATE_CIRCLES]);
+    EXPECT_EQ(counted(1), counts[TANGENT_CIRCLES]);
+    EXPECT_EQ(counted(1), counts[LINE_CIRCLE_CALLS]);
+    EXPECT_EQ(counted(3), counts[LINE_LINE_CALLS]);
+    EXPECT_EQ(counted(1), counts[SEGMENT_END_CLAMPED]);
+    EXPECT_EQ(0, counts[ARC_CONSTRUCTIONS]);
+    EXPECT_GE(counts[ARC_OFFSET_LOOKUPS], counted(1));
+}
+
+TEST(CompassInstrumentation, SumsUpThreads) {
+    auto segments = randomSegments(200, 91);
+    auto before = instrumentationSnapshot();
+    long sinkCalls = 0;
+    std::thread worker([&]() {
+        std::vector<BatchIntersection> intersections;
+        intersectAllInto(segments, std::back_inserter(intersections));
+        sinkCalls = threadInstrumentation()[SEGMENT_SINK_CALLS];
+    });
+    worker.join();
+    auto counts = instrumentationSnapshot() - before;
+
+    EXPECT_EQ(counted(sinkCalls), sinkCalls);
+    EXPECT_EQ(sinkCalls, counts[SEGMENT_SINK_CALLS]);
+    if (INSTRUMENTATION) EXPECT_GT(sinkCalls, 0);
+}
+
+// FIXED POINT
+
+TEST(CompassFixedPoint, Arithmetic) {
+    EXPECT_EQ(Fixed(1.5), Fixed(3) / 2);
+    EXPECT_EQ(Fixed(-0.75), Fixed(1.5) * Fixed(-0.5));
+    EXPECT_EQ(Fixed::fromRaw(1), Fixed::fromRaw(1 << 16) * Fixed::fromRaw(1 << 16));
+    EXPECT_EQ(Fixed(3), sqrt(Fixed(9)));
+    EXPECT_EQ(Fixed::fromRaw(6074000999), sqrt(Fixed(2)));
+    EXPECT_EQ(0, sqrt(Fixed(-1)).raw);
+    EXPECT_EQ(Fixed(-2), floor(Fixed(-1.5)));
+
+    // saturates instead of wrapping or trapping
+    EXPECT_EQ(Fixed::max(), Fixed(1) / Fixed());
+    EXPECT_EQ(-Fixed::max(), Fixed(-1) / Fixed());
+    EXPECT_EQ(Fixed::max(), Fixed(1 << 30) * Fixed(4));
+    EXPECT_EQ(Fixed::max(), Fixed::max() + Fixed(1));
+}
+
+TEST(CompassFixedPoint, AnglesMatchStd) {
+    for (double angle = -7; angle < 7; angle += 0.01) {
+        EXPECT_NEAR(std::sin(angle), double(sin(Fixed(angle))), 1e-8);
+        EXPECT_NEAR(std::cos(angle), double(cos(Fixed(angle))), 1e-8);
+        double x = std::cos(angle) * 3, y = std::sin(angle) * 3;
+        EXPECT_NEAR(std::atan2(y, x), double(atan2(Fixed(y), Fixed(x))), 1e-8);
+    }
+    for (double x = -1; x <= 1; x += 0.01) EXPECT_NEAR(std::acos(x), double(acos(Fixed(x))), 1e-4);
+    for (double x = -0.99; x <= 0.99; x += 0.01) EXPECT_NEAR(std::acos(x), double(acos(Fixed(x))), 1e-8);
+}
+
+TEST(CompassFixedPoint, IntersectionsMatchFloat) {
+    auto segments = randomSegments(300, 101);
+    std::vector<Segmentx> fixedSegments;
+    for (auto& segment : segments) fixedSegments.push_back(segment.cast<Fixed>());
+
+    int compared = 0;
+    for (int a = 0; a < segments.size(); a++) {
+        for (int b = a + 1; b < segments.size(); b++) {
+            auto expected = intersect(segments[a], segments[b]);
+            auto actual = intersect(fixedSegments[a], fixedSegments[b]);
+            // near misses and tangents can go either way
+            if (expected.size() != actual.size()) continue;
+            // float's acos loses small angles, which large arcs turn into long distances
+            float alongTolerance = 0.001f * (segments[a].isStraight() ? 1 : std::max(1.0f, segments[a].radius()));
+            for (int i = 0; i < expected.size(); i++) {
+                EXPECT_NEAR(expected[i].position[0], double(actual[i].position[0]), 0.001);
+                EXPECT_NEAR(expected[i].position[1], double(actual[i].position[1]), 0.001);
+                EXPECT_NEAR(expected[i].alongA, double(actual[i].alongA), alongTolerance);
+                compared++;
+            }
+        }
+    }
+    EXPECT_GT(compared, 5000);
+}
+
+// Only depends on integer arithmetic, so the same on every compiler, optimization level and machine.
+// Inputs come straight from the generator's bits, mt19937 is specified to the bit.
+TEST(CompassFixedPoint, BitIdentical) {
+    std::mt19937 generator(102);
+    auto coordinate = [&]() { return Fixed::fromRaw(generator()); };
+    std::vector<Segmentx> segments;
+    for (int i = 0; i < 200; i++) {
+        vec2x start(coordinate(), coordinate()), end(coordinate(), coordinate());
+        if (i % 2) {
+            vec2x direction = vec2x(coordinate() - Fixed(0.5), coordinate() - Fixed(0.5)).normalized();
+            segments.push_back(Segmentx(start, direction, end));
+        } else {
+            segments.push_back(Segmentx(start, end));
+        }
+    }
+
+    uint64_t hash = 0;
+    auto mix = [&](Fixed value) { hash = hash * 0x100000001B3u ^ uint64_t(value.raw); };
+    for (int a = 0; a < segments.size(); a++) {
+        mix(segments[a].length());
+        mix(segments[a].midpoint()[0]);
+        for (int b = a + 1; b < segments.size(); b++) {
+            for (auto& intersection : intersect(segments[a], segments[b])) {
+                mix(intersection.alongA);
+                mix(intersection.alongB);
+                mix(intersection.position[0]);
+                mix(intersection.position[1]);
+            }
+        }
+    }
+    EXPECT_EQ(3666870362302906843u, hash);
+}
+
+// INTERSECTION GRAPH
+
+std::vector<BatchIntersection> graphIntersections (IntersectionGraph& graph) {
+    std::vector<BatchIntersection> intersections;
+    graph.forEachIntersection([&](const BatchIntersection& i) { intersections.push_back(i); });
+    return intersections;
+}
+
+void expectSameIntersections (std::vector<BatchIntersection> expected, std::vector<BatchIntersection> actual) {
+    ASSERT_EQ(expected.size(), actual.size());
+    for (int i = 0; i < expected.size(); i++) {
+        EXPECT_EQ(expected[i].indexA, actual[i].indexA);
+        EXPECT_EQ(expected[i].indexB, actual[i].indexB);
+        EXPECT_TRUE(sameFloat(expected[i].alongA, actual[i].alongA));
+        EXPECT_TRUE(sameFloat(expected[i].alongB, actual[i].alongB));
+    }
+}
+
+TEST(CompassIntersectionGraph, MatchesIntersectAll) {
+    auto segments = randomSegments(300, 21);
+    IntersectionGraph graph(0.2);
+    for (auto& segment : segments) graph.insert(segment);
+
+    auto expected = intersectAll(segments);
+    expectSameIntersections(expected, graphIntersections(graph));
+
+    auto changes = graph.takeChanges();
+    EXPECT_EQ(expected.size(), changes.added.size());
+    EXPECT_TRUE(changes.removed.empty());
+    EXPECT_TRUE(graph.takeChanges().empty());
+}
+
+TEST(CompassIntersectionGraph, ModifyAndRemove) {
+    auto segments = randomSegments(300, 22);
+    IntersectionGraph graph(0.2);
+    for (auto& segment : segments) graph.insert(segment);
+    auto before = graphIntersections(graph);
+    graph.takeChanges();
+
+    // drag one segment somewhere else
+    int dragged = 17;
+    Segment moved(segments[dragged].start + vec2(0.3, 0.1), segments[dragged].end + vec2(0.3, 0.1));
+    graph.modify(dragged, moved);
+
+    std::vector<Segment> modified;
+    for (int i = 0; i < segments.size(); i++) modified.push_back(i == dragged ? moved : segments[i]);
+    auto expected = intersectAll(modified);
+    expectSameIntersections(expected, graphIntersections(graph));
+
+    auto changes = graph.takeChanges();
+    auto involves = [&](const BatchIntersection& i) { return i.indexA == dragged || i.indexB == dragged; };
+    EXPECT_EQ(std::count_if(before.begin(), before.end(), involves), changes.removed.size());
+    EXPECT_EQ(std::count_if(expected.begin(), expected.end(), involves), changes.added.size());
+    for (auto& i : changes.removed) EXPECT_TRUE(involves(i));
+    for (auto& i : changes.added) EXPECT_TRUE(involves(i));
+
+    graph.remove(dragged);
+    EXPECT_FALSE(graph.contains(dragged));
+    EXPECT_EQ(std::count_if(expected.begin(), expected.end(), involves), graph.takeChanges().removed.size());
+    for (auto& i : graphIntersections(graph)) EXPECT_FALSE(involves(i));
+}
+
+TEST(CompassIntersectionGraph, ModifyReportsOnlyChanges) {
+    IntersectionGraph graph;
+    int road = graph.insert(Segment({0, 0}, {1, 0}));
+    graph.insert(Segment({0.5, -1}, {0.5, 1}));
+    graph.insert(Segment({1.5, -1}, {1.5, 1}));
+    graph.takeChanges();
+
+    graph.modify(road, Segment({0, 0}, {1, 0}));
+    EXPECT_TRUE(graph.takeChanges().empty());
+
+    // longer, the crossing at 0.5 stays the same
+    graph.modify(road, Segment({0, 0}, {2, 0}));
+    auto changes = graph.takeChanges();
+    EXPECT_TRUE(changes.removed.empty());
+    ASSERT_EQ(1, changes.added.size());
+    EXPECT_NEAR(1.5, changes.added[0].position[0], PRECISION);
+}
+
+TEST(CompassIntersectionGraph, NegativeFarAndLongSegments) {
+    auto segments = randomSegments(200, 23);
+    std::vector<Segment> placed;
+    for (int i = 0; i < segments.size(); i++) {
+        vec2 shift = i % 2 ? vec2(-3, -2) : vec2(-0.5, 0.2);
+        placed.push_back(Segment(segments[i].start * 4 + shift, segments[i].end * 4 + shift));
+    }
+    // a 5 km road across all of them, and one far outside of int cell indices
+    placed.push_back(Segment({-2500, -2500}, {2500, 2500}));
+    placed.push_back(Segment({-1e12, 1e12}, {-1e12 + 1, 1e12 + 1}));
+
+    IntersectionGraph graph(0.01);
+    for (auto& segment : placed) graph.insert(segment);
+    expectSameIntersections(intersectAll(placed), graphIntersections(graph));
+
+    graph.remove(placed.size() - 2);
+    placed.pop_back();
+    placed.pop_back();
+    auto withoutRoad = intersectAll(placed);
+    auto remaining = graphIntersections(graph);
+    expectSameIntersections(withoutRoad, remaining);
+}
+
+TEST(CompassIntersectionGraph, SpanningBothClamps) {
+    // from below -MAX_CELL_INDEX to above MAX_CELL_INDEX cells, more than int holds
+    IntersectionGraph graph(1);
+    std::vector<Segment> placed = {Segment(vec2(-2e9, 0), vec2(2e9, 1)), Segment({0, -1}, {0, 2})};
+    int wide = graph.insert(placed[0]);
+    graph.insert(placed[1]);
+    expectSameIntersections(intersectAll(placed), graphIntersections(graph));
+    EXPECT_EQ(1, graphIntersections(graph).size());
+
+    graph.remove(wide);
+    EXPECT_EQ(0, graphIntersections(graph).size());
+}
+
+// PRIMITIVE DISPATCH
+
+std::vector<Primitive> randomPrimitives (int n, unsigned int seed) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<float> coordinate(0, 1);
+    auto segments = randomSegments(n, seed);
+    std::vector<Primitive> primitives;
+    for (int i = 0; i < n; i++) {
+        vec2 point(coordinate(generator), coordinate(generator));
+        vec2 direction = vec2(coordinate(generator) - 0.5f, coordinate(generator) - 0.5f).normalized();
+        switch (i % 4) {
+            case 0: primitives.push_back(Line(point, direction)); break;
+            case 1: primitives.push_back(Ray(point, direction)); break;
+            case 2: primitives.push_back(Circle(point, 0.1f + 0.3f * coordinate(generator))); break;
+            case 3: primitives.push_back(segments[i]); break;
+        }
+    }
+    return primitives;
+}
+
+TEST(CompassPrimitiveDispatch, MatchesOverloads) {
+    auto primitives = randomPrimitives(8, 5);
+    auto& line = primitives[0].line;
+    auto& ray = primitives[1].ray;
+    auto& circle = primitives[2].circle;
+    auto& segment = primitives[3].segment;
+
+    auto expectSame = [](AtMost<2, Intersection> expected, AtMost<2, Intersection> dispatched) {
+        ASSERT_EQ(expected.size(), dispatched.size());
+        for (int i = 0; i < expected.size(); i++) {
+            EXPECT_TRUE(sameFloat(expected[i].alongA, dispatched[i].alongA));
+            EXPECT_TRUE(sameFloat(expected[i].alongB, dispatched[i].alongB));
+        }
+    };
+
+    expectSame(intersect(ray, circle), intersect(primitives[1], primitives[2]));
+    expectSame(intersect(circle, ray), intersect(primitives[2], primitives[1]));
+    expectSame(intersect(segment, line), intersect(primitives[3], primitives[0]));
+    expectSame(intersect(line, circle), intersect(primitives[0], primitives[2]));
+    expectSame(intersect(segment, primitives[7].segment), intersect(primitives[3], primitives[7]));
+
+    auto lineLine = intersect(line, primitives[4].line);
+    auto dispatchedLineLine = intersect(primitives[0], primitives[4]);
+    ASSERT_EQ(lineLine.size(), dispatchedLineLine.size());
+    for (int i = 0; i < lineLine.size(); i++) {
+        EXPECT_TRUE(sameFloat(lineLine[i].alongA, dispatchedLineLine[i].alongA));
+    }
+}
+
+TEST(CompassPrimitiveDispatch, BatchedMatchesSingleDispatch) {
+    auto primitives = randomPrimitives(60, 6);
+    std::vector<PrimitivePair> pairs;
+    for (int a = 0; a < primitives.size(); a++) {
+        for (int b = 0; b < primitives.size(); b++) {
+            if (a != b) pairs.push_back(PrimitivePair(a, b));
+        }
+    }
+
+    // single dispatch, then grouped the way the batched form groups them
+    std::vector<BatchIntersection> expected;
+    for (auto& pair : pairs) {
+        for (auto& i : intersect(primitives[pair.first], primitives[pair.second])) {
+            expected.push_back({pair.first, pair.second, i.alongA, i.alongB, i.position});
+        }
+    }
+    std::stable_sort(expected.begin(), expected.end(), [&](const BatchIntersection& x, const BatchIntersection& y) {
+        return primitives[x.indexA].kind * PRIMITIVE_KIND_COUNT + primitives[x.indexB].kind
+               < primitives[y.indexA].kind * PRIMITIVE_KIND_COUNT + primitives[y.indexB].kind;
+    });
+
+    std::vector<BatchIntersection> batched;
+    intersectPairs(primitives, pairs, batched);
+
+    ASSERT_EQ(expected.size(), batched.size());
+    for (int i = 0; i < expected.size(); i++) {
+        EXPECT_EQ(expected[i].indexA, batched[i].indexA);
+        EXPECT_EQ(expected[i].indexB, batched[i].indexB);
+        EXPECT_TRUE(sameFloat(expected[i].alongA, batched[i].alongA));
+        EXPECT_TRUE(sameFloat(expected[i].alongB, batched[i].alongB));
+    }
+}
+
+// PATHS
+
+Path rectangle (vec2 min, vec2 max) {
+    return Path({
+        Segment(min, {max[0], min[1]}),
+        Segment({max[0], min[1]}, max),
+        Segment(max, {min[0], max[1]}),
+        Segment({min[0], max[1]}, min)
+    });
+}
+
+Path circle (vec2 center, float radius) {
+    return Path({
+        Segment(center + vec2(radius, 0), {0, 1}, center - vec2(radius, 0)),
+        Segment(center - vec2(radius, 0), {0, -1}, center + vec2(radius, 0))
+    });
+}
+
+TEST(CompassPaths, SignedArea) {
+    auto square = rectangle({0, 0}, {1, 1});
+    EXPECT_NEAR(1, square.signedArea(), PRECISION);
+    EXPECT_FALSE(square.isClockwise());
+    EXPECT_TRUE(square.reversed().isClockwise());
+    EXPECT_NEAR(M_PI * 0.25, circle({0, 0}, 0.5).signedArea(), PRECISION);
+}
+
+TEST(CompassPaths, Contains) {
+    auto disc = circle({0.5, 0.5}, 0.5);
+    EXPECT_TRUE(disc.contains({0.5, 0.5}));
+    EXPECT_TRUE(disc.contains({0.5, 0.95}));
+    EXPECT_FALSE(disc.contains({0.95, 0.95}));
+    EXPECT_TRUE(disc.reversed().contains({0.5, 0.1}));
+}
+
+TEST(CompassPaths, OffsetQueries) {
+    auto square = rectangle({0, 0}, {1, 1});
+    EXPECT_NEAR(4, square.length(), PRECISION);
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(0.5, 0), square.pointAt(0.5));
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(1, 0), square.pointAt(1));
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(1, 0.25), square.pointAt(1.25));
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(0, 1), square.directionAt(1.25));
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(0, 0), square.pointAt(5));
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(0, -1), square.directionAt(5));
+    EXPECT_NEAR(2.5, square.offsetAt({0.5, 1.1}), PRECISION);
+
+    auto disc = circle({0, 0}, 1);
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(0, 1), disc.pointAt(M_PI / 2));
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(-1, 0), disc.directionAt(M_PI / 2));
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(0, -1), disc.pointAt(M_PI * 3 / 2));
+    EXPECT_NEAR(M_PI * 3 / 2, disc.offsetAt({0, -2}), PRECISION);
+    EXPECT_NEAR(M_PI * 2, disc.reversed().length(), PRECISION);
+}
+
+TEST(CompassPaths, OffsetAtOnLongPaths) {
+    Path lane;
+    vec2 start(0, 0);
+    vec2 direction(1, 0);
+    for (auto& segment : randomSegments(300, 12)) {
+        vec2 end = start + (segment.end - segment.start);
+        lane.add(segment.isStraight() ? Segment(start, end) : Segment(start, direction, end));
+        direction = lane.segments.back().endDirection();
+        start = end;
+    }
+    ASSERT_GE(lane.segments.size(), PATH_BVH_MIN_SEGMENTS);
+
+    // the first of equally close segments, the same as a scan over all of them
+    auto scanned = [&](vec2 point) {
+        int closest = 0;
+        for (int i = 1; i < lane.segments.size(); i++) {
+            if (lane.segments[i].distanceTo(point) < lane.segments[closest].distanceTo(point)) closest = i;
+        }
+        auto& segment = lane.segments[closest];
+        return lane.startOffsets[closest] + std::min(segment.length(), std::max(0.0f, segment.offsetAt(point)));
+    };
+    std::mt19937 generator(13);
+    std::uniform_real_distribution<float> around(-1, 1);
+    for (int p = 0; p < 200; p++) {
+        vec2 point = lane.pointAt(lane.length() * p / 200) + vec2(around(generator), around(generator));
+        EXPECT_EQ(scanned(point), lane.offsetAt(point));
+    }
+
+    // segments added later are found as well
+    vec2 end = lane.segments.back().end;
+    lane.add(Segment(end, end + vec2(0, 50)));
+    EXPECT_EQ(scanned(end + vec2(1, 45)), lane.offsetAt(end + vec2(1, 45)));
+    EXPECT_NEAR(lane.length() - 5, lane.offsetAt(end + vec2(1, 45)), 0.01);
+}
+
+TEST(CompassPaths, BatchedMatchesSingle) {
+    std::vector<Segment> lane;
+    vec2 start(0, 0);
+    vec2 direction(1, 0);
+    for (auto& segment : randomSegments(200, 11)) {
+        vec2 end = start + (segment.end - segment.start);
+        lane.push_back(segment.isStraight() ? Segment(start, end) : Segment(start, direction, end));
+        direction = lane.back().endDirection();
+        start = end;
+    }
+    Path path(lane);
+
+    std::mt19937 generator(12);
+    std::uniform_real_distribution<float> offset(-1, path.length() + 1);
+    std::vector<float> offsets;
+    for (int i = 0; i < 1000; i++) offsets.push_back(offset(generator));
+    // mostly sorted, like vehicles along a lane
+    std::sort(offsets.begin() + 500, offsets.end());
+
+    std::vector<vec2> points, directions, pointsOnly;
+    path.pointsAndDirectionsAt(offsets, points, directions);
+    path.pointsAt(offsets, pointsOnly);
+    for (int i = 0; i < offsets.size(); i++) {
+        EXPECT_EQ(path.pointAt(offsets[i]), points[i]);
+        EXPECT_EQ(path.pointAt(offsets[i]), pointsOnly[i]);
+        EXPECT_EQ(path.directionAt(offsets[i]), directions[i]);
+    }
+}
+
+// a lane of alternating lines and arcs, each turning by at most 1 rad
+Path gentleLane (int n, unsigned int seed) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<float> bend(-1, 1), length(0.5, 1.5);
+    Path lane;
+    vec2 start(0, 0);
+    vec2 direction(1, 0);
+    for (int i = 0; i < n; i++) {
+        vec2 end = start + length(generator) * (Eigen::Rotation2D<float>(bend(generator) / 2) * direction);
+        lane.add(i % 2 ? Segment(start, direction, end) : Segment(start, end));
+        direction = lane.segments.back().endDirection();
+        start = end;
+    }
+    return lane;
+}
+
+TEST(CompassPaths, OffsetClosed) {
+    auto square = rectangle({0, 0}, {1, 1});
+
+    auto outside = square.offset(-0.1);
+    EXPECT_TRUE(outside.isClosed());
+    EXPECT_EQ(8, outside.segments.size());
+    EXPECT_NEAR(1 + 4 * 0.1 + M_PI * 0.01, outside.signedArea(), PRECISION);
+
+    auto inside = square.offset(0.1);
+    EXPECT_TRUE(inside.isClosed());
+    EXPECT_EQ(4, inside.segments.size());
+    EXPECT_NEAR(0.64, inside.signedArea(), PRECISION);
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(0.1, 0.1), inside.segments[0].start);
+
+    auto disc = circle({0.5, 0.5}, 0.5);
+    EXPECT_NEAR(M_PI * 0.16, disc.offset(0.1).signedArea(), PRECISION);
+    EXPECT_NEAR(M_PI * 0.36, disc.offset(-0.1).signedArea(), PRECISION);
+    EXPECT_EQ(0, disc.offset(0.6).segments.size());
+}
+
+TEST(CompassPaths, OffsetKeepsDistance) {
+    auto lane = gentleLane(30, 13);
+    for (float distance : {-0.2f, 0.2f}) {
+        auto offset = lane.offset(distance);
+        vec2 sideways = distance * lane.segments.front().direction.unitOrthogonal();
+        EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(lane.segments.front().start + sideways), offset.segments.front().start);
+        for (int i = 0; i + 1 < offset.segments.size(); i++) {
+            EXPECT_LT((offset.segments[i].end - offset.segments[i + 1].start).norm(), 0.001);
+        }
+
+        for (float along = 0; along < offset.length(); along += 0.05) {
+            vec2 point = offset.pointAt(along);
+            float closest = INFINITY;
+            for (auto& segment : lane.segments) closest = std::min(closest, segment.distanceTo(point));
+            EXPECT_NEAR(std::abs(distance), closest, 0.001);
+        }
+    }
+}
+
+TEST(CompassPaths, BatchedOffsetMatchesSingle) {
+    std::vector<Path> paths;
+    for (int p = 0; p < 100; p++) paths.push_back(gentleLane(20, 100 + p));
+    paths.push_back(rectangle({0, 0}, {1, 1}));
+    std::vector<float> distances = {-0.3, -0.1, 0.1, 0.3};
+
+    WorkStealingPool pool(4);
+    std::vector<Path> offsets;
+    offsetPaths(paths, distances, offsets, pool);
+
+    ASSERT_EQ(paths.size() * distances.size(), offsets.size());
+    for (int p = 0; p < paths.size(); p++) {
+        for (int d = 0; d < distances.size(); d++) {
+            auto single = paths[p].offset(distances[d]);
+            auto& batched = offsets[p * distances.size() + d];
+            ASSERT_EQ(single.segments.size(), batched.segments.size());
+            for (int i = 0; i < single.segments.size(); i++) {
+                EXPECT_EQ(single.segments[i].start, batched.segments[i].start);
+                EXPECT_EQ(single.segments[i].end, batched.segments[i].end);
+            }
+        }
+    }
+}
+
+// STRAIGHT SKELETON
+
+TEST(CompassStraightSkeleton, Square) {
+    auto skeleton = straightSkeleton({{0, 0}, {1, 0}, {1, 1}, {0, 1}});
+
+    ASSERT_EQ(5, skeleton.nodes.size());
+    EXPECT_VECTOR_ROUGHLY_EQUAL(vec2(0.5, 0.5), skeleton.nodes[4].position);
+    EXPECT_NEAR(0.5, skeleton.nodes[4].height, PRECISION);
+    EXPECT_EQ(4, skeleton.arcs.size());
+    for (auto& arc : skeleton.arcs) EXPECT_EQ(4, arc.second);
+}
+
+TEST(CompassStraightSkeleton, Rectangle) {
+    auto skeleton = straightSkeleton({{0, 0}, {2, 0}, {2, 1}, {0, 1}});
+
+    ASSERT_EQ(6, skeleton.nodes.size());
+    EXPECT_EQ(5, skeleton.arcs.size());
+    for (int i = 4; i < 6; i++) {
+        EXPECT_NEAR(0.5, skeleton.nodes[i].position[1], PRECISION);
+        EXPECT_NEAR(0.5, skeleton.nodes[i].height, PRECISION);
+    }
+    EXPECT_NEAR(1, std::abs(skeleton.nodes[4].position[0] - skeleton.nodes[5].position[0]), PRECISION);
+}
+
+TEST(CompassStraightSkeleton, DentSplits) {
+    // the dent's reflex vertex runs into the bottom edge and splits the polygon in two
+    std::vector<vec2> polygon = {{0, 0}, {6, 0}, {6, 2}, {3.5, 2}, {3, 1}, {2.5, 2}, {0, 2}};
+    auto skeleton = straightSkeleton(polygon);
+
+    float splitHeight = 1 / (1 + std::sqrt(5.0f));
+    int splits = 0;
+    for (auto& node : skeleton.nodes) {
+        if ((node.position - vec2(3, splitHeight)).norm() < PRECISION) {
+            EXPECT_NEAR(splitHeight, node.height, PRECISION);
+            splits++;
+        }
+    }
+    EXPECT_EQ(1, splits);
+    EXPECT_EQ(2 * 7 - 2, skeleton.nodes.size());
+    EXPECT_EQ(2 * 7 - 3, skeleton.arcs.size());
+}
+
+// distance from point to the closest edge of a closed polygon
+float distanceToOutline (std::vector<vec2>& polygon, vec2 point) {
+    float distance = INFINITY;
+    for (int i = 0; i < polygon.size(); i++) {
+        Segment edge(polygon[i], polygon[(i + 1) % polygon.size()]);
+        distance = std::min(distance, edge.distanceTo(point));
+    }
+    return distance;
+}
+
+std::vector<vec2> randomStarPolygon (std::mt19937& generator, int n) {
+    std::uniform_real_distribution<float> radius(0.3, 1);
+    std::vector<vec2> polygon;
+    for (int i = 0; i < n; i++) {
+        float angle = 2 * M_PI * i / n;
+        polygon.push_back(radius(generator) * vec2(std::cos(angle), std::sin(angle)));
+    }
+    return polygon;
+}
+
+TEST(CompassStraightSkeleton, StarPolygons) {
+    std::mt19937 generator(31);
+    for (int p = 0; p < 50; p++) {
+        int n = 5 + p % 15;
+        auto polygon = randomStarPolygon(generator, n);
+        auto skeleton = straightSkeleton(polygon);
+        Path outline;
+        for (int i = 0; i < n; i++) outline.add(Segment(polygon[i], polygon[(i + 1) % n]));
+
+        // a tree connecting every vertex, with n - 2 inner nodes in the general case
+        EXPECT_EQ(2 * n - 2, skeleton.nodes.size());
+        EXPECT_EQ(2 * n - 3, skeleton.arcs.size());
+        std::vector<int> outgoing(skeleton.nodes.size(), 0);
+        for (auto& arc : skeleton.arcs) outgoing[arc.first]++;
+        for (int i = 0; i < n; i++) EXPECT_EQ(1, outgoing[i]);
+
+        // the shrinking polygon never gets closer to the outline than its height
+        for (int i = n; i < skeleton.nodes.size(); i++) {
+            auto& node = skeleton.nodes[i];
+            EXPECT_TRUE(outline.contains(node.position));
+            EXPECT_GT(node.height, 0);
+            EXPECT_LE(node.height, distanceToOutline(polygon, node.position) + PRECISION);
+        }
+    }
+}
+
+TEST(CompassStraightSkeleton, NearDegenerateFootprints) {
+    // generated building footprints (U, T and H shapes) where several events coincide up to rounding,
+    // which used to put nodes up to a meter below or above their height
+    std::vector<std::vector<vec2>> footprints = {
+        {{129.465851, 939.001404}, {111.13871, 941.229492}, {108.84317, 922.347473}, {116.915062, 921.36615},
+         {118.232292, 932.200989}, {120.415634, 931.935608}, {119.098412, 921.100708}, {127.170303, 920.119385}},
+        {{1002.30341, 806.8396}, {1010.66766, 809.474365}, {1008.06964, 817.721802}, {1018.17944, 820.906433},
+         {1014.78625, 831.678162}, {986.202515, 822.674072}, {989.595703, 811.902405}, {999.705444, 815.087036}},
+        {{807.940247, 462.924774}, {815.502319, 470.253357}, {814.720215, 471.060333}, {818.501282, 474.724609},
+         {819.283325, 473.917633}, {826.845398, 481.246216}, {815.862549, 492.578888}, {808.303223, 485.25296},
+         {815.375732, 477.95517}, {811.589233, 474.285614}, {804.516785, 481.583405}, {796.957458, 474.257477}},
+    };
+    // a millimeter, well above rounding at a kilometer from the origin
+    float tolerance = 0.001;
+
+    for (auto& polygon : footprints) {
+        auto skeleton = straightSkeleton(polygon);
+        int n = polygon.size();
+        Path outline;
+        for (int i = 0; i < n; i++) outline.add(Segment(polygon[i], polygon[(i + 1) % n]));
+
+        // still a tree connecting every vertex
+        EXPECT_EQ(skeleton.nodes.size() - 1, skeleton.arcs.size());
+        std::vector<int> outgoing(skeleton.nodes.size(), 0);
+        for (auto& arc : skeleton.arcs) outgoing[arc.first]++;
+        for (int i = 0; i < n; i++) EXPECT_EQ(1, outgoing[i]);
+
+        // the shrinking polygon never gets closer to the outline than its height, and arcs only go up
+        for (int i = n; i < skeleton.nodes.size(); i++) {
+            auto& node = skeleton.nodes[i];
+            EXPECT_TRUE(outline.contains(node.position));
+            EXPECT_LE(node.height, distanceToOutline(polygon, node.position) + tolerance);
+        }
+        for (auto& arc : skeleton.arcs) {
+            EXPECT_LE(skeleton.nodes[arc.first].height, skeleton.nodes[arc.second].height + tolerance);
+        }
+    }
+}
+
+TEST(CompassStraightSkeleton, BatchedMatchesSingle) {
+    std::mt19937 generator(32);
+    std::vector<std::vector<vec2>> polygons;
+    for (int p = 0; p < 600; p++) polygons.push_back(randomStarPolygon(generator, 4 + p % 9));
+
+    WorkStealingPool pool(4);
+    std::vector<StraightSkeleton> skeletons;
+    straightSkeletons(polygons, skeletons, pool);
+
+    ASSERT_EQ(polygons.size(), skeletons.size());
+    for (int p = 0; p < polygons.size(); p++) {
+        auto single = straightSkeleton(polygons[p]);
+        ASSERT_EQ(single.nodes.size(), skeletons[p].nodes.size());
+        ASSERT_EQ(single.arcs, skeletons[p].arcs);
+        for (int i = 0; i < single.nodes.size(); i++) {
+            EXPECT_EQ(single.nodes[i].position, skeletons[p].nodes[i].position);
+        }
+    }
+}
+
+// SEGMENT BVH
+
+// a closed counter-clockwise wobbly outline around center, alternating lines and bulging arcs
+Path wobblyOutline (vec2 center, float radius, int n, unsigned int seed) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<float> wobble(0.8f, 1.2f), bulge(-0.3f, 0.3f);
+    std::vector<vec2> corners;
+    for (int i = 0; i < n; i++) {
+        float angle = 2 * M_PI * i / n;
+        corners.push_back(center + radius * wobble(generator) * vec2(std::cos(angle), std::sin(angle)));
+    }
+    std::vector<Segment> segments;
+    for (int i = 0; i < n; i++) {
+        vec2 start = corners[i], end = corners[(i + 1) % n];
+        vec2 direction = Eigen::Rotation2D<float>(bulge(generator)) * vec2((end - start).normalized());
+        segments.push_back(i % 2 ? Segment(start, direction, end) : Segment(start, end));
+    }
+    return Path(segments);
+}
+
+TEST(CompassSegmentBVH, NearestMatchesBruteForce) {
+    auto segments = randomSegments(500, 41);
+    SegmentBVH bvh(segments);
+
+    std::mt19937 generator(42);
+    std::uniform_real_distribution<float> coordinate(-0.2f, 1.2f);
+    std::vector<std::pair<float, int>> kNearest;
+    for (int q = 0; q < 200; q++) {
+        vec2 point(coordinate(generator), coordinate(generator));
+        std::vector<std::pair<float, int>> all;
+        for (int i = 0; i < segments.size(); i++) all.push_back({segments[i].distanceTo(point), i});
+        std::sort(all.begin(), all.end());
+
+        EXPECT_EQ(all[0].second, bvh.nearest(point));
+        bvh.kNearest(point, 7, kNearest);
+        ASSERT_EQ(7, kNearest.size());
+        for (int k = 0; k < 7; k++) EXPECT_EQ(all[k], kNearest[k]);
+    }
+
+    EXPECT_EQ(-1, SegmentBVH(std::vector<Segment>()).nearest({0, 0}));
+}
+
+TEST(CompassSegmentBVH, WindingMatchesPaths) {
+    std::vector<Path> paths = {wobblyOutline({0, 0}, 1, 120, 43), wobblyOutline({0.1, 0}, 0.4, 30, 44).reversed(),
+                               circle({0.3, 0.6}, 0.1), wobblyOutline({-0.6, -0.3}, 0.15, 9, 45)};
+    SegmentBVH bvh(paths);
+    EXPECT_EQ(1, bvh.pathOf(paths[0].segments.size()));
+
+    std::mt19937 generator(46);
+    std::uniform_real_distribution<float> coordinate(-1.4f, 1.4f);
+    int inside = 0;
+    for (int q = 0; q < 2000; q++) {
+        vec2 point(coordinate(generator), coordinate(generator));
+        // right on the outline, rounding decides
+        if (bvh.segments[bvh.nearest(point)].distanceTo(point) < 0.001f) continue;
+        int winding = 0;
+        for (auto& path : paths) winding += path.windingNumber(point);
+        EXPECT_EQ(winding, bvh.windingNumber(point));
+        if (winding) inside++;
+    }
+    EXPECT_LT(0, inside);
+}
+
+TEST(CompassSegmentBVH, BatchedMatchesSingle) {
+    std::vector<Path> paths = {wobblyOutline({0.5, 0.5}, 0.4, 60, 47)};
+    SegmentBVH bvh(paths);
+
+    // a cursor moving in small steps
+    std::mt19937 generator(48);
+    std::uniform_real_distribution<float> step(-0.02f, 0.02f);
+    std::vector<vec2> points;
+    vec2 cursor(0.5, 0.5);
+    for (int i = 0; i < 1000; i++) {
+        cursor += vec2(step(generator), step(generator));
+        points.push_back(cursor);
+    }
+
+    std::vector<int> nearest, windings;
+    bvh.nearestMany(points, nearest);
+    bvh.windingNumbers(points, windings);
+    for (int i = 0; i < points.size(); i++) {
+        EXPECT_EQ(bvh.nearest(points[i]), nearest[i]);
+        EXPECT_EQ(bvh.windingNumber(points[i]), windings[i]);
+    }
+}
+
+// TESSELLATION
+
+TEST(CompassTessellation, WithinChordalError) {
+    for (auto& segment : randomSegments(300, 71)) {
+        for (float maxError : {0.01f, 0.0001f}) {
+            std::vector<vec2> polyline;
+            tessellate(segment, maxError, polyline);
+            ASSERT_EQ(chordCount(segment, maxError) + 1, polyline.size());
+            EXPECT_EQ(segment.start, polyline.front());
+            EXPECT_EQ(segment.end, polyline.back());
+            if (segment.isStraight()) {
+                EXPECT_EQ(2, polyline.size());
+                continue;
+            }
+
+            for (int i = 0; i + 1 < polyline.size(); i++) {
+                EXPECT_NEAR(segment.radius(), (polyline[i] - segment.radialCenter()).norm(), segment.radius() * 0.00001);
+                vec2 chordMiddle = (polyline[i] + polyline[i + 1]) / 2;
+                EXPECT_LE(segment.distanceTo(chordMiddle), maxError * 1.01 + segment.radius() * 0.00001);
+            }
+            // one chord less would be too coarse
+            float fewerChordAngle = segment.angleSpan() / (polyline.size() - 2);
+            if (polyline.size() > 2) EXPECT_GT(segment.radius() * (1 - std::cos(fewerChordAngle / 2)), maxError * 0.99);
+        }
+    }
+}
+
+TEST(CompassTessellation, LargeRadii) {
+    for (float radius : {1000.0f, 5000.0f, 50000.0f}) {
+        for (float span : {0.1f, 0.5f}) {
+            auto arc = Segment(vec2(radius, 0), vec2(0, 1), radius * vec2(std::cos(span), std::sin(span)));
+            for (float maxError : {0.001f, 0.0001f}) {
+                // in double, the distance of a chord spanning the angle a from the arc is 2 r sin(a / 4)^2
+                auto chordError = [&](double chords) {
+                    double quarter = std::sin(arc.angleSpan() / chords / 4);
+                    return 2 * double(arc.radius()) * quarter * quarter;
+                };
+                int chords = chordCount(arc, maxError);
+                EXPECT_GT(MAX_ARC_CHORDS, chords);
+                EXPECT_LE(chordError(chords), maxError);
+                EXPECT_GT(chordError(chords - 1), maxError);
+            }
+        }
+    }
+}
+
+TEST(CompassTessellation, CacheAndBatch) {
+    auto segments = randomSegments(1000, 72);
+    TessellationCache cache;
+    std::vector<vec2> cached, direct;
+    for (int pass = 0; pass < 2; pass++) {
+        for (auto& segment : segments) cache.tessellate(segment, 0.001, cached);
+    }
+    EXPECT_EQ(segments.size(), cache.misses);
+    EXPECT_EQ(segments.size(), cache.hits);
+    cache.tessellate(segments[0], 0.002, cached);
+    EXPECT_EQ(segments.size() + 1, cache.misses);
+
+    Tessellation batched, parallel;
+    tessellateAll(segments, 0.001, batched);
+    WorkStealingPool pool(4);
+    tessellateAll(segments, 0.001, parallel, pool);
+
+    for (auto& segment : segments) tessellate(segment, 0.001, direct);
+    EXPECT_EQ(direct, batched.vertices);
+    EXPECT_EQ(direct, parallel.vertices);
+    EXPECT_EQ(batched.starts, parallel.starts);
+    EXPECT_EQ(direct, std::vector<vec2>(cached.begin(), cached.begin() + direct.size()));
+    EXPECT_EQ(chordCount(segments[5], 0.001) + 1, batched.polylineSize(5));
+}
+
+// SEGMENT FILE
+
+TEST(CompassSegmentFile, RoundTrip) {
+    auto segments = randomSegments(2500, 51);
+    const char* fileName = "compass-test-segments.bin";
+
+    SegmentFileWriter writer;
+    ASSERT_TRUE(writer.open(fileName));
+    writer.add(segments);
+    ASSERT_TRUE(writer.close());
+
+    MappedSegments mapped;
+    ASSERT_TRUE(mapped.open(fileName));
+    ASSERT_EQ(segments.size(), mapped.size());
+    EXPECT_EQ(3, mapped.blockCount());
+    EXPECT_EQ(segments[1500].start[1], mapped.column(1, START_Y)[1500 - SEGMENT_FILE_BLOCK_SIZE]);
+
+    for (int i = 0; i < segments.size(); i++) {
+        auto segment = mapped.segment(i);
+        EXPECT_EQ(segments[i].start, segment.start);
+        EXPECT_EQ(segments[i].end, segment.end);
+        EXPECT_EQ(segments[i].direction, segment.direction);
+        EXPECT_EQ(segments[i].isStraight(), segment.isStraight());
+        EXPECT_EQ(segments[i].length(), segment.length());
+        EXPECT_EQ(segments[i].radialCenter(), segment.radialCenter());
+        EXPECT_EQ(segments[i].signedRadius(), segment.signedRadius());
+        EXPECT_EQ(segments[i].startAngle(), segment.startAngle());
+        EXPECT_EQ(segments[i].angleSpan(), segment.angleSpan());
+    }
+
+    mapped.close();
+    std::remove(fileName);
+}
+
+TEST(CompassSegmentFile, BlocksAreBatches) {
+    auto segments = randomSegments(SEGMENT_FILE_BLOCK_SIZE + 60, 54);
+    const char* fileName = "compass-test-segments.bin";
+
+    SegmentFileWriter writer;
+    ASSERT_TRUE(writer.open(fileName));
+    writer.add(segments);
+    ASSERT_TRUE(writer.close());
+
+    MappedSegments mapped;
+    ASSERT_TRUE(mapped.open(fileName));
+    auto first = mapped.batch(0);
+    auto last = mapped.batch(1);
+    EXPECT_EQ(SEGMENT_FILE_BLOCK_SIZE, first.size());
+    EXPECT_EQ(60, last.size());
+    EXPECT_EQ(SEGMENT_FILE_BLOCK_SIZE, last.paddedSize());
+
+    // the same intersections as a batch built in memory from the same segments
+    std::vector<Segment> firstSegments(segments.begin(), segments.begin() + 200);
+    std::vector<Segment> lastSegments(segments.begin() + SEGMENT_FILE_BLOCK_SIZE, segments.end());
+    auto batchFirst = SegmentBatch(firstSegments);
+    auto batchLast = SegmentBatch(lastSegments);
+    std::vector<BatchIntersection> expected, actual;
+    intersectMany(batchLast, batchFirst, expected);
+    // only the first 200, a multiple of SEGMENT_BATCH_PADDING
+    first.count = first.paddedCount = 200;
+    intersectMany(last, first, actual);
+
+    ASSERT_EQ(expected.size(), actual.size());
+    EXPECT_LT(0, actual.size());
+    for (int n = 0; n < actual.size(); n++) {
+        EXPECT_EQ(expected[n].indexA, actual[n].indexA);
+        EXPECT_EQ(expected[n].indexB, actual[n].indexB);
+        EXPECT_TRUE(sameFloat(expected[n].alongA, actual[n].alongA));
+        EXPECT_TRUE(sameFloat(expected[n].alongB, actual[n].alongB));
+        EXPECT_TRUE(sameFloat(expected[n].position[0], actual[n].position[0]));
+        EXPECT_TRUE(sameFloat(expected[n].position[1], actual[n].position[1]));
+    }
+
+    mapped.close();
+    std::remove(fileName);
+}
+
+TEST(CompassSegmentFile, RejectsOtherFiles) {
+    const char* fileName = "compass-test-segments.bin";
+    auto segments = randomSegments(10, 52);
+    SegmentFileWriter writer;
+    ASSERT_TRUE(writer.open(fileName));
+    ASSERT_TRUE(writer.close());
+
+    MappedSegments mapped;
+    ASSERT_TRUE(mapped.open(fileName));
+    EXPECT_EQ(0, mapped.size());
+
+    // a newer version
+    FILE* file = std::fopen(fileName, "r+b");
+    uint32_t version = SEGMENT_FILE_VERSION + 1;
+    std::fseek(file, offsetof(SegmentFileHeader, version), SEEK_SET);
+    std::fwrite(&version, sizeof(version), 1, file);
+    std::fclose(file);
+    EXPECT_FALSE(mapped.open(fileName));
+
+    // truncated, the header promises a block that isn't there
+    ASSERT_TRUE(writer.open(fileName));
+    writer.add(segments);
+    ASSERT_TRUE(writer.close());
+    ASSERT_EQ(0, truncate(fileName, sizeof(SegmentFileHeader) + 100));
+    EXPECT_FALSE(mapped.open(fileName));
+    EXPECT_NE(nullptr, mapped.error());
+
+    // corrupt counts, more than int holds and so many that the byte count overflows
+    for (uint64_t count : {(uint64_t(1) << 31) + 5, ~uint64_t(0), uint64_t(1) << 60}) {
+        ASSERT_TRUE(writer.open(fileName));
+        writer.add(segments);
+        ASSERT_TRUE(writer.close());
+        file = std::fopen(fileName, "r+b");
+        std::fseek(file, offsetof(SegmentFileHeader, segmentCount), SEEK_SET);
+        std::fwrite(&count, sizeof(count), 1, file);
+        std::fclose(file);
+        EXPECT_FALSE(mapped.open(fileName));
+        EXPECT_EQ(0, mapped.size());
+    }
+
+    EXPECT_FALSE(mapped.open("compass-test-missing.bin"));
+    EXPECT_NE(nullptr, mapped.error());
+    std::remove(fileName);
+}
+
+TEST(CompassSegmentFile, WriterWithoutFile) {
+    auto segments = randomSegments(SEGMENT_FILE_BLOCK_SIZE + 10, 53);
+    SegmentFileWriter writer;
+    EXPECT_FALSE(writer.isOpen());
+    // a full block would be flushed, there is nowhere to
+    writer.add(segments);
+    EXPECT_TRUE(writer.close());
+
+    EXPECT_FALSE(writer.open("compass-test-missing-directory/segments.bin"));
+    EXPECT_NE(nullptr, writer.error());
+    writer.add(segments);
+}
+
+// WHITEBOARD
+
+TEST(CompassWhiteboard, BatchMatchesStream) {
+    auto segments = randomSegments(100, 61);
+    auto disc = circle({0.5, 0.5}, 0.25);
+
+    std::ostringstream direct, batched;
+    auto directStream = wb::draw(direct);
+    auto batchedStream = wb::draw(batched);
+    {
+        WhiteboardBatch batch(batchedStream, 32);
+        for (auto& segment : segments) {
+            directStream << segment;
+            batch << segment;
+        }
+        directStream << wb::clear << disc << vec2(0.25, 0.75);
+        batch << wb::clear << disc << vec2(0.25, 0.75);
+    }
+    EXPECT_EQ(direct.str(), batched.str());
+}
+
+TEST(CompassWhiteboard, ViewportCulling) {
+    std::ostringstream out;
+    auto stream = wb::draw(out);
+    WhiteboardBatch batch(stream);
+    batch.setViewport(BoundingBox({0, 0}, {1, 1}), 0.01);
+
+    batch << Segment({0.1, 0.1}, {0.9, 0.1});
+    // outside
+    batch << Segment({2, 2}, {3, 3}) << vec2(-1, 0.5);
+    // smaller than a pixel
+    batch << Segment({0.5, 0.5}, {0.501, 0.5});
+    // bulging less than a pixel
+    batch << Segment({0.1, 0.5}, vec2(1, 0.01).normalized(), {0.9, 0.5});
+    batch.flush();
+
+    EXPECT_EQ(3, batch.culledCount);
+    EXPECT_EQ("line 0.1 0.1 0.9 0.1\nline 0.1 0.5 0.9 0.5\n", out.str());
+}
+
+// BUFFER
+
+Path polygon (std::vector<vec2> corners) {
+    Path path;
+    for (int i = 0; i < corners.size(); i++) path.add(Segment(corners[i], corners[(i + 1) % corners.size()]));
+    return path;
+}
+
+Path moved (Path path, vec2 by) {
+    Path movedPath;
+    for (auto& segment : path.segments) {
+        if (segment.isStraight()) movedPath.add(Segment(segment.start + by, segment.end + by));
+        else movedPath.add(Segment(segment.start + by, segment.direction, segment.end + by));
+    }
+    return movedPath;
+}
+
+// every point of the buffer outlines is distance away from the outline, and their segments meet
+void expectAtDistance (Path& outline, std::vector<Path>& buffer, float distance) {
+    for (auto& path : buffer) {
+        EXPECT_TRUE(path.isClosed());
+        for (int s = 1; s < path.segments.size(); s++) {
+            EXPECT_LT((path.segments[s].start - path.segments[s - 1].end).norm(), PIECE_LINK_DISTANCE);
+        }
+        for (float along = 0; along < path.length(); along += 0.01) {
+            vec2 point = path.pointAt(along);
+            float closest = INFINITY;
+            for (auto& segment : outline.segments) closest = std::min(closest, segment.distanceTo(point));
+            EXPECT_NEAR(distance, closest, 0.001);
+        }
+    }
+}
+
+TEST(CompassBuffer, Square) {
+    auto square = rectangle({0, 0}, {1, 1});
+    auto grown = buffered(square, 0.1);
+    ASSERT_EQ(1, grown.size());
+    EXPECT_EQ(8, grown[0].segments.size());
+    EXPECT_NEAR(1 + 4 * 0.1 + M_PI * 0.01, grown[0].signedArea(), PRECISION);
+    for (auto& segment : grown[0].segments) {
+        if (!segment.isStraight()) EXPECT_NEAR(0.1, segment.radius(), PRECISION);
+    }
+    expectAtDistance(square, grown, 0.1);
+
+    auto shrunk = buffered(square, -0.1);
+    ASSERT_EQ(1, shrunk.size());
+    EXPECT_NEAR(0.64, shrunk[0].signedArea(), PRECISION);
+
+    auto clockwise = square.reversed();
+    auto grownClockwise = buffered(clockwise, 0.1);
+    ASSERT_EQ(1, grownClockwise.size());
+    EXPECT_NEAR(-(1 + 4 * 0.1 + M_PI * 0.01), grownClockwise[0].signedArea(), PRECISION);
+}
+
+TEST(CompassBuffer, NarrowGapCloses) {
+    // a U whose gap is narrower than twice the distance
+    auto u = polygon({{0, 0}, {1, 0}, {1, 1}, {0.55, 1}, {0.55, 0.3}, {0.45, 0.3}, {0.45, 1}, {0, 1}});
+    auto grown = buffered(u, 0.1);
+    whiteboard << wb::clear << u;
+    for (auto& path : grown) whiteboard << wb::color{255, 0, 0, 255} << path;
+
+    ASSERT_EQ(1, grown.size());
+    EXPECT_FALSE(grown[0].isClockwise());
+    expectAtDistance(u, grown, 0.1);
+    // nothing is left inside the gap
+    for (auto& segment : grown[0].segments) {
+        EXPECT_FALSE(BoundingBox({0.4, 0.2}, {0.6, 1}).contains(segment.midpoint()));
+    }
+}
+
+TEST(CompassBuffer, RingLeavesHole) {
+    // a C that closes into a ring with a hole
+    auto c = polygon({{0, 0}, {1, 0}, {1, 1}, {0.55, 1}, {0.55, 0.8}, {0.8, 0.8}, {0.8, 0.2}, {0.2, 0.2},
+                      {0.2, 0.8}, {0.45, 0.8}, {0.45, 1}, {0, 1}});
+    auto grown = buffered(c, 0.06);
+    ASSERT_EQ(2, grown.size());
+    int holes = 0;
+    for (auto& path : grown) holes += path.isClockwise();
+    EXPECT_EQ(1, holes);
+    expectAtDistance(c, grown, 0.06);
+}
+
+TEST(CompassBuffer, FarFromOrigin) {
+    // a building with notches front and back, where floats only have a few digits below a millimeter left
+    auto building = polygon({{728.100891, 745.650574}, {716.499939, 744.355042}, {716.674255, 742.794128},
+                             {710.873779, 742.146423}, {710.699463, 743.707336}, {699.098511, 742.411804},
+                             {701.023071, 725.178162}, {712.243652, 726.431152}, {711.190735, 735.860229},
+                             {717.751831, 736.592957}, {718.80481, 727.163879}, {730.025391, 728.41687}});
+    ShapeBuffer builder;
+    std::vector<Path> grown;
+    // wide enough to close the back notch, whose offset corners only just cross
+    ASSERT_EQ(1, builder.buffer(building, 6, grown));
+    EXPECT_EQ(0, builder.unlinkedCount);
+    expectAtDistance(building, grown, 6);
+}
+
+TEST(CompassBuffer, BatchedOutlines) {
+    // rectangles, whose buffers have a known area, between star polygons, spread out along x
+    std::vector<Path> outlines;
+    std::mt19937 generator(73);
+    for (int i = 0; i < 200; i++) {
+        vec2 at(3 * i, i % 7);
+        vec2 size(0.3 + 0.01 * (i % 20), 0.4 + 0.013 * (i % 11));
+        if (i % 2) outlines.push_back(moved(polygon(randomStarPolygon(generator, 4 + i % 9)), at));
+        else outlines.push_back(rectangle(at, at + size));
+    }
+
+    WorkStealingPool pool(4);
+    std::vector<std::vector<Path>> grown, shrunk;
+    bufferAll(outlines, 0.05, grown, pool);
+    bufferAll(outlines, -0.05, shrunk, pool);
+
+    ASSERT_EQ(outlines.size(), grown.size());
+    ASSERT_EQ(outlines.size(), shrunk.size());
+    for (int i = 0; i < outlines.size(); i++) {
+        ASSERT_EQ(1, grown[i].size());
+        if (i % 2) {
+            expectAtDistance(outlines[i], grown[i], 0.05);
+            expectAtDistance(outlines[i], shrunk[i], 0.05);
+        } else {
+            // measured back at the origin, where signedArea doesn't lose digits
+            vec2 at = outlines[i].segments[0].start;
+            float w = 0.3 + 0.01 * (i % 20), h = 0.4 + 0.013 * (i % 11), d = 0.05;
+            EXPECT_NEAR(w * h + 2 * d * (w + h) + M_PI * d * d, moved(grown[i][0], -at).signedArea(), PRECISION);
+            ASSERT_EQ(1, shrunk[i].size());
+            EXPECT_NEAR((w - 2 * d) * (h - 2 * d), moved(shrunk[i][0], -at).signedArea(), PRECISION);
+        }
+    }
+}
+
+// OVERLAP
+
+// every pair of segments, then whether one contains the other
+bool overlapsBruteForce (Path& a, Path& b) {
+    for (auto& segmentA : a.segments) {
+        for (auto& segmentB : b.segments) {
+            if (intersect(segmentA, segmentB).size()) return true;
+        }
+    }
+    return b.contains(a.segments[0].start) || a.contains(b.segments[0].start);
+}
+
+TEST(CompassOverlap, Polygons) {
+    auto square = rectangle({0, 0}, {1, 1});
+    auto apart = rectangle({2, 0}, {3, 1});
+    auto touching = rectangle({1, 0}, {2, 1});
+    auto crossing = rectangle({0.5, 0.5}, {1.5, 1.5});
+    auto inside = rectangle({0.25, 0.25}, {0.75, 0.75});
+    EXPECT_FALSE(overlaps(square, apart));
+    EXPECT_TRUE(overlaps(square, touching));
+    EXPECT_TRUE(overlaps(square, crossing));
+    EXPECT_TRUE(overlaps(square, inside));
+    EXPECT_TRUE(overlaps(inside, square));
+    auto insideClockwise = inside.reversed();
+    EXPECT_TRUE(overlaps(square, insideClockwise));
+
+    // bounds overlap, but the square sits in the notch of the L
+    auto l = polygon({{0, 0}, {2, 0}, {2, 1}, {1, 1}, {1, 2}, {0, 2}});
+    auto inNotch = rectangle({1.2, 1.2}, {1.8, 1.8});
+    EXPECT_EQ(POLYGON, shapeKind(l));
+    EXPECT_EQ(CONVEX_POLYGON, shapeKind(inNotch));
+    EXPECT_FALSE(overlaps(l, inNotch));
+    EXPECT_FALSE(overlaps(inNotch, l));
+    auto overCorner = rectangle({0.8, 0.8}, {1.8, 1.8});
+    EXPECT_TRUE(overlaps(l, overCorner));
+}
+
+TEST(CompassOverlap, MatchesBruteForce) {
+    std::mt19937 generator(81);
+    std::uniform_real_distribution<float> offset(-1.5, 1.5);
+    std::vector<Path> shapes;
+    for (int i = 0; i < 40; i++) {
+        vec2 at(offset(generator), offset(generator));
+        if (i % 3 == 0) shapes.push_back(wobblyOutline(at, 0.6, 4 + i % 7, 82 + i));
+        else if (i % 3 == 1) shapes.push_back(moved(polygon(randomStarPolygon(generator, 4 + i % 9)), at));
+        else shapes.push_back(rectangle(at, at + vec2(0.3 + 0.02 * i, 0.5)));
+    }
+
+    OverlapTester tester;
+    int overlapping = 0;
+    for (auto& a : shapes) {
+        for (auto& b : shapes) {
+            bool expected = overlapsBruteForce(a, b);
+            EXPECT_EQ(expected, tester.overlaps(a, b));
+            overlapping += expected;
+        }
+    }
+    // both answers come up
+    EXPECT_GT(overlapping, 2 * shapes.size());
+    EXPECT_LT(overlapping, shapes.size() * shapes.size() / 2);
+}
+
+TEST(CompassOverlap, Batched) {
+    // a 10 by 10 grid of 0.6 wide squares and circles, shape x + 10y at x, y with gaps of 0.4
+    std::vector<Path> shapes;
+    for (int i = 0; i < 100; i++) {
+        vec2 at(i % 10, i / 10);
+        if (i % 3 == 0) shapes.push_back(circle(at + vec2(0.3, 0.3), 0.3));
+        else shapes.push_back(rectangle(at, at + vec2(0.6, 0.6)));
+    }
+    std::vector<BoundingBox> bounds;
+    std::vector<ShapeKind> kinds;
+    prepareShapes(shapes, bounds, kinds);
+
+    OverlapTester tester;
+    std::vector<int> found;
+    auto expectOverlapping = [&](Path candidate, std::vector<int> expected) {
+        tester.overlapping(candidate, shapes, bounds, kinds, found);
+        EXPECT_EQ(expected, found);
+        EXPECT_EQ(expected.empty() ? -1 : expected[0], tester.firstOverlapping(candidate, shapes, bounds, kinds));
+    };
+    // across a row, over the left side of the circle 54
+    expectOverlapping(rectangle({2.2, 5.1}, {4.3, 5.2}), {52, 53, 54});
+    // inside the square 37
+    expectOverlapping(rectangle({7.2, 3.2}, {7.4, 3.4}), {37});
+    // between the squares 55, 56, 65 and 66
+    expectOverlapping(rectangle({5.65, 5.65}, {5.95, 5.95}), {});
+    // over the corner of the bounds of the circle 0, but not the circle
+    expectOverlapping(rectangle({-0.5, -0.5}, {0.05, 0.05}), {});
+    // an L in the gaps, whose bounds cover 11, 12, 21 and 22
+    expectOverlapping(polygon({{0.7, 0.7}, {2.9, 0.7}, {2.9, 0.9}, {0.9, 0.9}, {0.9, 2.9}, {0.7, 2.9}}), {});
+    // a circle between the corners of 88, 89, 98 and the circle 99
+    expectOverlapping(circle({8.8, 8.8}, 0.5), {88, 89, 98, 99});
+}
+
+// CLIPPER
+
+float totalArea (std::vector<Path> paths) {
+    float area = 0;
+    for (auto& path : paths) area += path.signedArea();
+    return area;
+}
+
+TEST(CompassClipper, OverlappingSquares) {
+    auto a = rectangle({0, 0}, {1, 1});
+    auto b = rectangle({0.5, 0.5}, {1.5, 1.5});
+
+    auto intersection = clip(INTERSECTION, a, b);
+    whiteboard << wb::clear << a << b;
+    for (auto& path : intersection) whiteboard << wb::color{255, 0, 0, 255} << path;
+
+    ASSERT_EQ(1, intersection.size());
+    EXPECT_EQ(4, intersection[0].segments.size());
+    EXPECT_NEAR(0.25, totalArea(intersection), PRECISION);
+
+    auto united = clip(UNION, a, b);
+    ASSERT_EQ(1, united.size());
+    EXPECT_EQ(8, united[0].segments.size());
+    EXPECT_NEAR(1.75, totalArea(united), PRECISION);
+
+    auto difference = clip(DIFFERENCE, a, b);
+    ASSERT_EQ(1, difference.size());
+    EXPECT_NEAR(0.75, totalArea(difference), PRECISION);
+
+    auto inverseDifference = clip(NOT, a, b);
+    ASSERT_EQ(1, inverseDifference.size());
+    EXPECT_NEAR(0.75, totalArea(inverseDifference), PRECISION);
+}
+
+TEST(CompassClipper, SharedEdge) {
+    auto a = rectangle({0, 0}, {1, 1});
+    auto b = rectangle({1, 0}, {2, 1});
+
+    EXPECT_EQ(0, clip(INTERSECTION, a, b).size());
+
+    auto united = clip(UNION, a, b);
+    ASSERT_EQ(1, united.size());
+    EXPECT_EQ(4, united[0].segments.size());
+    EXPECT_NEAR(2, totalArea(united), PRECISION);
+
+    auto difference = clip(DIFFERENCE, a, b);
+    EXPECT_NEAR(1, totalArea(difference), PRECISION);
+}
+
+TEST(CompassClipper, WeldsAcrossLoopStart) {
+    // the subject starts in the middle of its bottom edge, which comes out as one segment
+    auto a = polygon({{0.5, 0}, {1, 0}, {1, 1}, {0, 1}, {0, 0}});
+    auto b = rectangle({-1, -1}, {2, 2});
+    Clipper clipper;
+    std::vector<Path> out;
+    ASSERT_EQ(1, clipper.clip(INTERSECTION, a, b, out));
+    EXPECT_EQ(4, out[0].segments.size());
+    EXPECT_NEAR(1, out[0].signedArea(), PRECISION);
+    EXPECT_EQ(0, clipper.unclosedCount);
+
+    // the same for arcs, a half disc starting in the middle of its arc
+    Path halfDisc;
+    halfDisc.add(Segment({1, 0}, {0, 1}, {0, 1}));
+    halfDisc.add(Segment({0, 1}, {0, -1}));
+    halfDisc.add(Segment({0, -1}, {1, 0}, {1, 0}));
+    ASSERT_EQ(1, clipper.clip(INTERSECTION, halfDisc, b, out));
+    EXPECT_EQ(2, out[0].segments.size());
+    EXPECT_NEAR(M_PI / 2, out[0].signedArea(), PRECISION);
+    EXPECT_EQ(0, clipper.unclosedCount);
+}
+
+TEST(CompassClipper, PartiallySharedEdge) {
+    auto a = rectangle({0, 0}, {1, 1});
+    auto b = rectangle({1, 0.5}, {2, 1.5});
+
+    auto united = clip(UNION, a, b);
+    ASSERT_EQ(1, united.size());
+    EXPECT_NEAR(2, totalArea(united), PRECISION);
+}
+
+TEST(CompassClipper, SameSquare) {
+    auto a = rectangle({0, 0}, {1, 1});
+    auto b = rectangle({0, 0}, {1, 1});
+
+    EXPECT_NEAR(1, totalArea(clip(INTERSECTION, a, b)), PRECISION);
+    EXPECT_NEAR(1, totalArea(clip(UNION, a, b)), PRECISION);
+    EXPECT_EQ(0, clip(DIFFERENCE, a, b).size());
+}
+
+TEST(CompassClipper, Hole) {
+    auto a = rectangle({0, 0}, {1, 1});
+    auto b = rectangle({0.25, 0.25}, {0.75, 0.75}).reversed();
+
+    auto difference = clip(DIFFERENCE, a, b);
+    ASSERT_EQ(2, difference.size());
+    EXPECT_NEAR(0.75, totalArea(difference), PRECISION);
+}
+
+TEST(CompassClipper, SquareAndCircle) {
+    auto a = rectangle({0, 0}, {1, 1});
+    auto b = circle({1, 1}, 0.5);
+
+    auto intersection = clip(INTERSECTION, a, b);
+    whiteboard << wb::clear << a << b;
+    for (auto& path : intersection) whiteboard << wb::color{255, 0, 0, 255} << path;
+
+    ASSERT_EQ(1, intersection.size());
+    EXPECT_EQ(3, intersection[0].segments.size());
+    EXPECT_NEAR(M_PI * 0.25 / 4, totalArea(intersection), PRECISION);
+
+    auto united = clip(UNION, a, b);
+    ASSERT_EQ(1, united.size());
+    EXPECT_NEAR(1 + M_PI * 0.25 * 3 / 4, totalArea(united), PRECISION);
+}
+
+TEST(CompassClipper, ReusedClipperKeepsCapacity) {
+    Clipper clipper;
+    std::vector<Path> out;
+    // three teeth standing on a base, crossed by a bar: their intersection falls apart into three squares
+    auto comb = polygon({{0, 0}, {5, 0}, {5, 3}, {4, 3}, {4, 0.5}, {3, 0.5},
+                         {3, 3}, {2, 3}, {2, 0.5}, {1, 0.5}, {1, 3}, {0, 3}});
+    auto bar = rectangle({-1, 1}, {6, 2});
+    auto a = rectangle({0, 0}, {1, 1});
+    auto b = rectangle({0.5, 0.5}, {1.5, 1.5});
+
+    ASSERT_EQ(3, clipper.clip(INTERSECTION, comb, bar, out));
+    ASSERT_EQ(3, out.size());
+    std::vector<size_t> capacities;
+    std::vector<const Segment*> data;
+    for (auto& path : out) {
+        capacities.push_back(path.segments.capacity());
+        data.push_back(path.segments.data());
+    }
+
+    ASSERT_EQ(1, clipper.clip(INTERSECTION, a, b, out));
+    ASSERT_EQ(3, out.size());
+    EXPECT_NEAR(0.25, out[0].signedArea(), PRECISION);
+    EXPECT_TRUE(out[1].segments.empty());
+    EXPECT_TRUE(out[2].segments.empty());
+
+    ASSERT_EQ(3, clipper.clip(INTERSECTION, comb, bar, out));
+    ASSERT_EQ(3, out.size());
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(capacities[i], out[i].segments.capacity());
+        EXPECT_EQ(data[i], out[i].segments.data());
+        EXPECT_NEAR(1, out[i].signedArea(), PRECISION);
+    }
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
@@ -1,7 +1,12 @@
 #ifndef COMPASS_WHITEBOARD_COMPASS_H
 #define COMPASS_WHITEBOARD_COMPASS_H
 
+#include <string>
+#include <cstdio>
+#include <initializer_list>
 #include "primitives.h"
+#include "path.h"
+#include "bounding-box.h"
 typedef Eigen::Vector2f vec2;
 
 wb::draw_stream& operator<< (wb::draw_stream& drawStream, vec2 point) {
@@ -39,4 +44,138 @@ wb::draw_stream& operator<< (wb::draw_stream& drawStream, Ray ray) {
     return drawStream << Segment(ray.start, ray.start + 1000 * ray.direction);
 }
 
+wb::draw_stream& operator<< (wb::draw_stream& drawStream, Path path) {
+    for (auto& segment : path.segments) drawStream << segment;
+    return drawStream;
+}
+
+// BATCHED DRAWING
+
+// Buffers draw commands and hands them to the draw stream in blocks of blockSize commands,
+// instead of formatting every command into the stream on its own. The blocks are the same
+// lines the draw_stream operators above write, so the viewer reads them unchanged.
+// With a viewport, everything outside of it is dropped and segments smaller than a pixel
+// are too, arcs that bulge less than a pixel are drawn as lines.
+// Anything else (wb::clear, colors) flushes the batch first and is passed through, to keep the order.
+class WhiteboardBatch {
+    wb::draw_stream& drawStream;
+    int blockSize;
+    int commands;
+    std::string buffer;
+
+    bool culling;
+    BoundingBox viewport;
+    float pixelSize;
+
+public:
+    int culledCount;
+
+    WhiteboardBatch (wb::draw_stream& drawStream, int blockSize = 4096)
+        : drawStream(drawStream), blockSize(blockSize), commands(0),
+          culling(false), pixelSize(0), culledCount(0) {};
+
+    WhiteboardBatch (const WhiteboardBatch&) = delete;
+    WhiteboardBatch& operator= (const WhiteboardBatch&) = delete;
+
+    ~WhiteboardBatch () {
+        flush();
+    }
+
+    void setViewport (BoundingBox bounds, float pixelSize) {
+        culling = true;
+        viewport = bounds;
+        this->pixelSize = pixelSize;
+    }
+
+    void clearViewport () {
+        culling = false;
+    }
+
+    void flush () {
+        if (!commands) return;
+        // the last line is ended by lineDone()
+        buffer.pop_back();
+        drawStream.startOutput() << buffer;
+        drawStream.lineDone();
+        buffer.clear();
+        commands = 0;
+    }
+
+    WhiteboardBatch& operator<< (vec2 point) {
+        if (culling && !viewport.contains(point)) {
+            culledCount++;
+            return *this;
+        }
+        appendText("dot", {point[0], point[1]});
+        return commandDone();
+    }
+
+    WhiteboardBatch& operator<< (Segment segment) {
+        bool straight = segment.isStraight();
+        if (culling) {
+            BoundingBox bounds = boundsOf(segment);
+            vec2 extent = bounds.extent();
+            if (!bounds.overlaps(viewport) || (extent[0] < pixelSize && extent[1] < pixelSize)) {
+                culledCount++;
+                return *this;
+            }
+            if (!straight) {
+                // how far the arc bulges away from its chord, for arcs spanning less than half a circle
+                float sagitta = segment.radius() - (segment.radialCenter() - (segment.start + segment.end) / 2).norm();
+                straight = segment.angleSpan() < M_PI && sagitta < pixelSize;
+            }
+        }
+
+        if (straight) {
+            appendText("line", {segment.start[0], segment.start[1], segment.end[0], segment.end[1]});
+        } else {
+            appendText("arc", {segment.start[0], segment.start[1], segment.direction[0], segment.direction[1],
+                               segment.end[0], segment.end[1]});
+        }
+        return commandDone();
+    }
+
+    WhiteboardBatch& operator<< (Circle circle) {
+        return *this << Segment(circle.center + vec2(0, -circle.radius), vec2(1, 0), circle.center + vec2(0, circle.radius))
+                     << Segment(circle.center + vec2(0, circle.radius), vec2(-1, 0), circle.center + vec2(0, -circle.radius));
+    }
+
+    WhiteboardBatch& operator<< (Line line) {
+        return *this << Segment(line.start - 1000 * line.direction, line.start + 1000 * line.direction);
+    }
+
+    WhiteboardBatch& operator<< (Ray ray) {
+        return *this << Segment(ray.start, ray.start + 1000 * ray.direction);
+    }
+
+    WhiteboardBatch& operator<< (Path path) {
+        for (auto& segment : path.segments) *this << segment;
+        return *this;
+    }
+
+    template <typename Command>
+    WhiteboardBatch& operator<< (const Command& command) {
+        flush();
+        drawStream << command;
+        return *this;
+    }
+
+private:
+    // formatted like the default std::ostream formatting of the draw_stream operators
+    void appendText (const char* name, std::initializer_list<float> coordinates) {
+        char number[32];
+        buffer += name;
+        for (float coordinate : coordinates) {
+            int length = std::snprintf(number, sizeof(number), " %g", coordinate);
+            buffer.append(number, length);
+        }
+        buffer += '\n';
+    }
+
+    WhiteboardBatch& commandDone () {
+        if (++commands == blockSize) flush();
+        return *this;
+    }
+};
+
 #endif //COMPASS_WHITEBOARD_COMPASS_H
@@ -0,0 +1,151 @@
+#ifndef COMPASS_WORK_STEALING_POOL_H
+#define COMPASS_WORK_STEALING_POOL_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Runs the tasks 0 ... n - 1 on threadCount threads, the calling thread being one of them.
+// Every thread starts with an equal contiguous range of tasks, takes tasks from the front of
+// its own range and, once that is empty, steals the back half of another thread's range.
+// The other threads are started once and wait for the next run between runs, so a pool
+// is meant to live as long as the batches it runs. Call run from one thread at a time,
+// and not from inside a task.
+class WorkStealingPool {
+    struct TaskRange {
+        std::mutex mutex;
+        int begin = 0;
+        int end = 0;
+    };
+
+    int threadCount;
+    std::unique_ptr<TaskRange[]> ranges;
+    std::vector<std::thread> helpers;
+
+    // the current run, guarded by mutex: the task function without its type, the threads taking part,
+    // how many helpers still work on it, and a count of runs that tells helpers a new one started
+    std::mutex mutex;
+    std::condition_variable started;
+    std::condition_variable finished;
+    void (*call) (void* function, int task) = nullptr;
+    void* function = nullptr;
+    int participants = 0;
+    int working = 0;
+    long runs = 0;
+    bool stopping = false;
+
+public:
+    // a threadCount of 0 uses all hardware threads
+    explicit WorkStealingPool (int threadCount = 0)
+            : threadCount(threadCount > 0 ? threadCount : std::max(1, int(std::thread::hardware_concurrency()))),
+              ranges(new TaskRange[this->threadCount]) {
+        for (int t = 1; t < this->threadCount; t++) helpers.push_back(std::thread([this, t]() { serve(t); }));
+    };
+
+    ~WorkStealingPool () {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        started.notify_all();
+        for (auto& helper : helpers) helper.join();
+    }
+
+    int size () const {
+        return threadCount;
+    }
+
+    // Calls f(task) once for every task, concurrently, returns when all tasks are done
+    template <typename F>
+    void run (int taskCount, F f) {
+        int threads = std::min(threadCount, std::max(1, taskCount));
+        for (int t = 0; t < threads; t++) {
+            ranges[t].begin = int(long(taskCount) * t / threads);
+            ranges[t].end = int(long(taskCount) * (t + 1) / threads);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            call = [](void* erased, int task) { (*static_cast<F*>(erased))(task); };
+            function = &f;
+            participants = threads;
+            working = threads - 1;
+            runs++;
+        }
+        if (threads > 1) started.notify_all();
+
+        work(0, threads);
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this]() { return working == 0; });
+    }
+
+    // Calls f(begin, end) for the items 0 ... itemCount - 1 in consecutive ranges of rangeSize, one task each,
+    // for items too small to be tasks of their own. f can set up its scratch state once for a whole range.
+    template <typename F>
+    void runRanges (int itemCount, int rangeSize, F f) {
+        run((itemCount + rangeSize - 1) / rangeSize, [&](int task) {
+            f(task * rangeSize, std::min(itemCount, (task + 1) * rangeSize));
+        });
+    }
+
+private:
+    // a helper thread, works on every run that has enough tasks for it until the pool is destroyed
+    void serve (int self) {
+        long seen = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            started.wait(lock, [&]() { return stopping || runs != seen; });
+            if (stopping) return;
+            seen = runs;
+            int threads = participants;
+            if (self >= threads) continue;
+
+            lock.unlock();
+            work(self, threads);
+            lock.lock();
+            if (--working == 0) finished.notify_one();
+        }
+    }
+
+    void work (int self, int threads) {
+        while (true) {
+            int task;
+            if (takeOwn(self, task)) call(function, task);
+            else if (!steal(self, threads)) return;
+        }
+    }
+
+    bool takeOwn (int self, int& task) {
+        std::lock_guard<std::mutex> lock(ranges[self].mutex);
+        if (ranges[self].begin == ranges[self].end) return false;
+        task = ranges[self].begin++;
+        return true;
+    }
+
+    // Moves the back half of the first non-empty other range into our own, false if there is none
+    bool steal (int self, int threads) {
+        for (int offset = 1; offset < threads; offset++) {
+            auto& victim = ranges[(self + offset) % threads];
+            int begin, end;
+            {
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                int remaining = victim.end - victim.begin;
+                if (remaining == 0) continue;
+                begin = victim.end - (remaining + 1) / 2;
+                end = victim.end;
+                victim.end = begin;
+            }
+
+            std::lock_guard<std::mutex> lock(ranges[self].mutex);
+            ranges[self].begin = begin;
+            ranges[self].end = end;
+            return true;
+        }
+        return false;
+    }
+};
+
+#endif //COMPASS_WORK_STEALING_POOL_H